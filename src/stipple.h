@@ -22,14 +22,37 @@
 #define MEMBUF_I32_COUNT 64   /* MB_I32: 64 elements */
 #define MEMBUF_U32_COUNT 64   /* MB_U32: 64 elements */
 #define MEMBUF_F32_COUNT 64   /* MB_FLOAT: 64 elements */
+#define MEMBUF_BIT_COUNT 2048 /* MB_BIT: 2048 bits */
+#define MEMBUF_BIT_WORDS 64   /* MB_BIT: 32-bit words backing the bitset */
+#define MEMBUF_I64_COUNT 32   /* MB_I64: 32 elements */
 
 /* Stack configuration */
 #define STACK_DEPTH 32           /* Maximum nested function calls */
 #define STACK_VAR_COUNT 16       /* Stack variables per frame */
 #define STACK_LOCALS_COUNT 64    /* Local variables per frame */
 
-/* Instruction memory */
-#define PROGRAM_MAX_SIZE 65536   /* 64KB instruction memory */
+/* Instruction memory; both limits can be overridden at build time (-D) */
+#ifndef PROGRAM_MAX_SIZE
+#define PROGRAM_MAX_SIZE 65536   /* 64KB built-in instruction memory (program[]) */
+#endif
+#ifndef PROGRAM_MAP_MAX_SIZE
+#define PROGRAM_MAP_MAX_SIZE (16 * 1024 * 1024)  /* Code run in place by vm_attach_program() */
+#endif
+#define PROGRAM_IMAGE_MAX_SIZE (PROGRAM_MAX_SIZE * 2)  /* Program file: code plus container metadata */
+
+/* Host-side I/O buffers (VM_IO_HOST mode) */
+#define VM_IO_INPUT_SIZE 1024    /* Bytes of pending input per VM */
+#define VM_IO_OUTPUT_SIZE 1024   /* Bytes of undrained output per VM */
+
+/* Host (native) function table */
+#define HOST_FN_COUNT 32         /* Registered native functions per VM */
+
+/* Exception handler table (HANDLERS section) */
+#define VM_MAX_HANDLERS 64       /* Handler entries per program */
+
+/* Breakpoints patched in by vm_break_set() */
+#define VM_MAX_BREAKPOINTS 32    /* Per VM */
+#define VM_BREAK_STARTS_WORDS(len) (((len) / 32u) + 1u)  /* Instruction-start bitmap words for len code bytes */
 
 /* Instruction sizes in bytes */
 #define INSTRUCTION_HEADER_SIZE 4
@@ -38,6 +61,9 @@
 #define INSTRUCTION_MEDIUM_SIZE 12
 #define INSTRUCTION_LARGE_SIZE 16
 
+_Static_assert(PROGRAM_MAX_SIZE % 4 == 0 && PROGRAM_MAX_SIZE <= PROGRAM_MAP_MAX_SIZE,
+               "PROGRAM_MAX_SIZE must be word aligned and within PROGRAM_MAP_MAX_SIZE");
+
 /* Maximum payload length in 4-byte words */
 #define INSTRUCTION_MAX_PAYLOAD_WORDS 3
 
@@ -62,7 +88,13 @@ typedef enum {
 	VM_ERR_INVALID_INSTRUCTION,   /* Malformed instruction */
 	VM_ERR_PROGRAM_TOO_LARGE,     /* Program exceeds maximum size */
 	VM_ERR_OVERFLOW,              /* Arithmetic overflow or invalid float result */
-	VM_ERR_HALT                   /* HALT instruction executed (not an error) */
+	VM_ERR_HALT,                  /* HALT instruction executed (not an error) */
+	/* New codes go below: programs, serve replies and exit codes see these values */
+	VM_ERR_INVALID_HOST_FN,       /* Host function index out of range or unregistered */
+	VM_ERR_INVALID_IMAGE,         /* Malformed container header, section table or metadata */
+	VM_ERR_LINK,                  /* Unresolved import, duplicate export or unlinkable module */
+	VM_YIELD,                     /* Suspended for the host; resume with vm_step/vm_run (not an error) */
+	VM_BREAK                      /* Stopped at a breakpoint or watchpoint for a debugger (not an error) */
 } vm_status_t;
 
 /* ============================================================================
@@ -81,7 +113,9 @@ typedef enum {
 	V_GLOBAL_VAR_IDX,   /* Reference to global variable */
 	V_STACK_VAR_IDX,    /* Reference to stack variable */
 	V_BUF_IDX,          /* Reference to memory buffer */
-	V_BUF_POS           /* Position within memory buffer */
+	V_BUF_POS,          /* Position within memory buffer */
+	V_I64,              /* Signed 64-bit integer */
+	V_U64               /* Unsigned 64-bit integer */
 } var_value_type_t;
 
 /* Type aliases for clarity */
@@ -104,11 +138,13 @@ typedef struct {
 		uint8_t u8x4[4];                /* V_U8 */
 		uint16_t u16x2[2];              /* V_U16 */
 		stack_var_ref_t stack_var_ref;  /* V_STACK_VAR_IDX */
+		int64_t i64;                    /* V_I64 */
+		uint64_t u64;                   /* V_U64 */
 	} val;
 } var_value_t;
 
-/* Static assertion to verify var_value_t size */
-_Static_assert(sizeof(var_value_t) <= 12, "var_value_t too large");
+/* Static assertion to verify var_value_t size (64-bit members force 8-byte alignment) */
+_Static_assert(sizeof(var_value_t) <= 16, "var_value_t too large");
 
 /* ============================================================================
  * Memory Buffers
@@ -121,7 +157,9 @@ typedef enum {
 	MB_U16,         /* Array of 128 unsigned 16-bit values */
 	MB_I32,         /* Array of 64 signed 32-bit values */
 	MB_U32,         /* Array of 64 unsigned 32-bit values */
-	MB_FLOAT        /* Array of 64 float values */
+	MB_FLOAT,       /* Array of 64 float values */
+	MB_BIT,         /* Bitset of 2048 bits packed into 64 words */
+	MB_I64          /* Array of 32 signed 64-bit values */
 } membuf_type_t;
 
 /* Memory buffer with typed storage */
@@ -133,11 +171,13 @@ typedef struct {
 		int32_t i32x64[G_MEMBUF_LEN / 4];
 		uint32_t u32x64[G_MEMBUF_LEN / 4];
 		float f32x64[G_MEMBUF_LEN / 4];
+		uint32_t bitx64[MEMBUF_BIT_WORDS];  /* Bit n is bit (n % 32) of word n / 32 */
+		int64_t i64x32[G_MEMBUF_LEN / 8];
 	} buf;
 } membuf_t;
 
-/* Static assertion to verify membuf_t size */
-_Static_assert(sizeof(membuf_t) <= 260, "membuf_t too large");
+/* Static assertion to verify membuf_t size (type tag padded to 8 bytes) */
+_Static_assert(sizeof(membuf_t) <= 264, "membuf_t too large");
 
 /* ============================================================================
  * Stack Frame Structure
@@ -149,8 +189,11 @@ typedef struct {
 	var_value_t locals[STACK_LOCALS_COUNT];   /* Local variables */
 	var_value_t ret_val;                      /* Return value */
 	uint32_t return_addr;                     /* Return address (PC) */
+	uint64_t locals_live;                     /* Bit i: locals[i] stored since the frame was entered */
 } stack_frame_t;
 
+_Static_assert(STACK_LOCALS_COUNT <= 64, "locals_live needs a bit per local");
+
 /* ============================================================================
  * Instruction Format
  * ============================================================================ */
@@ -240,6 +283,33 @@ _Static_assert(sizeof(medium_instruction_t) == INSTRUCTION_MEDIUM_SIZE,
 _Static_assert(sizeof(large_instruction_t) == INSTRUCTION_LARGE_SIZE, 
                "large_instruction_t must be 16 bytes");
 
+/*
+ * Compact encoding (VM_ENCODING_COMPACT, flagged in the image container):
+ * opcode, operand and a form byte, then the immediates packed without
+ * alignment. Form bits 0-1/2-3/4-5 give the width of imm1/imm2/imm3
+ * (0 absent, 1: 1 byte, 2: 2 bytes, 3: 4 bytes; short widths are
+ * zero-extended). COMPACT_FORM_NIBBLES replaces imm1 and imm2 with a single
+ * byte holding both as nibbles, so a three-operand stack op fits in 4 bytes.
+ * JMP_TABLE entries stay 4-byte words after the instruction.
+ */
+#define COMPACT_HEADER_SIZE 3
+#define COMPACT_FORM_WIDTH(form, i) (((form) >> ((i) * 2u)) & 0x03u)
+#define COMPACT_FORM_NIBBLES  0x40u  /* imm1 = low nibble, imm2 = high nibble of the next byte */
+#define COMPACT_FORM_RESERVED 0x80u  /* Must be 0 */
+
+/* Instruction encodings understood by the decoder */
+typedef enum {
+	VM_ENCODING_WIDE = 0,  /* 4-byte header plus 0-3 32-bit words (raw images) */
+	VM_ENCODING_COMPACT    /* 3-byte header plus packed immediates */
+} vm_encoding_t;
+
+/* An instruction decoded from either encoding */
+typedef struct {
+	instruction_header_t header;  /* INSTR_PAYLOAD_LEN() is the immediate count */
+	instruction_payload_t imm[INSTRUCTION_MAX_PAYLOAD_WORDS];  /* Absent immediates read as 0 */
+	uint32_t size;                /* Encoded bytes, not counting JMP_TABLE entries */
+} vm_instruction_t;
+
 /* ============================================================================
  * Opcode Definitions
  * ============================================================================ */
@@ -257,6 +327,11 @@ typedef enum {
 	OP_JGE = 0x08,      /* Jump if greater or equal */
 	OP_CALL = 0x09,     /* Call subroutine */
 	OP_RET = 0x0A,      /* Return from subroutine */
+	OP_JMP_TABLE = 0x0B, /* Indexed jump through inline target table */
+	OP_CALL_HOST = 0x0C, /* Call registered native function */
+	OP_YIELD = 0x0D,     /* Suspend execution and return to host */
+	OP_TAILCALL = 0x0E,  /* Call reusing the current frame */
+	OP_CALL_MEMO = 0x0F, /* Call a pure subroutine through the memo table */
 
 	/* Variable Load Operations (0x10-0x1F) */
 	OP_LOAD_G = 0x10,       /* Load global variable to stack var */
@@ -266,6 +341,8 @@ typedef enum {
 	OP_LOAD_I_U32 = 0x14,   /* Load immediate uint32 to stack var */
 	OP_LOAD_I_F32 = 0x15,   /* Load immediate float to stack var */
 	OP_LOAD_RET = 0x16,     /* Load return value from frame */
+	OP_LOAD_I_I64 = 0x17,   /* Load immediate int64 (imm1 low, imm2 high) */
+	OP_LOAD_I_U64 = 0x18,   /* Load immediate uint64 (imm1 low, imm2 high) */
 
 	/* Variable Store Operations (0x20-0x2F) */
 	OP_STORE_G = 0x20,      /* Store stack var to global variable */
@@ -294,6 +371,15 @@ typedef enum {
 	OP_NEG_F32 = 0x44,      /* Negate float */
 	OP_ABS_F32 = 0x45,      /* Absolute value of float */
 	OP_SQRT_F32 = 0x46,     /* Square root of float */
+	OP_EXP_F32 = 0x47,      /* Natural exponential */
+	OP_LOG_F32 = 0x48,      /* Natural logarithm */
+	OP_SIN_F32 = 0x49,      /* Sine (radians) */
+	OP_COS_F32 = 0x4A,      /* Cosine (radians) */
+	OP_POW_F32 = 0x4B,      /* Power: src1 raised to src2 */
+	OP_FLOOR_F32 = 0x4C,    /* Round toward negative infinity */
+	OP_FMA_F32 = 0x4D,      /* Fused multiply-add: src1 * src2 + src3 */
+	OP_VMAP_F32 = 0x4E,     /* Apply unary float opcode to the first N buffer elements */
+	OP_VFMA_F32 = 0x4F,     /* Element-wise fused multiply-add over buffers */
 
 	/* Bitwise Operations - Unsigned Only (0x50-0x5F) */
 	OP_AND_U32 = 0x50,      /* Bitwise AND */
@@ -307,6 +393,11 @@ typedef enum {
 	OP_CMP_I32 = 0x60,      /* Compare signed integers */
 	OP_CMP_U32 = 0x61,      /* Compare unsigned integers */
 	OP_CMP_F32 = 0x62,      /* Compare floats */
+	OP_CMP_I64 = 0x63,      /* Compare signed 64-bit integers */
+	OP_CMP_U64 = 0x64,      /* Compare unsigned 64-bit integers */
+	OP_SELECT = 0x65,       /* Branchless pick of one of two stack vars by condition var */
+	OP_CMOV = 0x66,         /* Branchless pick of one of two stack vars by condition flags */
+	OP_TEST_CONST = 0x67,   /* Set Z if a stack var has the immediate type and value */
 
 	/* Type Conversion Operations (0x70-0x7F) */
 	OP_I32_TO_U32 = 0x70,   /* Convert signed to unsigned int */
@@ -315,12 +406,32 @@ typedef enum {
 	OP_U32_TO_F32 = 0x73,   /* Convert unsigned int to float */
 	OP_F32_TO_I32 = 0x74,   /* Convert float to signed int (truncate) */
 	OP_F32_TO_U32 = 0x75,   /* Convert float to unsigned int (truncate) */
+	OP_I32_TO_I64 = 0x76,   /* Widen signed int to int64 */
+	OP_I64_TO_I32 = 0x77,   /* Narrow int64 to signed int (checked) */
+	OP_U32_TO_U64 = 0x78,   /* Widen unsigned int to uint64 */
+	OP_U64_TO_U32 = 0x79,   /* Narrow uint64 to unsigned int (checked) */
+	OP_I64_TO_U64 = 0x7A,   /* Convert int64 to uint64 */
+	OP_U64_TO_I64 = 0x7B,   /* Convert uint64 to int64 */
+	OP_I64_TO_F32 = 0x7C,   /* Convert int64 to float */
+	OP_F32_TO_I64 = 0x7D,   /* Convert float to int64 (truncate, checked) */
 
 	/* Memory Buffer Access (0x80-0x8F) */
 	OP_BUF_READ = 0x80,     /* Read from buffer to stack var */
 	OP_BUF_WRITE = 0x81,    /* Write stack var to buffer */
 	OP_BUF_LEN = 0x82,      /* Get buffer element count */
 	OP_BUF_CLEAR = 0x83,    /* Clear buffer */
+	OP_BUF_INIT = 0x84,     /* Clear buffer and set its type */
+	OP_BIT_GET = 0x85,      /* Read bit from bitset */
+	OP_BIT_SET = 0x86,      /* Set bit in bitset */
+	OP_BIT_CLR = 0x87,      /* Clear bit in bitset */
+	OP_BIT_TGL = 0x88,      /* Toggle bit in bitset */
+	OP_BIT_CNT = 0x89,      /* Count set bits (popcount) */
+	OP_BIT_FFS = 0x8A,      /* Find first set bit at or after index */
+	OP_BIT_FFC = 0x8B,      /* Find first clear bit at or after index */
+	OP_BIT_AND = 0x8C,      /* Bitset intersection */
+	OP_BIT_OR = 0x8D,       /* Bitset union */
+	OP_BIT_XOR = 0x8E,      /* Bitset symmetric difference */
+	OP_BIT_ANDN = 0x8F,     /* Bitset difference (src1 & ~src2) */
 
 	/* String Operations (0x90-0x9F) */
 	OP_STR_CAT = 0x90,      /* Concatenate strings */
@@ -340,24 +451,96 @@ typedef enum {
 	OP_READ_U32 = 0xA6,     /* Read unsigned integer */
 	OP_READ_F32 = 0xA7,     /* Read float */
 	OP_READ_STR = 0xA8,     /* Read string to buffer */
+	OP_PRINT_I64 = 0xA9,    /* Print signed 64-bit integer */
+	OP_PRINT_U64 = 0xAA,    /* Print unsigned 64-bit integer */
+
+	/* 64-bit Integer Arithmetic (0xB0-0xBF) */
+	OP_ADD_I64 = 0xB0,      /* Add signed 64-bit integers */
+	OP_SUB_I64 = 0xB1,      /* Subtract signed 64-bit integers */
+	OP_MUL_I64 = 0xB2,      /* Multiply signed 64-bit integers */
+	OP_DIV_I64 = 0xB3,      /* Divide signed 64-bit integers */
+	OP_MOD_I64 = 0xB4,      /* Modulo signed 64-bit integers */
+	OP_NEG_I64 = 0xB5,      /* Negate signed 64-bit integer */
+	OP_ADD_U64 = 0xB6,      /* Add unsigned 64-bit integers */
+	OP_SUB_U64 = 0xB7,      /* Subtract unsigned 64-bit integers */
+	OP_MUL_U64 = 0xB8,      /* Multiply unsigned 64-bit integers */
+	OP_DIV_U64 = 0xB9,      /* Divide unsigned 64-bit integers */
+	OP_MOD_U64 = 0xBA,      /* Modulo unsigned 64-bit integers */
+
+	/* Packed Lane Operations on V_U8 (4 lanes) and V_U16 (2 lanes) (0xC0-0xCF) */
+	OP_ADD_PK = 0xC0,       /* Lane-wise add, wrapping */
+	OP_ADDS_PK = 0xC1,      /* Lane-wise add, saturating */
+	OP_SUB_PK = 0xC2,       /* Lane-wise subtract, wrapping */
+	OP_SUBS_PK = 0xC3,      /* Lane-wise subtract, saturating */
+	OP_MIN_PK = 0xC4,       /* Lane-wise unsigned minimum */
+	OP_MAX_PK = 0xC5,       /* Lane-wise unsigned maximum */
+	OP_CMPEQ_PK = 0xC6,     /* Lane-wise equal, all-ones mask lanes */
+	OP_CMPGT_PK = 0xC7,     /* Lane-wise unsigned greater, all-ones mask lanes */
+	OP_SHUF_PK = 0xC8,      /* Rearrange lanes by immediate selector */
+	OP_U32_TO_PK = 0xC9,    /* Reinterpret u32 as packed lanes (lane 0 = low bits) */
+	OP_PK_TO_U32 = 0xCA,    /* Reinterpret packed lanes as u32 (lane 0 = low bits) */
+	OP_BUF_READ_PK = 0xCB,  /* Read 4 bytes / 2 halfwords from buffer as packed */
+	OP_BUF_WRITE_PK = 0xCC, /* Write packed lanes to buffer */
+
+	/* Wrapping and Saturating Integer Arithmetic (0xD0-0xDF) */
+	OP_ADD_WRAP_I32 = 0xD0, /* Add signed integers, two's complement wrap */
+	OP_SUB_WRAP_I32 = 0xD1, /* Subtract signed integers, two's complement wrap */
+	OP_MUL_WRAP_I32 = 0xD2, /* Multiply signed integers, two's complement wrap */
+	OP_ADD_WRAP_U32 = 0xD3, /* Add unsigned integers modulo 2^32 */
+	OP_SUB_WRAP_U32 = 0xD4, /* Subtract unsigned integers modulo 2^32 */
+	OP_MUL_WRAP_U32 = 0xD5, /* Multiply unsigned integers modulo 2^32 */
+	OP_ADD_SAT_I32 = 0xD6,  /* Add signed integers, clamp to INT32_MIN..INT32_MAX */
+	OP_SUB_SAT_I32 = 0xD7,  /* Subtract signed integers, clamp to INT32_MIN..INT32_MAX */
+	OP_MUL_SAT_I32 = 0xD8,  /* Multiply signed integers, clamp to INT32_MIN..INT32_MAX */
+	OP_ADD_SAT_U32 = 0xD9,  /* Add unsigned integers, clamp to UINT32_MAX */
+	OP_SUB_SAT_U32 = 0xDA,  /* Subtract unsigned integers, clamp to 0 */
+	OP_MUL_SAT_U32 = 0xDB,  /* Multiply unsigned integers, clamp to UINT32_MAX */
+
+	/* Q16.16 Fixed-Point Operations (0xE0-0xEF) */
+	OP_MUL_FX = 0xE0,       /* Multiply Q16.16 values with rounding mode */
+	OP_DIV_FX = 0xE1,       /* Divide Q16.16 values with rounding mode */
+	OP_I32_TO_FX = 0xE2,    /* Convert integer to Q16.16 */
+	OP_FX_TO_I32 = 0xE3,    /* Convert Q16.16 to integer with rounding mode */
+	OP_F32_TO_FX = 0xE4,    /* Convert float to Q16.16 with rounding mode */
+	OP_FX_TO_F32 = 0xE5,    /* Convert Q16.16 to float */
+	OP_VMUL_FX = 0xE6,      /* Element-wise Q16.16 multiply over MB_I32 buffers */
+	OP_VDIV_FX = 0xE7,      /* Element-wise Q16.16 divide over the first N MB_I32 elements */
+	OP_VF32_TO_FX = 0xE8,   /* Convert MB_FLOAT buffer to Q16.16 MB_I32 buffer */
+	OP_VFX_TO_F32 = 0xE9,   /* Convert Q16.16 MB_I32 buffer to MB_FLOAT buffer */
 
 	/* Reserved ranges for future expansion */
-	/* 0x0B-0x0F: Control flow extensions */
-	/* 0x17-0x1F: Load operation extensions */
+	/* 0x19-0x1F: Load operation extensions */
 	/* 0x24-0x2F: Store operation extensions */
 	/* 0x3B-0x3F: Integer arithmetic extensions */
-	/* 0x47-0x4F: Float arithmetic extensions */
 	/* 0x56-0x5F: Bitwise operation extensions */
-	/* 0x63-0x6F: Comparison extensions */
-	/* 0x76-0x7F: Type conversion extensions */
-	/* 0x84-0x8F: Buffer operation extensions */
+	/* 0x68-0x6F: Comparison extensions */
+	/* 0x7E-0x7F: Type conversion extensions */
 	/* 0x96-0x9F: String operation extensions */
-	/* 0xA9-0xAF: I/O operation extensions */
-	/* 0xB0-0xFF: Reserved for future use */
+	/* 0xAB-0xAF: I/O operation extensions */
+	/* 0xBB-0xBF: 64-bit arithmetic extensions */
+	/* 0xCD-0xCF: Packed lane operation extensions */
+	/* 0xDC-0xDF: Wrapping/saturating arithmetic extensions */
+	/* 0xEA-0xEF: Fixed-point operation extensions */
 
-	OP_MAX = 0xA9  /* One past last valid opcode */
+	/* Debugging (0xF0-0xFF) */
+	OP_BREAK = 0xF0,        /* Stop with VM_BREAK; patched over an opcode by vm_break_set() */
+	/* 0xF1-0xFF: Debugging extensions */
+
+	OP_MAX = 0xF1  /* One past last valid opcode */
 } opcode_t;
 
+/*
+ * Q16.16 fixed point. Values are carried in V_I32 slots and MB_I32 buffers,
+ * so ADD_I32/SUB_I32/CMP_I32 apply to them unchanged.
+ */
+#define FX_FRAC_BITS     16u
+#define FX_ONE           0x10000   /* 1.0 in Q16.16 */
+
+/* Rounding modes for the fixed-point opcodes */
+#define FX_ROUND_NEAREST 0u  /* Round to nearest, ties away from zero */
+#define FX_ROUND_FLOOR   1u  /* Round toward negative infinity */
+#define FX_ROUND_ZERO    2u  /* Truncate toward zero */
+
 /* ============================================================================
  * VM State Structure
  * ============================================================================ */
@@ -367,6 +550,64 @@ typedef enum {
 #define FLAG_LESS    0x02u  /* Less flag (L) - first < second */
 #define FLAG_GREATER 0x04u  /* Greater flag (G) - first > second */
 
+/* Where OP_READ_* and OP_PRINT* do their I/O */
+typedef enum {
+	VM_IO_STDIO = 0,  /* Blocking stdin/stdout (default) */
+	VM_IO_HOST        /* Non-blocking, through the in_buf/out_buf below */
+} vm_io_mode_t;
+
+/*
+ * Per-VM I/O context. In VM_IO_HOST mode a read that cannot complete from
+ * in_buf, or a print that might not fit in out_buf, returns VM_YIELD without
+ * advancing the PC, so it is retried once the host has fed more input,
+ * closed it, or drained the output.
+ */
+typedef struct {
+	vm_io_mode_t mode;
+	bool in_closed;                      /* No more input will be fed (EOF) */
+	bool in_discard;                     /* Drop input through the next newline */
+	uint32_t in_head;                    /* First unread byte in in_buf */
+	uint32_t in_len;                     /* One past last valid byte in in_buf */
+	uint8_t in_buf[VM_IO_INPUT_SIZE];
+	uint32_t out_len;                    /* Bytes waiting in out_buf */
+	uint8_t out_buf[VM_IO_OUTPUT_SIZE];
+} vm_io_t;
+
+/*
+ * Native function callable through CALL_HOST. args points directly at the
+ * STACK_VAR_COUNT stack_vars of frame SP+1 and ret at that frame's ret_val,
+ * the same slots a bytecode CALL would use, so nothing is copied. ret is
+ * V_VOID on entry. A non-VM_OK result aborts execution with that status.
+ */
+typedef vm_status_t (*vm_host_fn_t)(var_value_t* args, var_value_t* ret, void* ctx);
+
+/*
+ * Exception handler: an error raised by an instruction in [start, end)
+ * resumes at handler in the same frame, with the vm_status_t in stack var
+ * var as V_U32. A call is covered when its CALL instruction is.
+ */
+typedef struct {
+	uint32_t start;    /* First covered code byte */
+	uint32_t end;      /* One past the last covered byte */
+	uint32_t handler;  /* PC to resume at */
+	uint32_t var;      /* Stack var that receives the error code */
+} vm_handler_t;
+
+/* Instruction whose opcode a BREAK replaced */
+typedef struct {
+	uint32_t pc;
+	uint8_t opcode;   /* Original opcode */
+} vm_breakpoint_t;
+
+/* Lazily verified linked program (vm-link.h) */
+struct vm_linked;
+
+/* Call site argument profile (vm-spec.h) */
+struct vm_call_profile;
+
+/* CALL_MEMO result table (vm-memo.h) */
+struct vm_memo;
+
 /* Complete VM state */
 typedef struct {
 	/* Global storage */
@@ -378,13 +619,37 @@ typedef struct {
 	uint8_t sp;  /* Stack pointer (current frame index, 0-31) */
 
 	/* Program execution */
-	uint8_t program[PROGRAM_MAX_SIZE];  /* Instruction memory */
+	uint8_t program[PROGRAM_MAX_SIZE];  /* Built-in instruction memory */
+	const uint8_t* code;                /* Code being run: program[] or an attached region */
 	uint32_t program_len;               /* Length of loaded program */
+	vm_encoding_t encoding;             /* Encoding of program[] */
+	struct vm_linked* linked;           /* Set by vm_link_attach(); CALL verifies callees through it */
 	uint32_t pc;                        /* Program counter */
+	struct vm_call_profile* call_profile;  /* When set, CALL records its arguments there */
+	struct vm_memo* memo;               /* Set by vm_memo_attach(); CALL_MEMO caches results there */
+
+	/* Exception handlers, searched in order only when an instruction fails */
+	vm_handler_t handlers[VM_MAX_HANDLERS];
+	uint32_t handler_count;
+
+	/* Breakpoints patched into the code; cleared when a program is loaded */
+	vm_breakpoint_t breakpoints[VM_MAX_BREAKPOINTS];
+	uint32_t breakpoint_count;
+	uint8_t* patch;  /* Writable view of code for breakpoints, or NULL */
+	uint32_t* break_starts;  /* Instruction starts, bit per code byte: break_starts_buf or the caller's */
+	bool break_starts_valid;  /* Built for the current code */
+	uint32_t break_starts_buf[VM_BREAK_STARTS_WORDS(PROGRAM_MAX_SIZE)];
 
 	/* Condition flags */
 	uint8_t flags;  /* Comparison flags (Z, L, G) */
 
+	/* I/O context for OP_READ_* and OP_PRINT* */
+	vm_io_t io;
+
+	/* Host function table (CALL_HOST) */
+	vm_host_fn_t host_fns[HOST_FN_COUNT];
+	void* host_ctx[HOST_FN_COUNT];
+
 	/* Error state */
 	vm_status_t last_error;
 } vm_state_t;
@@ -411,6 +676,8 @@ static inline uint32_t get_buffer_capacity(membuf_type_t type)
 		case MB_I32:   return MEMBUF_I32_COUNT;
 		case MB_U32:   return MEMBUF_U32_COUNT;
 		case MB_FLOAT: return MEMBUF_F32_COUNT;
+		case MB_BIT:   return MEMBUF_BIT_COUNT;
+		case MB_I64:   return MEMBUF_I64_COUNT;
 		case MB_VOID:
 		default:       return 0u;
 	}
@@ -438,15 +705,104 @@ void vm_init(vm_state_t* vm);
 /* Reset VM state (clear all variables, reset PC and SP) */
 void vm_reset(vm_state_t* vm);
 
-/* Load program into instruction memory */
+/* Load a raw or container image into instruction memory (verifies it first) */
 vm_status_t vm_load_program(vm_state_t* vm, const uint8_t* program, uint32_t len);
 
+/* Check program structure and all static jump targets without loading it (raw or container) */
+vm_status_t vm_verify_program(const uint8_t* program, uint32_t len);
+
+/* Verify bare code in the given encoding (vm_verify_program() for raw images) */
+vm_status_t vm_verify_code(const uint8_t* code, uint32_t len, vm_encoding_t encoding);
+
+/*
+ * vm_verify_code() over the first avail of len bytes, for code that arrives
+ * in pieces: checks the instructions from *next that are complete and
+ * leaves *next at the first one that is not. With avail == len this is
+ * vm_verify_code().
+ */
+vm_status_t vm_verify_code_prefix(const uint8_t* code, uint32_t avail, uint32_t len,
+                                  vm_encoding_t encoding, uint32_t* next);
+
+/* Decode the instruction at pc */
+vm_status_t vm_decode_instruction(const uint8_t* code, uint32_t len, uint32_t pc,
+                                  vm_encoding_t encoding, vm_instruction_t* insn);
+
+/* Load a program that already passed vm_verify_program() (e.g. from a cache) */
+vm_status_t vm_load_verified_program(vm_state_t* vm, const uint8_t* program, uint32_t len);
+
+/*
+ * Run a raw or container image in place instead of copying it into
+ * program[], so code may be up to PROGRAM_MAP_MAX_SIZE bytes. The caller
+ * keeps the bytes (e.g. an mmap'd file) alive and unchanged while the VM
+ * uses them.
+ */
+vm_status_t vm_attach_program(vm_state_t* vm, const uint8_t* program, uint32_t len);
+
+/* vm_attach_program() for an image that already passed vm_verify_program() */
+vm_status_t vm_attach_verified_program(vm_state_t* vm, const uint8_t* program, uint32_t len);
+
+/* Content hash of a program image (64-bit FNV-1a) */
+uint64_t vm_program_hash(const uint8_t* program, uint32_t len);
+
+/* Register fn at index idx of the host function table; NULL unregisters */
+vm_status_t vm_register_host_fn(vm_state_t* vm, uint32_t idx, vm_host_fn_t fn, void* ctx);
+
+/* Select stdio or host-buffered I/O; discards any pending host input/output */
+void vm_set_io_mode(vm_state_t* vm, vm_io_mode_t mode);
+
+/* Append input for VM_IO_HOST mode; returns the number of bytes accepted */
+uint32_t vm_feed_input(vm_state_t* vm, const uint8_t* data, uint32_t len);
+
+/* Signal end of input in VM_IO_HOST mode; blocked reads then see EOF */
+void vm_close_input(vm_state_t* vm);
+
+/* Output collected in VM_IO_HOST mode, oldest first; valid until the next step */
+const uint8_t* vm_pending_output(const vm_state_t* vm, uint32_t* len);
+
+/* Drop the first n bytes of pending output after the host has written them */
+void vm_consume_output(vm_state_t* vm, uint32_t n);
+
 /* Execute one instruction */
 vm_status_t vm_step(vm_state_t* vm);
 
-/* Execute until HALT or error */
+/* Execute until HALT, error, VM_YIELD or VM_BREAK */
 vm_status_t vm_run(vm_state_t* vm);
 
+/*
+ * Patch a BREAK over the opcode of the instruction at pc, saving the
+ * original, so execution stops there with VM_BREAK and no per-step check.
+ * An attached program is patched in place after vm_break_allow_patch(),
+ * else first copied into program[] (VM_ERR_PROGRAM_TOO_LARGE if it does
+ * not fit). Linked programs are not supported (VM_ERR_LINK). pc must start
+ * an instruction (VM_ERR_INVALID_PC). The instruction starts are found
+ * once per loaded program and kept in the VM, or in the bitmap given to
+ * vm_break_allow_patch(). Loading another program drops all breakpoints.
+ */
+vm_status_t vm_break_set(vm_state_t* vm, uint32_t pc);
+
+/*
+ * Let vm_break_set() patch the attached program in place. region is the
+ * len bytes of writable memory it was attached from, typically a private
+ * file mapping with PROT_WRITE, so only the pages that get a BREAK are
+ * copied. Every VM running from region sees the breakpoints. starts holds
+ * the instruction-start bitmap of this VM's code, which may be larger than
+ * the one in vm_state_t: VM_BREAK_STARTS_WORDS(program_len) words.
+ * VM_ERR_BOUNDS if the code being run does not lie inside region or
+ * starts is too small.
+ */
+vm_status_t vm_break_allow_patch(vm_state_t* vm, uint8_t* region, uint32_t len,
+                                 uint32_t* starts, uint32_t starts_words);
+
+/* Restore the instruction at pc; VM_ERR_INVALID_PC if no breakpoint is set there */
+vm_status_t vm_break_clear(vm_state_t* vm, uint32_t pc);
+
+/*
+ * After VM_BREAK: execute the instruction the breakpoint at vm.pc replaced,
+ * as one vm_step(), and leave the breakpoint armed. A BREAK that is part of
+ * the program is stepped over. Then resume with vm_step()/vm_run().
+ */
+vm_status_t vm_break_continue(vm_state_t* vm);
+
 /* Get human-readable error message */
 const char* vm_get_error_string(vm_status_t status);
 
@@ -0,0 +1,313 @@
+/*
+ * Stipple VM - Program Cache
+ * Fixed table of LRU slots. Images inserted in this process are copied into
+ * the slot; images found on disk are used in place through a read-only
+ * mapping. Either way the slot is verified and decoded once as it is
+ * filled, and a hit attaches the decoded code in place. Disk files are
+ * written to a temporary name and renamed, so concurrent readers never see
+ * a partial file.
+ */
+
+#define _GNU_SOURCE
+#include "vm-cache.h"
+#include "vm-image.h"
+#include <stdio.h>   /* For rename */
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    uint64_t hash;
+    uint32_t len;              /* 0: slot empty */
+    uint64_t last_use;         /* Use counter at last hit */
+    const uint8_t* image;      /* storage, or into map */
+    void* map;                 /* Mapping of the disk file, if any */
+    size_t map_len;
+    bool container;            /* image is a container, parsed into img */
+    vm_image_t img;
+    const uint8_t* code;       /* Verified code: in image, or unpacked */
+    uint8_t storage[PROGRAM_IMAGE_MAX_SIZE];
+    uint8_t unpacked[PROGRAM_MAX_SIZE];  /* CODE_LZ4, decompressed once */
+} cache_slot_t;
+
+static cache_slot_t g_pool[VM_CACHE_SLOTS + 1];
+static cache_slot_t* g_slots[VM_CACHE_SLOTS];
+static cache_slot_t* g_spare;  /* Filled first, so an image that fails to verify evicts nothing */
+static uint64_t g_uses;
+static vm_cache_stats_t g_stats;
+static char g_dir[VM_CACHE_PATH_MAX];
+static bool g_has_dir;
+
+/* ============================================================================
+ * Disk Files
+ * ============================================================================ */
+
+/* <dir>/<16 hex digits>.stc */
+static bool cache_path(uint64_t hash, char* out, size_t cap) {
+    const char hex[] = "0123456789abcdef";
+    size_t n = strlen(g_dir);
+    if (n + 1u + 16u + 4u + 1u > cap) return false;
+    memcpy(out, g_dir, n);
+    out[n++] = '/';
+    for (int i = 15; i >= 0; i--) {
+        out[n++] = hex[(hash >> (i * 4)) & 0xFu];
+    }
+    memcpy(&out[n], ".stc", 5);
+    return true;
+}
+
+static bool write_file(int fd, const void* buf, size_t len) {
+    const uint8_t* p = buf;
+    while (len > 0u) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/* Best effort: a failed write only costs a resend of the program in the next process */
+static void disk_store(uint64_t hash, const uint8_t* image, uint32_t len) {
+    char path[VM_CACHE_PATH_MAX + 32];
+    char tmp[VM_CACHE_PATH_MAX + 48];
+    if (!g_has_dir || !cache_path(hash, path, sizeof(path))) return;
+    size_t n = strlen(path);
+    memcpy(tmp, path, n);
+    memcpy(&tmp[n], ".tmp.", 5);
+    n += 5u;
+    for (pid_t pid = getpid(); pid > 0 && n < sizeof(tmp) - 1u; pid /= 10) {
+        tmp[n++] = (char)('0' + (pid % 10));
+    }
+    tmp[n] = '\0';
+
+    vm_cache_file_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = VM_CACHE_MAGIC;
+    hdr.abi = VM_CACHE_ABI;
+    hdr.hash = hash;
+    hdr.len = len;
+    hdr.kind = VM_CACHE_KIND_VERIFIED;
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    bool ok = write_file(fd, &hdr, sizeof(hdr)) && write_file(fd, image, len);
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp, path) != 0) (void)unlink(tmp);
+}
+
+/*
+ * Map a cache file; stale or malformed files are removed. The directory is
+ * not trusted: the bytes must hash to the name here, and the slot they fill
+ * verifies them again (slot_fill), so its hits can skip both.
+ */
+static bool disk_load(uint64_t hash, void** map, size_t* map_len) {
+    char path[VM_CACHE_PATH_MAX + 32];
+    if (!g_has_dir || !cache_path(hash, path, sizeof(path))) return false;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(vm_cache_file_header_t) &&
+        st.st_size <= (off_t)(sizeof(vm_cache_file_header_t) + PROGRAM_IMAGE_MAX_SIZE)) {
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    (void)close(fd);
+
+    bool valid = false;
+    if (p != MAP_FAILED) {
+        vm_cache_file_header_t hdr;
+        memcpy(&hdr, p, sizeof(hdr));
+        valid = hdr.magic == VM_CACHE_MAGIC && hdr.abi == VM_CACHE_ABI && hdr.hash == hash &&
+                hdr.kind == VM_CACHE_KIND_VERIFIED && hdr.len != 0u &&
+                (off_t)(sizeof(hdr) + hdr.len) == st.st_size;
+        const uint8_t* image = (const uint8_t*)p + sizeof(hdr);
+        valid = valid && vm_program_hash(image, hdr.len) == hash;
+        if (!valid) (void)munmap(p, (size_t)st.st_size);
+    }
+    if (!valid) {
+        g_stats.stale++;
+        (void)unlink(path);
+        return false;
+    }
+    *map = p;
+    *map_len = (size_t)st.st_size;
+    return true;
+}
+
+/* ============================================================================
+ * Slots
+ * ============================================================================ */
+
+static cache_slot_t* slot_find(uint64_t hash) {
+    for (uint32_t i = 0; i < VM_CACHE_SLOTS; i++) {
+        if (g_slots[i]->len != 0u && g_slots[i]->hash == hash) return g_slots[i];
+    }
+    return NULL;
+}
+
+static void slot_clear(cache_slot_t* s) {
+    if (s->map) (void)munmap(s->map, s->map_len);
+    s->map = NULL;
+    s->map_len = 0;
+    s->image = NULL;
+    s->code = NULL;
+    s->len = 0;
+}
+
+/* Verify image and keep what a load needs: the parsed container and the
+ * runnable code, unpacked here when it is compressed. On failure s stays empty. */
+static vm_status_t slot_fill(cache_slot_t* s, uint64_t hash, const uint8_t* image, uint32_t len) {
+    vm_status_t status;
+    s->container = vm_image_is_container(image, len);
+    if (s->container) {
+        status = vm_image_parse(image, len, &s->img);
+        if (status == VM_OK) status = vm_image_decode(&s->img, s->unpacked, &s->code);
+    } else {
+        status = vm_verify_program(image, len);
+        s->code = image;
+    }
+    if (status != VM_OK) {
+        slot_clear(s);
+        return status;
+    }
+    s->image = image;
+    s->len = len;
+    s->hash = hash;
+    return VM_OK;
+}
+
+/* Swap the filled spare for an empty slot if any, else the least recently used one */
+static cache_slot_t* slot_commit(void) {
+    uint32_t victim = 0;
+    for (uint32_t i = 0; i < VM_CACHE_SLOTS; i++) {
+        if (g_slots[i]->len == 0u) {
+            victim = i;
+            break;
+        }
+        if (g_slots[i]->last_use < g_slots[victim]->last_use) victim = i;
+    }
+    if (g_slots[victim]->len != 0u) {
+        g_stats.evictions++;
+        slot_clear(g_slots[victim]);
+    }
+    cache_slot_t* s = g_spare;
+    g_spare = g_slots[victim];
+    g_slots[victim] = s;
+    return s;
+}
+
+/* In memory, else from disk */
+static cache_slot_t* slot_lookup(uint64_t hash) {
+    cache_slot_t* s = slot_find(hash);
+    if (s) {
+        g_stats.hits++;
+        return s;
+    }
+    void* map;
+    size_t map_len;
+    if (!disk_load(hash, &map, &map_len)) return NULL;
+    s = g_spare;
+    s->map = map;
+    s->map_len = map_len;
+    const uint8_t* image = (const uint8_t*)map + sizeof(vm_cache_file_header_t);
+    if (slot_fill(s, hash, image, (uint32_t)(map_len - sizeof(vm_cache_file_header_t))) != VM_OK) {
+        char path[VM_CACHE_PATH_MAX + 32];
+        g_stats.stale++;
+        if (cache_path(hash, path, sizeof(path))) (void)unlink(path);
+        return NULL;
+    }
+    g_stats.disk_hits++;
+    return slot_commit();
+}
+
+/* Verify and copy program into a slot unless it is there already */
+static vm_status_t slot_insert(uint64_t hash, const uint8_t* program, uint32_t len, cache_slot_t** out) {
+    cache_slot_t* s = slot_find(hash);
+    if (s && (s->len != len || memcmp(s->image, program, len) != 0)) {
+        slot_clear(s);  /* Hash collision: the newer program wins */
+        s = NULL;
+    }
+    if (!s) {
+        memcpy(g_spare->storage, program, len);
+        vm_status_t status = slot_fill(g_spare, hash, g_spare->storage, len);
+        if (status != VM_OK) return status;
+        g_stats.misses++;
+        disk_store(hash, program, len);
+        s = slot_commit();
+    }
+    *out = s;
+    return VM_OK;
+}
+
+static vm_status_t slot_attach(vm_state_t* vm, cache_slot_t* s) {
+    s->last_use = ++g_uses;
+    if (s->container) return vm_image_attach_decoded(vm, &s->img, s->code);
+    return vm_attach_verified_program(vm, s->code, s->len);
+}
+
+bool vm_cache_init(const char* dir) {
+    for (uint32_t i = 0; i <= VM_CACHE_SLOTS; i++) slot_clear(&g_pool[i]);
+    for (uint32_t i = 0; i < VM_CACHE_SLOTS; i++) g_slots[i] = &g_pool[i];
+    g_spare = &g_pool[VM_CACHE_SLOTS];
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_uses = 0;
+    g_has_dir = false;
+    if (dir == NULL) return true;
+    size_t n = strlen(dir);
+    if (n == 0u || n >= sizeof(g_dir)) return false;
+    if (mkdir(dir, 0755) != 0) {
+        struct stat st;
+        if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+    }
+    memcpy(g_dir, dir, n + 1u);
+    g_has_dir = true;
+    return true;
+}
+
+bool vm_cache_find(uint64_t hash, const uint8_t** image, uint32_t* len) {
+    cache_slot_t* s = slot_lookup(hash);
+    if (!s) return false;
+    s->last_use = ++g_uses;
+    *image = s->image;
+    *len = s->len;
+    return true;
+}
+
+vm_status_t vm_cache_insert(const uint8_t* program, uint32_t len, const uint8_t** image) {
+    if (len > PROGRAM_IMAGE_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    cache_slot_t* s;
+    vm_status_t status = slot_insert(vm_program_hash(program, len), program, len, &s);
+    if (status != VM_OK) return status;
+    s->last_use = ++g_uses;
+    *image = s->image;
+    return VM_OK;
+}
+
+bool vm_cache_attach(vm_state_t* vm, uint64_t hash) {
+    cache_slot_t* s = slot_lookup(hash);
+    return s != NULL && slot_attach(vm, s) == VM_OK;
+}
+
+vm_status_t vm_cache_load(vm_state_t* vm, const uint8_t* program, uint32_t len, bool* hit) {
+    if (len > PROGRAM_IMAGE_MAX_SIZE) {
+        vm->last_error = VM_ERR_PROGRAM_TOO_LARGE;
+        return VM_ERR_PROGRAM_TOO_LARGE;
+    }
+    /* The hash stands for the bytes, as it does for hash-only requests */
+    uint64_t hash = vm_program_hash(program, len);
+    cache_slot_t* s = slot_lookup(hash);
+    *hit = s != NULL && s->len == len;
+    if (!*hit) {
+        vm_status_t status = slot_insert(hash, program, len, &s);
+        if (status != VM_OK) {
+            vm->last_error = status;
+            return status;
+        }
+    }
+    return slot_attach(vm, s);
+}
+
+vm_cache_stats_t vm_cache_stats(void) { return g_stats; }
@@ -0,0 +1,82 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - Program Cache
+ * Content-addressed cache of verified program images keyed by
+ * vm_program_hash(). Entries live in a fixed set of in-memory slots and,
+ * when a cache directory is configured, in one mmap-able file per image.
+ * A slot keeps the image decoded: container parsed, code verified and, if
+ * compressed, unpacked. A repeat load costs a hash plus a lookup, and the
+ * VM runs the slot's code in place. An image found on disk is hashed and
+ * decoded once as it enters a slot.
+ */
+
+/* ============================================================================
+ * Cache Configuration Constants
+ * ============================================================================ */
+
+#define VM_CACHE_SLOTS 16           /* In-memory entries (LRU) */
+#define VM_CACHE_PATH_MAX 256       /* Longest cache directory path */
+
+/*
+ * Bump VM_CACHE_VERSION whenever the meaning of a cached image changes
+ * (verifier rules, instruction encoding). Together with OP_MAX it forms the
+ * ABI stamp in every file; files with another stamp are deleted on lookup.
+ */
+#define VM_CACHE_VERSION 4u
+#define VM_CACHE_ABI (((uint32_t)OP_MAX << 16) | VM_CACHE_VERSION)
+
+#define VM_CACHE_MAGIC 0x43505453u  /* "STPC" */
+
+/* Representation stored in a disk file. Files keep the image as sent, since
+ * it must hash to the file name; the decoded form is rebuilt per process. */
+typedef enum {
+	VM_CACHE_KIND_VERIFIED = 1  /* Raw image that passed vm_verify_program() */
+} vm_cache_kind_t;
+
+/* On-disk file header, followed by len image bytes. Host byte order. */
+typedef struct {
+	uint32_t magic;    /* VM_CACHE_MAGIC */
+	uint32_t abi;      /* VM_CACHE_ABI of the writer */
+	uint64_t hash;     /* vm_program_hash() of the image */
+	uint32_t len;      /* Image length in bytes */
+	uint32_t kind;     /* vm_cache_kind_t */
+} vm_cache_file_header_t;
+
+_Static_assert(sizeof(vm_cache_file_header_t) == 24, "vm_cache_file_header_t must have no padding");
+
+/* Counters since vm_cache_init() */
+typedef struct {
+	uint64_t hits;        /* Found in memory */
+	uint64_t disk_hits;   /* Found on disk, mapped and verified */
+	uint64_t misses;      /* Verified and inserted */
+	uint64_t evictions;   /* Slots reused */
+	uint64_t stale;       /* Disk files dropped for a different ABI stamp, bad header or bad contents */
+} vm_cache_stats_t;
+
+/* ============================================================================
+ * Cache API
+ * ============================================================================ */
+
+/* Reset the cache (call before any other function); dir (may be NULL)
+ * enables persistence in that directory */
+bool vm_cache_init(const char* dir);
+
+/* Look up a verified image by hash, in memory then on disk. The image stays
+ * valid until the entry is evicted by a later insert. */
+bool vm_cache_find(uint64_t hash, const uint8_t** image, uint32_t* len);
+
+/* Verify and insert program (no-op if already cached); returns the cached image */
+vm_status_t vm_cache_insert(const uint8_t* program, uint32_t len, const uint8_t** image);
+
+/* Attach the cached program with this hash to vm; false if it is not cached.
+ * vm runs the slot in place, so it must not outlive the entry. */
+bool vm_cache_attach(vm_state_t* vm, uint64_t hash);
+
+/* vm_cache_attach() for program, inserting it on a miss; *hit tells whether
+ * it was already cached. A hit trusts the hash and checks only the length. */
+vm_status_t vm_cache_load(vm_state_t* vm, const uint8_t* program, uint32_t len, bool* hit);
+
+/* Counters since vm_cache_init() */
+vm_cache_stats_t vm_cache_stats(void);
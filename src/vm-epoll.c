@@ -0,0 +1,436 @@
+/*
+ * Stipple VM - epoll Reference Host
+ * Runs many VM instances on a single thread. Each instance reads from its
+ * own input descriptor and writes to an output sink; instances whose
+ * OP_READ_* or OP_PRINT* would block are suspended (VM_YIELD) and resumed
+ * when epoll reports readiness. Output is flushed with one writev per sink.
+ * No dynamic allocation - all instances live in a static table.
+ */
+
+#define _GNU_SOURCE
+#include "stipple.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define RUNNER_MAX_VMS 64          /* Instances per runner */
+#define RUNNER_SLICE_STEPS 4096u   /* Steps a VM runs before the next one gets a turn */
+#define RUNNER_MAX_EVENTS 64
+
+/* epoll user data: sink events are tagged so they can share the u32 with instance indices */
+#define EV_SINK_FLAG 0x80000000u
+
+typedef struct {
+    const char* spec;  /* Output spec this sink was opened from */
+    int fd;
+    bool blocked;      /* Last write hit EAGAIN; waiting for EPOLLOUT */
+    bool failed;       /* Write error; further output is discarded */
+} sink_t;
+
+typedef struct {
+    vm_state_t vm;
+    int in_fd;
+    uint32_t sink;     /* Index into g_sinks */
+    bool wait_in;      /* Suspended until in_fd is readable */
+    bool wait_out;     /* Suspended until the sink drains */
+    bool done;
+    vm_status_t status;
+} instance_t;
+
+static instance_t g_inst[RUNNER_MAX_VMS];
+static uint32_t g_inst_count;
+static sink_t g_sinks[RUNNER_MAX_VMS];
+static uint32_t g_sink_count;
+static uint8_t g_program_buffer[PROGRAM_IMAGE_MAX_SIZE];
+static int g_epfd = -1;
+static int g_std_flags[2] = { -1, -1 };  /* Flags to restore on stdin/stdout, or -1 */
+
+static void print_usage(const char* progname) {
+    (void)fputs("Usage: ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" <bytecode_file> <input>[,<output>]...\n", stdout);
+    (void)fputs("\nRuns one VM instance per <input> on a single epoll loop.\n", stdout);
+    (void)fputs("  <input>   file or FIFO path, '-' for stdin, or unix:<path> to connect a socket\n", stdout);
+    (void)fputs("  <output>  file path or '-' for stdout (default: the socket for unix:, else '-')\n", stdout);
+}
+
+static void print_uint32_err(uint32_t value) {
+    char buf[12];
+    int i = 0;
+    do {
+        buf[i] = (char)('0' + (value % 10u));
+        value /= 10u;
+        i++;
+    } while (value > 0u);
+    while (i > 0) {
+        i--;
+        (void)fputc(buf[i], stderr);
+    }
+}
+
+static void report(uint32_t idx, const char* what, const char* detail) {
+    (void)fputs("[vm ", stderr);
+    print_uint32_err(idx);
+    (void)fputs("] ", stderr);
+    (void)fputs(what, stderr);
+    if (detail) {
+        (void)fputs(": ", stderr);
+        (void)fputs(detail, stderr);
+    }
+    (void)fputc('\n', stderr);
+}
+
+static bool load_file(const char* filename, uint8_t* buffer, uint32_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        (void)fputs("Error: Cannot open file '", stderr);
+        (void)fputs(filename, stderr);
+        (void)fputs("'\n", stderr);
+        return false;
+    }
+    uint32_t total = 0;
+    for (;;) {
+        ssize_t n = read(fd, buffer + total, PROGRAM_IMAGE_MAX_SIZE - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            (void)fputs("Error: Failed to read file\n", stderr);
+            (void)close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        total += (uint32_t)n;
+        if (total == PROGRAM_IMAGE_MAX_SIZE) {
+            uint8_t extra;
+            if (read(fd, &extra, 1) > 0) {
+                (void)fputs("Error: File too large\n", stderr);
+                (void)close(fd);
+                return false;
+            }
+            break;
+        }
+    }
+    (void)close(fd);
+    if (total == 0u) {
+        (void)fputs("Error: File is empty\n", stderr);
+        return false;
+    }
+    *size = total;
+    return true;
+}
+
+static bool set_nonblocking(int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    return (fl >= 0) && (fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0);
+}
+
+/*
+ * stdin or stdout for the runner's own use. O_NONBLOCK belongs to the open
+ * file description, which the shell and stderr on the same terminal share,
+ * so pipes and terminals are reopened through /proc to get a private one.
+ * Regular files keep their offset only on the shared description, and
+ * sockets cannot be reopened; for those the flags are restored on exit.
+ */
+static int open_std(int fd) {
+    struct stat st;
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0 || fstat(fd, &st) != 0) return -1;
+    if (!S_ISREG(st.st_mode)) {
+        char path[] = "/proc/self/fd/0";
+        path[sizeof(path) - 2u] = (char)('0' + fd);
+        int own = open(path, (fl & (O_ACCMODE | O_APPEND)) | O_CLOEXEC);
+        if (own >= 0) return own;
+    }
+    if (g_std_flags[fd] < 0) g_std_flags[fd] = fl;
+    return fd;
+}
+
+static void restore_std(void) {
+    for (int fd = 0; fd < 2; fd++) {
+        if (g_std_flags[fd] >= 0) (void)fcntl(fd, F_SETFL, g_std_flags[fd]);
+    }
+}
+
+static int connect_unix(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1u);
+    if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        (void)close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Arm a one-shot readiness notification. One-shot keeps level-triggered
+ * descriptors (a pipe with unread data) from waking the loop while the VM
+ * is not actually waiting on them.
+ */
+static bool arm(int fd, uint32_t events, uint32_t data) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.u32 = data;
+    if (epoll_ctl(g_epfd, EPOLL_CTL_MOD, fd, &ev) == 0) return true;
+    return (errno == ENOENT) && (epoll_ctl(g_epfd, EPOLL_CTL_ADD, fd, &ev) == 0);
+}
+
+/* Sinks are shared by spec so VMs writing to the same target batch into one writev */
+static bool open_sink(const char* spec, int socket_fd, uint32_t* out) {
+    if (socket_fd < 0) {
+        for (uint32_t i = 0; i < g_sink_count; i++) {
+            if (strcmp(g_sinks[i].spec, spec) == 0) {
+                *out = i;
+                return true;
+            }
+        }
+    }
+    int fd;
+    if (socket_fd >= 0) {
+        /* A separate descriptor so input and output can be armed independently */
+        fd = fcntl(socket_fd, F_DUPFD_CLOEXEC, 0);
+    } else if (strcmp(spec, "-") == 0) {
+        fd = open_std(STDOUT_FILENO);
+    } else {
+        fd = open(spec, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0 || !set_nonblocking(fd)) return false;
+    sink_t* s = &g_sinks[g_sink_count];
+    s->spec = spec;
+    s->fd = fd;
+    s->blocked = false;
+    s->failed = false;
+    *out = g_sink_count++;
+    return true;
+}
+
+static bool add_instance(char* arg, const uint8_t* program, uint32_t len) {
+    uint32_t idx = g_inst_count;
+    instance_t* in = &g_inst[idx];
+    char* out_spec = strchr(arg, ',');
+    if (out_spec) *out_spec++ = '\0';
+
+    int sock = -1;
+    if (strncmp(arg, "unix:", 5) == 0) {
+        sock = connect_unix(arg + 5);
+        in->in_fd = sock;
+    } else if (strcmp(arg, "-") == 0) {
+        in->in_fd = open_std(STDIN_FILENO);
+    } else {
+        in->in_fd = open(arg, O_RDONLY | O_CLOEXEC);
+    }
+    if (in->in_fd < 0 || !set_nonblocking(in->in_fd)) {
+        report(idx, "cannot open input", arg);
+        return false;
+    }
+    bool own_socket = (sock >= 0) && (out_spec == NULL);
+    if (!open_sink(out_spec ? out_spec : (own_socket ? arg : "-"), own_socket ? sock : -1, &in->sink)) {
+        report(idx, "cannot open output", out_spec ? out_spec : arg);
+        return false;
+    }
+
+    vm_init(&in->vm);
+    vm_set_io_mode(&in->vm, VM_IO_HOST);
+    vm_status_t status = vm_load_program(&in->vm, program, len);
+    if (status != VM_OK) {
+        report(idx, "error loading program", vm_get_error_string(status));
+        return false;
+    }
+    in->status = VM_OK;
+    g_inst_count++;
+    return true;
+}
+
+/* Read whatever is available into the VM; suspend it if nothing is */
+static void pump_input(uint32_t idx) {
+    instance_t* in = &g_inst[idx];
+    uint8_t buf[VM_IO_INPUT_SIZE];
+    vm_io_t* io = &in->vm.io;
+    uint32_t space = VM_IO_INPUT_SIZE - (io->in_len - io->in_head);
+    if (space == 0u || io->in_closed) return;
+
+    ssize_t n = read(in->in_fd, buf, space);
+    if (n > 0) {
+        (void)vm_feed_input(&in->vm, buf, (uint32_t)n);
+    } else if (n == 0) {
+        vm_close_input(&in->vm);
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        in->wait_in = true;
+        if (!arm(in->in_fd, EPOLLIN, idx)) {
+            report(idx, "cannot poll input", strerror(errno));
+            in->wait_in = false;
+            vm_close_input(&in->vm);
+        }
+    } else if (errno != EINTR) {
+        report(idx, "read failed", strerror(errno));
+        vm_close_input(&in->vm);
+    }
+}
+
+/* Write the pending output of every instance on sink k with a single writev */
+static void flush_sink(uint32_t k) {
+    sink_t* s = &g_sinks[k];
+    struct iovec iov[RUNNER_MAX_VMS];
+    uint32_t owner[RUNNER_MAX_VMS];
+    int iovcnt = 0;
+    size_t total = 0;
+    if (s->blocked) return;
+
+    for (uint32_t i = 0; i < g_inst_count; i++) {
+        uint32_t len;
+        const uint8_t* data = vm_pending_output(&g_inst[i].vm, &len);
+        if (g_inst[i].sink != k || len == 0u) continue;
+        iov[iovcnt].iov_base = (void*)data;
+        iov[iovcnt].iov_len = len;
+        owner[iovcnt] = i;
+        total += len;
+        iovcnt++;
+    }
+    if (iovcnt == 0) return;
+
+    ssize_t n;
+    if (s->failed) {
+        n = (ssize_t)total;
+    } else {
+        n = writev(s->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) return;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                n = 0;
+            } else {
+                report(owner[0], "write failed", strerror(errno));
+                s->failed = true;
+                n = (ssize_t)total;
+            }
+        }
+    }
+
+    size_t left = (size_t)n;
+    for (int j = 0; j < iovcnt && left > 0u; j++) {
+        size_t take = (left < iov[j].iov_len) ? left : iov[j].iov_len;
+        vm_consume_output(&g_inst[owner[j]].vm, (uint32_t)take);
+        g_inst[owner[j]].wait_out = false;
+        left -= take;
+    }
+    if ((size_t)n < total) {
+        s->blocked = true;
+        if (!arm(s->fd, EPOLLOUT, EV_SINK_FLAG | k)) {
+            /* Not pollable (e.g. a regular file): it never stays blocked */
+            s->blocked = false;
+        }
+    }
+}
+
+static void run_slice(uint32_t idx) {
+    instance_t* in = &g_inst[idx];
+    vm_status_t status = VM_OK;
+    uint32_t pc = in->vm.pc;
+    for (uint32_t n = 0; n < RUNNER_SLICE_STEPS && status == VM_OK; n++) {
+        pc = in->vm.pc;
+        status = vm_step(&in->vm);
+    }
+    if (status == VM_OK) return;
+    if (status != VM_YIELD) {
+        in->done = true;
+        in->status = (status == VM_ERR_HALT) ? VM_OK : status;
+        if (in->status != VM_OK) report(idx, "runtime error", vm_get_error_string(status));
+        return;
+    }
+
+    /* YIELD moves past itself; a blocked read or print stays put to re-execute */
+    if (in->vm.pc != pc) return;
+    uint8_t op = in->vm.code[pc];
+    const vm_io_t* io = &in->vm.io;
+    if (op >= OP_READ_I32 && op <= OP_READ_STR && io->in_len - io->in_head == VM_IO_INPUT_SIZE) {
+        /* Reads consume something from a full buffer; feeding more could never unblock this one */
+        in->done = true;
+        in->status = VM_YIELD;
+        report(idx, "read stalled on a full input buffer", NULL);
+    } else if (op >= OP_READ_I32 && op <= OP_READ_STR) {
+        pump_input(idx);
+    } else {
+        in->wait_out = true;
+    }
+}
+
+static void handle_events(int timeout) {
+    struct epoll_event events[RUNNER_MAX_EVENTS];
+    int n = epoll_wait(g_epfd, events, RUNNER_MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+        uint32_t data = events[i].data.u32;
+        if ((data & EV_SINK_FLAG) != 0u) {
+            g_sinks[data & ~EV_SINK_FLAG].blocked = false;
+        } else {
+            g_inst[data].wait_in = false;
+            pump_input(data);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc - 2 > RUNNER_MAX_VMS) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    uint32_t program_size;
+    if (!load_file(argv[1], g_program_buffer, &program_size)) {
+        return 1;
+    }
+
+    /* Peers that go away must surface as write errors, not kill the runner */
+    (void)signal(SIGPIPE, SIG_IGN);
+    g_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epfd < 0) {
+        (void)fputs("Error: epoll_create1 failed\n", stderr);
+        return 1;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (!add_instance(argv[i], g_program_buffer, program_size)) {
+            restore_std();
+            return 1;
+        }
+    }
+
+    for (;;) {
+        for (uint32_t i = 0; i < g_inst_count; i++) {
+            instance_t* in = &g_inst[i];
+            if (!in->done && !in->wait_in && !in->wait_out) run_slice(i);
+        }
+
+        bool pending = false;
+        for (uint32_t k = 0; k < g_sink_count; k++) {
+            flush_sink(k);
+            pending |= g_sinks[k].blocked;
+        }
+
+        bool alive = false;
+        bool runnable = false;
+        for (uint32_t i = 0; i < g_inst_count; i++) {
+            alive |= !g_inst[i].done;
+            runnable |= !g_inst[i].done && !g_inst[i].wait_in && !g_inst[i].wait_out;
+        }
+        if (!alive && !pending) break;
+        /* Only sleep when every live VM is suspended */
+        handle_events(runnable ? 0 : -1);
+    }
+
+    restore_std();
+    int rc = 0;
+    for (uint32_t i = 0; i < g_inst_count; i++) {
+        if (g_inst[i].status != VM_OK) rc = 1;
+    }
+    return rc;
+}
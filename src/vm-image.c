@@ -0,0 +1,662 @@
+/*
+ * Stipple VM - Program Image Container
+ * Parsing, verification, loading and serialization of STIF images.
+ * Every offset and size is checked against the image before it is used, so
+ * a parsed view can be trusted by the lookups below without further checks.
+ */
+
+#include "vm-image.h"
+#include "vm-lz4.h"
+#include <string.h>
+
+/* Compressed code is unpacked and verified in chunks of this size, so the
+ * verifier reads bytes the decoder has just written */
+#define UNPACK_CHUNK 4096u
+
+/* Scratch for verifying and re-encoding compressed images */
+static uint8_t g_unpacked[PROGRAM_MAX_SIZE];
+static uint8_t g_packed[4u + VM_LZ4_BOUND(PROGRAM_MAX_SIZE)];
+
+static inline uint32_t align_up(uint32_t n) {
+    return (n + (VM_IMAGE_ALIGN - 1u)) & ~(VM_IMAGE_ALIGN - 1u);
+}
+
+bool vm_image_is_container(const uint8_t* data, uint32_t len) {
+    uint32_t magic;
+    if (len < sizeof(magic)) return false;
+    memcpy(&magic, data, sizeof(magic));
+    return magic == VM_IMAGE_MAGIC;
+}
+
+/* ============================================================================
+ * Metadata Checks
+ * ============================================================================ */
+
+static vm_status_t check_data(const uint8_t* p, uint32_t size) {
+    uint32_t off = 0;
+    while (off < size) {
+        vm_image_data_t rec;
+        if (size - off < sizeof(rec)) return VM_ERR_INVALID_IMAGE;
+        memcpy(&rec, &p[off], sizeof(rec));
+        off += sizeof(rec);
+        if (rec.type == MB_VOID || get_buffer_capacity((membuf_type_t)rec.type) == 0u) {
+            return VM_ERR_INVALID_IMAGE;
+        }
+        uint32_t padded = ((uint32_t)rec.len + 3u) & ~3u;
+        if (rec.len > G_MEMBUF_LEN || size - off < padded) return VM_ERR_INVALID_IMAGE;
+        off += padded;
+    }
+    return VM_OK;
+}
+
+static vm_status_t check_funcs(const vm_image_t* img) {
+    uint32_t size = img->section_size[VM_SECTION_FUNCS];
+    uint32_t code_len = img->code_len;
+    if (size % sizeof(vm_image_func_t) != 0u) return VM_ERR_INVALID_IMAGE;
+    uint32_t end = 0;
+    for (uint32_t off = 0; off < size; off += sizeof(vm_image_func_t)) {
+        vm_image_func_t f;
+        memcpy(&f, &img->section[VM_SECTION_FUNCS][off], sizeof(f));
+        if (f.pc < end || f.len == 0u || f.pc >= code_len || f.len > code_len - f.pc) {
+            return VM_ERR_INVALID_IMAGE;
+        }
+        if (f.name != VM_IMAGE_NO_NAME && f.name >= img->section_size[VM_SECTION_SYMBOLS]) {
+            return VM_ERR_INVALID_IMAGE;
+        }
+        end = f.pc + f.len;
+    }
+    return VM_OK;
+}
+
+static vm_status_t check_lines(const vm_image_t* img) {
+    uint32_t size = img->section_size[VM_SECTION_LINES];
+    if (size % sizeof(vm_image_line_t) != 0u) return VM_ERR_INVALID_IMAGE;
+    for (uint32_t off = 0; off < size; off += sizeof(vm_image_line_t)) {
+        vm_image_line_t l;
+        memcpy(&l, &img->section[VM_SECTION_LINES][off], sizeof(l));
+        if (l.pc >= img->code_len) return VM_ERR_INVALID_IMAGE;
+        if (off > 0u) {
+            uint32_t prev;
+            memcpy(&prev, &img->section[VM_SECTION_LINES][off - sizeof(l)], sizeof(prev));
+            if (l.pc <= prev) return VM_ERR_INVALID_IMAGE;
+        }
+    }
+    return VM_OK;
+}
+
+static vm_status_t check_links(const vm_image_t* img) {
+    uint32_t exports = img->section_size[VM_SECTION_EXPORTS];
+    uint32_t imports = img->section_size[VM_SECTION_IMPORTS];
+    uint32_t relocs = img->section_size[VM_SECTION_RELOCS];
+    if (exports % 4u != 0u || imports % 4u != 0u || relocs % sizeof(vm_image_reloc_t) != 0u) {
+        return VM_ERR_INVALID_IMAGE;
+    }
+    for (uint32_t off = 0; off < exports; off += 4u) {
+        uint32_t func;
+        memcpy(&func, &img->section[VM_SECTION_EXPORTS][off], 4);
+        if (func >= img->section_size[VM_SECTION_FUNCS] / sizeof(vm_image_func_t)) return VM_ERR_INVALID_IMAGE;
+    }
+    for (uint32_t off = 0; off < imports; off += 4u) {
+        uint32_t name;
+        memcpy(&name, &img->section[VM_SECTION_IMPORTS][off], 4);
+        if (name >= img->section_size[VM_SECTION_SYMBOLS]) return VM_ERR_INVALID_IMAGE;
+    }
+    uint32_t next = 0;
+    for (uint32_t off = 0; off < relocs; off += sizeof(vm_image_reloc_t)) {
+        vm_image_reloc_t r;
+        memcpy(&r, &img->section[VM_SECTION_RELOCS][off], sizeof(r));
+        if (r.pc < next || r.import >= imports / 4u) return VM_ERR_INVALID_IMAGE;
+        if (r.pc >= img->code_len) return VM_ERR_INVALID_IMAGE;
+        next = r.pc + 1u;
+    }
+    return VM_OK;
+}
+
+static vm_status_t check_handlers(const vm_image_t* img) {
+    uint32_t size = img->section_size[VM_SECTION_HANDLERS];
+    if (size % sizeof(vm_handler_t) != 0u || size / sizeof(vm_handler_t) > VM_MAX_HANDLERS) {
+        return VM_ERR_INVALID_IMAGE;
+    }
+    for (uint32_t off = 0; off < size; off += sizeof(vm_handler_t)) {
+        vm_handler_t h;
+        memcpy(&h, &img->section[VM_SECTION_HANDLERS][off], sizeof(h));
+        if (h.start >= h.end || h.end > img->code_len || h.var >= STACK_VAR_COUNT) return VM_ERR_INVALID_IMAGE;
+        if (h.handler >= img->code_len) return VM_ERR_INVALID_PC;
+    }
+    return VM_OK;
+}
+
+/* ============================================================================
+ * Parsing and Loading
+ * ============================================================================ */
+
+vm_status_t vm_image_parse(const uint8_t* data, uint32_t len, vm_image_t* img) {
+    vm_image_header_t hdr;
+    if (len < sizeof(hdr)) return VM_ERR_INVALID_IMAGE;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.magic != VM_IMAGE_MAGIC || hdr.version != VM_IMAGE_VERSION ||
+        (hdr.flags & ~VM_IMAGE_FLAGS_KNOWN) != 0u || hdr.section_count > VM_IMAGE_MAX_SECTIONS) {
+        return VM_ERR_INVALID_IMAGE;
+    }
+    uint32_t table_end = sizeof(hdr) + (hdr.section_count * sizeof(vm_image_section_t));
+    if (table_end > len) return VM_ERR_INVALID_IMAGE;
+
+    memset(img, 0, sizeof(*img));
+    img->version = hdr.version;
+    img->flags = hdr.flags;
+    img->entry = hdr.entry;
+    for (uint32_t i = 0; i < hdr.section_count; i++) {
+        vm_image_section_t sec;
+        memcpy(&sec, &data[sizeof(hdr) + (i * sizeof(sec))], sizeof(sec));
+        if (sec.reserved != 0u || sec.offset % VM_IMAGE_ALIGN != 0u || sec.offset < table_end ||
+            sec.offset > len || sec.size > len - sec.offset) {
+            return VM_ERR_INVALID_IMAGE;
+        }
+        if (sec.kind == VM_SECTION_NONE || sec.kind >= VM_SECTION_COUNT) continue;
+        if (img->section[sec.kind] != NULL) return VM_ERR_INVALID_IMAGE;
+        img->section[sec.kind] = &data[sec.offset];
+        img->section_size[sec.kind] = sec.size;
+    }
+
+    /* Code must be bytecode, never another container; compressed code is
+     * checked for that once it is unpacked */
+    const uint8_t* packed = img->section[VM_SECTION_CODE_LZ4];
+    if ((img->section[VM_SECTION_CODE] == NULL) == (packed == NULL)) return VM_ERR_INVALID_IMAGE;
+    if (packed != NULL) {
+        if (img->section_size[VM_SECTION_CODE_LZ4] < 4u) return VM_ERR_INVALID_IMAGE;
+        memcpy(&img->code_len, packed, 4);
+        /* Unpacked code always goes into program[] */
+        if (img->code_len > PROGRAM_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    } else {
+        img->code_len = img->section_size[VM_SECTION_CODE];
+        if (img->code_len > PROGRAM_MAP_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+        if (vm_image_is_container(img->section[VM_SECTION_CODE], img->code_len)) return VM_ERR_INVALID_IMAGE;
+    }
+    if (img->code_len == 0u) return VM_ERR_INVALID_IMAGE;
+    if (img->entry >= img->code_len) return VM_ERR_INVALID_PC;
+
+    uint32_t sym_len = img->section_size[VM_SECTION_SYMBOLS];
+    if (sym_len > 0u && img->section[VM_SECTION_SYMBOLS][sym_len - 1u] != 0u) return VM_ERR_INVALID_IMAGE;
+    if (img->section_size[VM_SECTION_PROFILE] % 4u != 0u) return VM_ERR_INVALID_IMAGE;
+
+    vm_status_t status = check_data(img->section[VM_SECTION_DATA], img->section_size[VM_SECTION_DATA]);
+    if (status == VM_OK) status = check_funcs(img);
+    if (status == VM_OK) status = check_lines(img);
+    if (status == VM_OK) status = check_links(img);
+    if (status == VM_OK) status = check_handlers(img);
+    return status;
+}
+
+static vm_encoding_t image_encoding(const vm_image_t* img) {
+    return ((img->flags & VM_IMAGE_FLAG_COMPACT) != 0u) ? VM_ENCODING_COMPACT : VM_ENCODING_WIDE;
+}
+
+vm_status_t vm_image_unpack_code(const vm_image_t* img, uint8_t* dst, bool verify) {
+    const uint8_t* packed = img->section[VM_SECTION_CODE_LZ4];
+    if (packed == NULL) {
+        memcpy(dst, img->section[VM_SECTION_CODE], img->code_len);
+        return verify ? vm_verify_code(dst, img->code_len, image_encoding(img)) : VM_OK;
+    }
+
+    vm_lz4_stream_t s;
+    vm_lz4_stream_init(&s, &packed[4], img->section_size[VM_SECTION_CODE_LZ4] - 4u, dst, img->code_len);
+    uint32_t pc = 0;
+    while (!vm_lz4_stream_done(&s)) {
+        uint32_t src_pos = s.src_pos;
+        uint32_t dst_pos = s.dst_pos;
+        uint32_t want = (img->code_len - dst_pos > UNPACK_CHUNK) ? dst_pos + UNPACK_CHUNK : img->code_len;
+        vm_status_t status = vm_lz4_stream_decode(&s, want);
+        if (status != VM_OK) return status;
+        /* Input ran out before the output was complete */
+        if (s.src_pos == src_pos && s.dst_pos == dst_pos) return VM_ERR_INVALID_IMAGE;
+        if (verify) {
+            status = vm_verify_code_prefix(dst, s.dst_pos, img->code_len, image_encoding(img), &pc);
+            if (status != VM_OK) return status;
+        }
+    }
+    if (vm_image_is_container(dst, img->code_len)) return VM_ERR_INVALID_IMAGE;
+    return VM_OK;
+}
+
+vm_status_t vm_image_decode(const vm_image_t* img, uint8_t* scratch, const uint8_t** code) {
+    if (img->section_size[VM_SECTION_IMPORTS] != 0u) return VM_ERR_LINK;
+    if (img->section[VM_SECTION_CODE_LZ4] != NULL) {
+        *code = scratch;
+        return vm_image_unpack_code(img, scratch, true);
+    }
+    *code = img->section[VM_SECTION_CODE];
+    return vm_verify_code(*code, img->code_len, image_encoding(img));
+}
+
+vm_status_t vm_image_verify(const uint8_t* data, uint32_t len) {
+    vm_image_t img;
+    vm_status_t status = vm_image_parse(data, len, &img);
+    if (status != VM_OK) return status;
+    const uint8_t* code;
+    return vm_image_decode(&img, g_unpacked, &code);
+}
+
+void vm_image_apply_data(vm_state_t* vm, const vm_image_t* img) {
+    const uint8_t* p = img->section[VM_SECTION_DATA];
+    uint32_t size = img->section_size[VM_SECTION_DATA];
+    uint32_t off = 0;
+    while (off < size) {
+        vm_image_data_t rec;
+        memcpy(&rec, &p[off], sizeof(rec));
+        off += sizeof(rec);
+        membuf_t* buf = &vm->g_membuf[rec.buf_idx];
+        buf->type = (membuf_type_t)rec.type;
+        memset(&buf->buf, 0, sizeof(buf->buf));
+        memcpy(&buf->buf, &p[off], rec.len);
+        off += ((uint32_t)rec.len + 3u) & ~3u;
+    }
+}
+
+/* Make img's code the running program; compressed code is unpacked into program[] */
+static vm_status_t load_code(vm_state_t* vm, const vm_image_t* img, bool in_place, bool verify) {
+    if (img->section[VM_SECTION_CODE_LZ4] != NULL) {
+        vm_status_t status = vm_image_unpack_code(img, vm->program, verify);
+        if (status != VM_OK) {
+            /* program[] now holds a partial unpack; never run it */
+            vm->code = vm->program;
+            vm->program_len = 0;
+            vm->linked = NULL;
+            return status;
+        }
+        return vm_attach_verified_program(vm, vm->program, img->code_len);
+    }
+    const uint8_t* code = img->section[VM_SECTION_CODE];
+    if (verify) {
+        vm_status_t status = vm_verify_code(code, img->code_len, image_encoding(img));
+        if (status != VM_OK) return status;
+    }
+    return in_place ? vm_attach_verified_program(vm, code, img->code_len)
+                    : vm_load_verified_program(vm, code, img->code_len);
+}
+
+/* Apply DATA and the entry point once load_code() succeeded */
+static vm_status_t finish_load(vm_state_t* vm, const vm_image_t* img, vm_status_t status) {
+    if (status != VM_OK) {
+        vm->last_error = status;
+        return status;
+    }
+    vm_image_apply_data(vm, img);
+    vm->handler_count = img->section_size[VM_SECTION_HANDLERS] / sizeof(vm_handler_t);
+    if (vm->handler_count != 0u) {
+        memcpy(vm->handlers, img->section[VM_SECTION_HANDLERS], img->section_size[VM_SECTION_HANDLERS]);
+    }
+    vm->encoding = image_encoding(img);
+    vm->pc = img->entry;
+    return VM_OK;
+}
+
+vm_status_t vm_image_load_verified(vm_state_t* vm, const uint8_t* data, uint32_t len, bool in_place) {
+    vm_image_t img;
+    vm_status_t status = vm_image_parse(data, len, &img);
+    if (status == VM_OK) status = load_code(vm, &img, in_place, false);
+    return finish_load(vm, &img, status);
+}
+
+vm_status_t vm_image_attach_decoded(vm_state_t* vm, const vm_image_t* img, const uint8_t* code) {
+    return finish_load(vm, img, vm_attach_verified_program(vm, code, img->code_len));
+}
+
+vm_status_t vm_image_load(vm_state_t* vm, const uint8_t* data, uint32_t len, bool in_place) {
+    vm_image_t img;
+    vm_status_t status = vm_image_parse(data, len, &img);
+    if (status == VM_OK && img.section_size[VM_SECTION_IMPORTS] != 0u) status = VM_ERR_LINK;
+    if (status == VM_OK) status = load_code(vm, &img, in_place, true);
+    return finish_load(vm, &img, status);
+}
+
+vm_status_t vm_image_build(const vm_image_t* img, uint8_t* out, uint32_t cap, uint32_t* len) {
+    vm_image_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = VM_IMAGE_MAGIC;
+    hdr.version = VM_IMAGE_VERSION;
+    hdr.flags = img->flags;
+    hdr.entry = img->entry;
+    for (uint32_t k = VM_SECTION_CODE; k < VM_SECTION_COUNT; k++) {
+        if (img->section[k] != NULL) hdr.section_count++;
+    }
+
+    uint32_t table_end = sizeof(hdr) + (hdr.section_count * sizeof(vm_image_section_t));
+    uint32_t off = align_up(table_end);
+    if (off > cap) return VM_ERR_PROGRAM_TOO_LARGE;
+    memset(out, 0, off);
+    memcpy(out, &hdr, sizeof(hdr));
+
+    uint32_t slot = 0;
+    for (uint32_t k = VM_SECTION_CODE; k < VM_SECTION_COUNT; k++) {
+        if (img->section[k] == NULL) continue;
+        uint32_t size = img->section_size[k];
+        if (size > cap - off) return VM_ERR_PROGRAM_TOO_LARGE;
+        vm_image_section_t sec = { .kind = k, .offset = off, .size = size, .reserved = 0u };
+        memcpy(&out[sizeof(hdr) + (slot * sizeof(sec))], &sec, sizeof(sec));
+        slot++;
+        memcpy(&out[off], img->section[k], size);
+        /* Every section but the last is padded to the next boundary */
+        uint32_t end = (slot == hdr.section_count) ? off + size : align_up(off + size);
+        if (end > cap) return VM_ERR_PROGRAM_TOO_LARGE;
+        memset(&out[off + size], 0, end - (off + size));
+        off = end;
+    }
+    *len = off;
+    return VM_OK;
+}
+
+/* ============================================================================
+ * Compact Re-encoding
+ * ============================================================================ */
+
+#define NO_PC 0xFFFFFFFFu
+#define NO_SLOT INSTRUCTION_MAX_PAYLOAD_WORDS
+
+/* Scratch for vm_image_compact(); wide instructions are word aligned, so
+ * per-instruction tables are indexed by wide PC / 4 */
+static uint32_t g_new_pc[(PROGRAM_MAX_SIZE / 4u) + 1u];  /* Compact PC, or NO_PC inside an instruction */
+static uint8_t g_target_width[PROGRAM_MAX_SIZE / 4u];    /* Form width code of the jump target */
+static uint8_t g_code[PROGRAM_MAX_SIZE];
+static uint8_t g_meta[PROGRAM_IMAGE_MAX_SIZE];
+
+/* Immediate holding a code address, or NO_SLOT */
+static uint32_t target_slot(uint8_t opcode) {
+    switch (opcode) {
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JLT:
+        case OP_JGT: case OP_JLE: case OP_JGE: case OP_CALL: case OP_CALL_MEMO: case OP_TAILCALL:
+            return 0u;
+        case OP_JMP_TABLE:
+            return 1u;  /* Default target; entries are remapped separately */
+        default:
+            return NO_SLOT;
+    }
+}
+
+/* Smallest form width code whose zero extension reproduces v */
+static uint32_t width_code(uint32_t v) {
+    if (v <= 0xFFu) return 1u;
+    if (v <= 0xFFFFu) return 2u;
+    return 3u;
+}
+
+/*
+ * Encode insn into out (NULL: size only). The immediate at slot always uses
+ * slot_width, so the size does not depend on where its target ends up.
+ */
+static uint32_t compact_emit(const vm_instruction_t* insn, uint32_t slot, uint32_t slot_width, uint8_t* out) {
+    uint8_t buf[COMPACT_HEADER_SIZE + (INSTRUCTION_MAX_PAYLOAD_WORDS * 4u)];
+    uint32_t count = INSTR_PAYLOAD_LEN(insn->header);
+    uint32_t n = COMPACT_HEADER_SIZE;
+    uint32_t i = 0;
+    uint8_t form = 0;
+    if (count >= 2u && slot >= 2u && insn->imm[0].u32 < 16u && insn->imm[1].u32 < 16u) {
+        form |= COMPACT_FORM_NIBBLES;
+        buf[n++] = (uint8_t)(insn->imm[0].u32 | (insn->imm[1].u32 << 4));
+        i = 2;
+    }
+    for (; i < count; i++) {
+        uint32_t v = insn->imm[i].u32;
+        uint32_t w = (i == slot) ? slot_width : width_code(v);
+        form |= (uint8_t)(w << (i * 2u));
+        if (w == 1u) {
+            buf[n++] = (uint8_t)v;
+        } else if (w == 2u) {
+            uint16_t h = (uint16_t)v;
+            memcpy(&buf[n], &h, 2);
+            n += 2u;
+        } else {
+            memcpy(&buf[n], &v, 4);
+            n += 4u;
+        }
+    }
+    buf[0] = insn->header.opcode;
+    buf[1] = insn->header.operand;
+    buf[2] = form;
+    if (out != NULL) memcpy(out, buf, n);
+    return n;
+}
+
+/* Wide PC to compact PC; only instruction starts and the end of code map */
+static bool remap_pc(uint32_t pc, uint32_t code_len, uint32_t* out) {
+    if (pc % 4u != 0u || pc > code_len || g_new_pc[pc / 4u] == NO_PC) return false;
+    *out = g_new_pc[pc / 4u];
+    return true;
+}
+
+/* Fill g_new_pc for the current target widths; returns the compact length */
+static uint32_t compact_layout(const uint8_t* code, uint32_t len) {
+    for (uint32_t i = 0; i <= len / 4u; i++) g_new_pc[i] = NO_PC;
+    uint32_t pc = 0;
+    uint32_t new_pc = 0;
+    while (pc < len) {
+        vm_instruction_t insn;
+        (void)vm_decode_instruction(code, len, pc, VM_ENCODING_WIDE, &insn);
+        g_new_pc[pc / 4u] = new_pc;
+        uint32_t table = (insn.header.opcode == OP_JMP_TABLE) ? insn.imm[0].u32 * 4u : 0u;
+        new_pc += compact_emit(&insn, target_slot(insn.header.opcode), g_target_width[pc / 4u], NULL) + table;
+        pc += insn.size + table;
+    }
+    g_new_pc[len / 4u] = new_pc;
+    return new_pc;
+}
+
+/*
+ * Branch relaxation: every target starts with a 1-byte immediate and is
+ * widened until it fits its final address. Widths only grow, so this
+ * terminates after at most two widenings per branch.
+ */
+static vm_status_t compact_code(const uint8_t* code, uint32_t len, uint32_t* out_len) {
+    for (uint32_t i = 0; i < len / 4u; i++) g_target_width[i] = 1u;
+    bool grown = true;
+    while (grown) {
+        grown = false;
+        (void)compact_layout(code, len);
+        for (uint32_t pc = 0; pc < len; ) {
+            vm_instruction_t insn;
+            (void)vm_decode_instruction(code, len, pc, VM_ENCODING_WIDE, &insn);
+            uint32_t slot = target_slot(insn.header.opcode);
+            if (slot != NO_SLOT) {
+                uint32_t target;
+                if (!remap_pc(insn.imm[slot].u32, len, &target)) return VM_ERR_INVALID_PC;
+                if (width_code(target) > g_target_width[pc / 4u]) {
+                    g_target_width[pc / 4u] = (uint8_t)width_code(target);
+                    grown = true;
+                }
+            }
+            pc += insn.size + ((insn.header.opcode == OP_JMP_TABLE) ? insn.imm[0].u32 * 4u : 0u);
+        }
+    }
+
+    uint32_t new_pc = 0;
+    for (uint32_t pc = 0; pc < len; ) {
+        vm_instruction_t insn;
+        (void)vm_decode_instruction(code, len, pc, VM_ENCODING_WIDE, &insn);
+        uint32_t slot = target_slot(insn.header.opcode);
+        if (slot != NO_SLOT) (void)remap_pc(insn.imm[slot].u32, len, &insn.imm[slot].u32);
+        new_pc += compact_emit(&insn, slot, g_target_width[pc / 4u], &g_code[new_pc]);
+        pc += insn.size;
+        if (insn.header.opcode == OP_JMP_TABLE) {
+            for (uint32_t i = 0; i < insn.imm[0].u32; i++) {
+                uint32_t target;
+                memcpy(&target, &code[pc], 4);
+                if (!remap_pc(target, len, &target)) return VM_ERR_INVALID_PC;
+                memcpy(&g_code[new_pc], &target, 4);
+                new_pc += 4u;
+                pc += 4u;
+            }
+        }
+    }
+    *out_len = new_pc;
+    return VM_OK;
+}
+
+vm_status_t vm_image_compact(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len) {
+    if (len > PROGRAM_IMAGE_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    vm_status_t status = vm_verify_program(in, len);
+    if (status != VM_OK) return status;
+    vm_image_t img;
+    if (vm_image_is_container(in, len)) {
+        (void)vm_image_parse(in, len, &img);
+        if ((img.flags & VM_IMAGE_FLAG_COMPACT) != 0u) {
+            if (len > cap) return VM_ERR_PROGRAM_TOO_LARGE;
+            memcpy(out, in, len);
+            *out_len = len;
+            return VM_OK;
+        }
+        if (img.section[VM_SECTION_CODE_LZ4] != NULL) {
+            (void)vm_image_unpack_code(&img, g_unpacked, false);
+            img.section[VM_SECTION_CODE] = g_unpacked;
+            img.section_size[VM_SECTION_CODE] = img.code_len;
+            img.section[VM_SECTION_CODE_LZ4] = NULL;
+            img.section_size[VM_SECTION_CODE_LZ4] = 0;
+        }
+    } else {
+        memset(&img, 0, sizeof(img));
+        img.section[VM_SECTION_CODE] = in;
+        img.section_size[VM_SECTION_CODE] = len;
+        img.code_len = len;
+    }
+
+    const uint8_t* code = img.section[VM_SECTION_CODE];
+    uint32_t code_len = img.code_len;
+    uint32_t compact_len;
+    if (code_len > PROGRAM_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;  /* Scratch tables */
+    status = compact_code(code, code_len, &compact_len);
+    if (status != VM_OK) return status;
+    if (!remap_pc(img.entry, code_len, &img.entry)) return VM_ERR_INVALID_PC;
+
+    /* FUNCS, LINES and HANDLERS are rewritten into g_meta, one after the other */
+    uint32_t meta = 0;
+    uint32_t funcs_len = img.section_size[VM_SECTION_FUNCS];
+    for (uint32_t off = 0; off < funcs_len; off += sizeof(vm_image_func_t)) {
+        vm_image_func_t f;
+        memcpy(&f, &img.section[VM_SECTION_FUNCS][off], sizeof(f));
+        uint32_t start, end;
+        if (!remap_pc(f.pc, code_len, &start) || !remap_pc(f.pc + f.len, code_len, &end)) return VM_ERR_INVALID_PC;
+        f.pc = start;
+        f.len = end - start;
+        memcpy(&g_meta[meta + off], &f, sizeof(f));
+    }
+    if (img.section[VM_SECTION_FUNCS] != NULL) img.section[VM_SECTION_FUNCS] = &g_meta[meta];
+    meta += funcs_len;
+    uint32_t lines_len = img.section_size[VM_SECTION_LINES];
+    for (uint32_t off = 0; off < lines_len; off += sizeof(vm_image_line_t)) {
+        vm_image_line_t l;
+        memcpy(&l, &img.section[VM_SECTION_LINES][off], sizeof(l));
+        if (!remap_pc(l.pc, code_len, &l.pc)) return VM_ERR_INVALID_PC;
+        memcpy(&g_meta[meta + off], &l, sizeof(l));
+    }
+    if (img.section[VM_SECTION_LINES] != NULL) img.section[VM_SECTION_LINES] = &g_meta[meta];
+    meta += lines_len;
+    uint32_t handlers_len = img.section_size[VM_SECTION_HANDLERS];
+    for (uint32_t off = 0; off < handlers_len; off += sizeof(vm_handler_t)) {
+        vm_handler_t h;
+        memcpy(&h, &img.section[VM_SECTION_HANDLERS][off], sizeof(h));
+        if (!remap_pc(h.start, code_len, &h.start) || !remap_pc(h.end, code_len, &h.end) ||
+            !remap_pc(h.handler, code_len, &h.handler)) {
+            return VM_ERR_INVALID_PC;
+        }
+        memcpy(&g_meta[meta + off], &h, sizeof(h));
+    }
+    if (img.section[VM_SECTION_HANDLERS] != NULL) img.section[VM_SECTION_HANDLERS] = &g_meta[meta];
+
+    img.section[VM_SECTION_CODE] = g_code;
+    img.section_size[VM_SECTION_CODE] = compact_len;
+    img.section[VM_SECTION_PROFILE] = NULL;
+    img.section_size[VM_SECTION_PROFILE] = 0;
+    img.flags |= VM_IMAGE_FLAG_COMPACT | VM_IMAGE_FLAG_VERIFIED;
+    status = vm_image_build(&img, out, cap, out_len);
+    if (status != VM_OK) return status;
+    return vm_image_verify(out, *out_len);
+}
+
+/* ============================================================================
+ * Compression
+ * ============================================================================ */
+
+vm_status_t vm_image_compress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len) {
+    if (len > PROGRAM_IMAGE_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    vm_status_t status;
+    vm_image_t img;
+    if (vm_image_is_container(in, len)) {
+        /* Not vm_verify_program(): modules with imports may be compressed too */
+        status = vm_image_parse(in, len, &img);
+        if (status != VM_OK) return status;
+        if (img.section[VM_SECTION_CODE_LZ4] != NULL) {
+            if (len > cap) return VM_ERR_PROGRAM_TOO_LARGE;
+            memcpy(out, in, len);
+            *out_len = len;
+            return VM_OK;
+        }
+    } else {
+        memset(&img, 0, sizeof(img));
+        img.section[VM_SECTION_CODE] = in;
+        img.section_size[VM_SECTION_CODE] = len;
+        img.code_len = len;
+    }
+    if (img.code_len > PROGRAM_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;  /* Unpacks into program[] */
+    status = vm_verify_code(img.section[VM_SECTION_CODE], img.code_len, image_encoding(&img));
+    if (status != VM_OK) return status;
+
+    uint32_t packed_len;
+    memcpy(g_packed, &img.code_len, 4);
+    status = vm_lz4_compress(img.section[VM_SECTION_CODE], img.code_len, &g_packed[4],
+                             (uint32_t)sizeof(g_packed) - 4u, &packed_len);
+    if (status != VM_OK) return status;
+    img.section[VM_SECTION_CODE] = NULL;
+    img.section_size[VM_SECTION_CODE] = 0;
+    img.section[VM_SECTION_CODE_LZ4] = g_packed;
+    img.section_size[VM_SECTION_CODE_LZ4] = packed_len + 4u;
+    img.flags |= VM_IMAGE_FLAG_VERIFIED;
+    status = vm_image_build(&img, out, cap, out_len);
+    if (status == VM_OK) status = vm_image_parse(out, *out_len, &img);
+    if (status == VM_OK) status = vm_image_unpack_code(&img, g_unpacked, true);
+    return status;
+}
+
+/* ============================================================================
+ * Metadata Lookups
+ * ============================================================================ */
+
+bool vm_image_function_at(const vm_image_t* img, uint32_t pc, vm_image_func_t* func) {
+    uint32_t lo = 0;
+    uint32_t hi = img->section_size[VM_SECTION_FUNCS] / sizeof(vm_image_func_t);
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2u);
+        vm_image_func_t f;
+        memcpy(&f, &img->section[VM_SECTION_FUNCS][mid * sizeof(f)], sizeof(f));
+        if (pc < f.pc) {
+            hi = mid;
+        } else if (pc - f.pc >= f.len) {
+            lo = mid + 1u;
+        } else {
+            *func = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t vm_image_line_at(const vm_image_t* img, uint32_t pc) {
+    /* Last entry with entry.pc <= pc */
+    uint32_t lo = 0;
+    uint32_t hi = img->section_size[VM_SECTION_LINES] / sizeof(vm_image_line_t);
+    uint32_t line = 0;
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2u);
+        vm_image_line_t l;
+        memcpy(&l, &img->section[VM_SECTION_LINES][mid * sizeof(l)], sizeof(l));
+        if (l.pc <= pc) {
+            line = l.line;
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return line;
+}
+
+const char* vm_image_symbol(const vm_image_t* img, uint32_t offset) {
+    if (offset >= img->section_size[VM_SECTION_SYMBOLS]) return NULL;
+    return (const char*)&img->section[VM_SECTION_SYMBOLS][offset];
+}
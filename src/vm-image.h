@@ -0,0 +1,185 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - Program Image Container
+ * Optional wrapper around raw bytecode: a header with magic, version, flags
+ * and entry point, then a section table. Sections start on VM_IMAGE_ALIGN
+ * boundaries so a mapped file can be used in place. Fields are in host byte
+ * order, like the instruction encoding.
+ *
+ * The magic's third byte reads as an instruction flags byte with payload
+ * length 9, which vm_verify_program() rejects, so no valid raw image starts
+ * with it and loaders can accept both forms.
+ */
+
+/* ============================================================================
+ * Container Constants
+ * ============================================================================ */
+
+#define VM_IMAGE_MAGIC 0x46495453u   /* "STIF" */
+#define VM_IMAGE_VERSION 1u
+#define VM_IMAGE_ALIGN 64u           /* Section offset alignment (cache line) */
+#define VM_IMAGE_MAX_SECTIONS 16u    /* Section table entries */
+#define VM_IMAGE_NO_NAME 0xFFFFFFFFu /* vm_image_func_t.name without a symbol */
+
+/* vm_image_header_t.flags; unknown bits are rejected */
+#define VM_IMAGE_FLAG_VERIFIED  0x0001u  /* Producer ran vm_verify_program() on the code */
+#define VM_IMAGE_FLAG_OPTIMIZED 0x0002u  /* Code was rewritten by an optimizer */
+#define VM_IMAGE_FLAG_COMPACT   0x0004u  /* CODE uses VM_ENCODING_COMPACT */
+#define VM_IMAGE_FLAGS_KNOWN    (VM_IMAGE_FLAG_VERIFIED | VM_IMAGE_FLAG_OPTIMIZED | VM_IMAGE_FLAG_COMPACT)
+
+/* Section kinds; each may appear at most once, unknown kinds are skipped */
+typedef enum {
+	VM_SECTION_NONE = 0,
+	VM_SECTION_CODE,     /* Bytecode, wide or compact per the flags (required) */
+	VM_SECTION_DATA,     /* vm_image_data_t records: initial buffer contents */
+	VM_SECTION_FUNCS,    /* vm_image_func_t entries sorted by pc */
+	VM_SECTION_SYMBOLS,  /* NUL-terminated names referenced by offset */
+	VM_SECTION_LINES,    /* vm_image_line_t entries sorted by pc */
+	VM_SECTION_PROFILE,  /* Profile counters, 4-byte words (format owned by the profiler) */
+	VM_SECTION_EXPORTS,  /* uint32_t FUNCS indices other modules may call (vm-link.h) */
+	VM_SECTION_IMPORTS,  /* uint32_t SYMBOLS offsets of functions defined elsewhere */
+	VM_SECTION_RELOCS,   /* vm_image_reloc_t entries sorted by pc */
+	VM_SECTION_CODE_LZ4, /* In place of CODE: uint32_t code length, then one LZ4 block (vm-lz4.h) */
+	VM_SECTION_HANDLERS, /* vm_handler_t entries, innermost first; the first covering entry wins */
+	VM_SECTION_COUNT
+} vm_section_kind_t;
+
+/* ============================================================================
+ * On-Disk Structures
+ * ============================================================================ */
+
+/* Image header, followed by section_count section table entries */
+typedef struct {
+	uint32_t magic;          /* VM_IMAGE_MAGIC */
+	uint16_t version;        /* VM_IMAGE_VERSION */
+	uint16_t flags;          /* VM_IMAGE_FLAG_* */
+	uint32_t entry;          /* Initial PC, an offset into the CODE section */
+	uint32_t section_count;  /* Section table entries */
+} vm_image_header_t;
+
+typedef struct {
+	uint32_t kind;      /* vm_section_kind_t */
+	uint32_t offset;    /* From the start of the image; multiple of VM_IMAGE_ALIGN */
+	uint32_t size;      /* Section length in bytes */
+	uint32_t reserved;  /* Must be 0 */
+} vm_image_section_t;
+
+/* DATA record, followed by len content bytes padded to a multiple of 4 */
+typedef struct {
+	uint8_t buf_idx;  /* Target buffer */
+	uint8_t type;     /* membuf_type_t given to the buffer */
+	uint16_t len;     /* Content bytes (at most G_MEMBUF_LEN); the rest is zeroed */
+} vm_image_data_t;
+
+/* FUNCS entry; functions do not overlap */
+typedef struct {
+	uint32_t pc;    /* First instruction */
+	uint32_t len;   /* Code bytes */
+	uint32_t name;  /* Offset into SYMBOLS, or VM_IMAGE_NO_NAME */
+} vm_image_func_t;
+
+/* LINES entry; covers code from pc up to the next entry */
+typedef struct {
+	uint32_t pc;
+	uint32_t line;  /* Source line, 1-based */
+} vm_image_line_t;
+
+/* RELOCS entry: the CALL or CALL_MEMO at pc targets an import; its imm1 is ignored */
+typedef struct {
+	uint32_t pc;      /* CALL instruction in this module's CODE */
+	uint32_t import;  /* Index into IMPORTS */
+} vm_image_reloc_t;
+
+_Static_assert(sizeof(vm_image_header_t) == 16, "vm_image_header_t must have no padding");
+_Static_assert(sizeof(vm_image_section_t) == 16, "vm_image_section_t must have no padding");
+_Static_assert(sizeof(vm_image_data_t) == 4, "vm_image_data_t must have no padding");
+_Static_assert(sizeof(vm_image_func_t) == 12, "vm_image_func_t must have no padding");
+_Static_assert(sizeof(vm_image_line_t) == 8, "vm_image_line_t must have no padding");
+_Static_assert(sizeof(vm_image_reloc_t) == 8, "vm_image_reloc_t must have no padding");
+_Static_assert(sizeof(vm_handler_t) == 16, "vm_handler_t must have no padding");
+
+/* Parsed view of an image; sections point into the caller's bytes */
+typedef struct {
+	uint16_t version;
+	uint16_t flags;
+	uint32_t entry;
+	uint32_t code_len;                         /* Code bytes, after decompression */
+	const uint8_t* section[VM_SECTION_COUNT];  /* Indexed by kind; NULL when absent */
+	uint32_t section_size[VM_SECTION_COUNT];
+} vm_image_t;
+
+/* ============================================================================
+ * Image API
+ * ============================================================================ */
+
+/* True if data starts with a container header rather than raw bytecode */
+bool vm_image_is_container(const uint8_t* data, uint32_t len);
+
+/* Check the header, section table and metadata sections (not the code itself) */
+vm_status_t vm_image_parse(const uint8_t* data, uint32_t len, vm_image_t* img);
+
+/* vm_image_parse() plus vm_verify_code() on the CODE section. A module with
+ * IMPORTS is rejected with VM_ERR_LINK: it only runs through vm_link().
+ * Compressed code is unpacked into static scratch space to be verified. */
+vm_status_t vm_image_verify(const uint8_t* data, uint32_t len);
+
+/* Load CODE (copied, or run in place from data), apply DATA and set the PC
+ * to the entry point of a verified image. CODE_LZ4 is unpacked into program[]. */
+vm_status_t vm_image_load_verified(vm_state_t* vm, const uint8_t* data, uint32_t len, bool in_place);
+
+/* vm_image_verify() and vm_image_load_verified() in one pass: compressed
+ * code is verified while it is unpacked. On failure vm has no program. */
+vm_status_t vm_image_load(vm_state_t* vm, const uint8_t* data, uint32_t len, bool in_place);
+
+/*
+ * The verification half of vm_image_verify() for a parsed image, kept apart
+ * so the work is done once for an image that is loaded many times. *code
+ * receives the runnable code: the CODE section itself, or CODE_LZ4 unpacked
+ * into scratch (PROGRAM_MAX_SIZE bytes).
+ */
+vm_status_t vm_image_decode(const vm_image_t* img, uint8_t* scratch, const uint8_t** code);
+
+/* Run code from vm_image_decode() in place and apply DATA, HANDLERS and the
+ * entry point of img. Nothing is parsed, unpacked or verified; the image and
+ * code must stay alive and unchanged while vm uses them. */
+vm_status_t vm_image_attach_decoded(vm_state_t* vm, const vm_image_t* img, const uint8_t* code);
+
+/*
+ * Write img->code_len bytes of code to dst, decompressing CODE_LZ4 in
+ * chunks. With verify, each chunk is verified right after it is written,
+ * so the code is read once while it is still in cache.
+ */
+vm_status_t vm_image_unpack_code(const vm_image_t* img, uint8_t* dst, bool verify);
+
+/* Copy the DATA records of a parsed image into vm's buffers */
+void vm_image_apply_data(vm_state_t* vm, const vm_image_t* img);
+
+/* Serialize img (sections, flags, entry) into out; *len receives the image size */
+vm_status_t vm_image_build(const vm_image_t* img, uint8_t* out, uint32_t cap, uint32_t* len);
+
+/*
+ * Re-encode a wide raw or container image as a compact container. Jump
+ * targets, JMP_TABLE entries, the entry point, FUNCS and LINES are remapped;
+ * PROFILE is dropped because its counters are keyed by the old PCs. A
+ * compact input is copied unchanged. out must not overlap in. Uses static
+ * scratch space, so it is not reentrant.
+ */
+vm_status_t vm_image_compact(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len);
+
+/*
+ * Replace the CODE of a raw or container image with CODE_LZ4. The code is
+ * verified first. An input that is already compressed is copied unchanged.
+ * Uses static scratch space, so it is not reentrant.
+ */
+vm_status_t vm_image_compress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len);
+
+/* Function containing pc; false if FUNCS is absent or no function covers it */
+bool vm_image_function_at(const vm_image_t* img, uint32_t pc, vm_image_func_t* func);
+
+/* Source line for pc, or 0 if LINES is absent or does not cover it */
+uint32_t vm_image_line_at(const vm_image_t* img, uint32_t pc);
+
+/* Symbol at offset in SYMBOLS, or NULL */
+const char* vm_image_symbol(const vm_image_t* img, uint32_t offset);
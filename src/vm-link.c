@@ -0,0 +1,312 @@
+/*
+ * Stipple VM - Module Linker
+ * Linking only copies code and matches names. Everything that decodes
+ * instructions happens in link_function(), once per function, on its first
+ * call: a checking pass, then a pass that rewrites module-relative targets
+ * and import calls into linked PCs. Patching only after the whole function
+ * checked out means a rejected function is never left half relocated.
+ */
+
+#include "vm-link.h"
+#include <string.h>
+
+#define NO_FUNC 0xFFFFFFFFu
+
+/* ============================================================================
+ * Lookups
+ * ============================================================================ */
+
+/* Index of the function containing pc, or NO_FUNC */
+static uint32_t find_func(const vm_linked_t* prog, uint32_t pc) {
+    uint32_t lo = 0;
+    uint32_t hi = prog->func_count;
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2u);
+        const vm_link_func_t* f = &prog->funcs[mid];
+        if (pc < f->pc) {
+            hi = mid;
+        } else if (pc - f->pc >= f->len) {
+            lo = mid + 1u;
+        } else {
+            return mid;
+        }
+    }
+    return NO_FUNC;
+}
+
+/* Exported functions named name; *pc receives the entry of the last match */
+static uint32_t find_export(const vm_linked_t* prog, const char* name, uint32_t* pc) {
+    uint32_t matches = 0;
+    for (uint32_t m = 0; m < prog->module_count; m++) {
+        const vm_link_module_t* mod = &prog->modules[m];
+        uint32_t size = mod->img.section_size[VM_SECTION_EXPORTS];
+        for (uint32_t off = 0; off < size; off += 4u) {
+            uint32_t idx;
+            memcpy(&idx, &mod->img.section[VM_SECTION_EXPORTS][off], 4);
+            const vm_link_func_t* f = &prog->funcs[mod->func_base + idx];
+            if (f->name != NULL && strcmp(f->name, name) == 0) {
+                *pc = f->pc;
+                matches++;
+            }
+        }
+    }
+    return matches;
+}
+
+const vm_link_func_t* vm_link_function_at(const vm_linked_t* prog, uint32_t pc) {
+    uint32_t i = find_func(prog, pc);
+    return (i == NO_FUNC) ? NULL : &prog->funcs[i];
+}
+
+/* ============================================================================
+ * Lazy Verification
+ * ============================================================================ */
+
+static uint32_t reloc_count(const vm_link_module_t* mod) {
+    return mod->img.section_size[VM_SECTION_RELOCS] / sizeof(vm_image_reloc_t);
+}
+
+static vm_image_reloc_t reloc_at(const vm_link_module_t* mod, uint32_t i) {
+    vm_image_reloc_t r;
+    memcpy(&r, &mod->img.section[VM_SECTION_RELOCS][i * sizeof(r)], sizeof(r));
+    return r;
+}
+
+/* First reloc at or after module-relative pc */
+static uint32_t first_reloc(const vm_link_module_t* mod, uint32_t pc) {
+    uint32_t lo = 0;
+    uint32_t hi = reloc_count(mod);
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2u);
+        if (reloc_at(mod, mid).pc < pc) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void patch_u32(vm_linked_t* prog, uint32_t at, uint32_t value) {
+    memcpy(&prog->code[at], &value, 4);
+}
+
+/*
+ * Check the function f (patch false) or rewrite its targets into linked PCs
+ * (patch true). Jump targets must stay inside f and non-import CALLs must
+ * hit a function entry of the same module.
+ */
+static vm_status_t link_function(vm_linked_t* prog, const vm_link_func_t* f, bool patch) {
+    const vm_link_module_t* mod = &prog->modules[f->module];
+    const uint32_t base = mod->base;
+    const uint32_t start = f->pc - base;  /* Module-relative bounds */
+    const uint32_t end = start + f->len;
+    const uint32_t relocs = reloc_count(mod);
+    uint32_t r = first_reloc(mod, start);
+    uint8_t last = OP_NOP;
+
+    for (uint32_t pc = f->pc; pc < f->pc + f->len;) {
+        vm_instruction_t insn;
+        vm_status_t status = vm_decode_instruction(prog->code, f->pc + f->len, pc, VM_ENCODING_WIDE, &insn);
+        if (status != VM_OK) return status;
+        uint32_t size = insn.size;
+        uint32_t imm1 = insn.imm[0].u32;
+        uint32_t at = pc + INSTRUCTION_HEADER_SIZE;  /* First immediate */
+
+        /* A reloc that is not at an instruction boundary was skipped over */
+        bool import = false;
+        if (r < relocs) {
+            vm_image_reloc_t rel = reloc_at(mod, r);
+            if (rel.pc + base < pc) return VM_ERR_LINK;
+            if (rel.pc + base == pc) {
+                const uint8_t op = insn.header.opcode;
+                if ((op != OP_CALL && op != OP_CALL_MEMO && op != OP_TAILCALL) || INSTR_PAYLOAD_LEN(insn.header) == 0u) {
+                    return VM_ERR_LINK;
+                }
+                if (patch) patch_u32(prog, at, prog->imports[mod->import_base + rel.import]);
+                import = true;
+                r++;
+            }
+        }
+
+        switch (insn.header.opcode) {
+            case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JLT:
+            case OP_JGT: case OP_JLE: case OP_JGE:
+                if (imm1 < start || imm1 >= end) return VM_ERR_INVALID_PC;
+                if (patch) patch_u32(prog, at, imm1 + base);
+                break;
+            case OP_CALL: case OP_CALL_MEMO: case OP_TAILCALL: {
+                if (import) break;
+                if (imm1 >= mod->img.code_len) return VM_ERR_INVALID_PC;
+                uint32_t callee = find_func(prog, imm1 + base);
+                if (callee == NO_FUNC || prog->funcs[callee].pc != imm1 + base) return VM_ERR_INVALID_PC;
+                if (patch) patch_u32(prog, at, imm1 + base);
+                break;
+            }
+            case OP_JMP_TABLE: {
+                if (INSTR_PAYLOAD_LEN(insn.header) != 2u) return VM_ERR_INVALID_INSTRUCTION;
+                uint32_t dflt = insn.imm[1].u32;
+                if (dflt < start || dflt >= end) return VM_ERR_INVALID_PC;
+                /* imm1 is the entry count; the table follows the instruction */
+                if (imm1 > (f->pc + f->len - pc - size) / 4u) return VM_ERR_INVALID_INSTRUCTION;
+                if (patch) patch_u32(prog, at + 4u, dflt + base);
+                for (uint32_t i = 0; i < imm1; i++) {
+                    uint32_t entry = pc + size + (i * 4u);
+                    uint32_t target;
+                    memcpy(&target, &prog->code[entry], 4);
+                    if (target < start || target >= end) return VM_ERR_INVALID_PC;
+                    if (patch) patch_u32(prog, entry, target + base);
+                }
+                size += imm1 * 4u;
+                break;
+            }
+            default:
+                break;
+        }
+        last = insn.header.opcode;
+        pc += size;
+    }
+
+    /* Relocs left inside f were in the middle of its last instruction */
+    if (r < relocs && reloc_at(mod, r).pc < end) return VM_ERR_LINK;
+    /* No falling through into the next, possibly unverified, function */
+    if (last != OP_RET && last != OP_JMP && last != OP_JMP_TABLE && last != OP_HALT && last != OP_TAILCALL) {
+        return VM_ERR_LINK;
+    }
+    return VM_OK;
+}
+
+vm_status_t vm_link_load(vm_linked_t* prog, uint32_t pc) {
+    uint32_t i = find_func(prog, pc);
+    if (i == NO_FUNC || prog->funcs[i].pc != pc) return VM_ERR_INVALID_PC;
+    vm_link_func_t* f = &prog->funcs[i];
+    if (f->state == VM_LINK_FUNC_PENDING) {
+        vm_status_t status = link_function(prog, f, false);
+        if (status != VM_OK) {
+            f->state = VM_LINK_FUNC_BAD;
+            f->error = status;
+        } else {
+            (void)link_function(prog, f, true);
+            f->state = VM_LINK_FUNC_READY;
+            prog->ready[pc / 32u] |= 1u << (pc % 32u);
+            prog->ready_count++;
+        }
+    }
+    return (f->state == VM_LINK_FUNC_BAD) ? f->error : VM_OK;
+}
+
+/* ============================================================================
+ * Linking
+ * ============================================================================ */
+
+/* Mark the buffers a module's DATA initializes; false if one is already taken */
+static bool claim_data(const vm_image_t* img, uint32_t* used) {
+    const uint8_t* p = img->section[VM_SECTION_DATA];
+    uint32_t size = img->section_size[VM_SECTION_DATA];
+    uint32_t off = 0;
+    while (off < size) {
+        vm_image_data_t rec;
+        memcpy(&rec, &p[off], sizeof(rec));
+        off += sizeof(rec) + (((uint32_t)rec.len + 3u) & ~3u);
+        uint32_t bit = 1u << (rec.buf_idx % 32u);
+        if ((used[rec.buf_idx / 32u] & bit) != 0u) return false;
+        used[rec.buf_idx / 32u] |= bit;
+    }
+    return true;
+}
+
+/* Copy one module's code and function table into prog */
+static vm_status_t add_module(vm_linked_t* prog, const uint8_t* data, uint32_t len, uint32_t* import_count) {
+    vm_link_module_t* mod = &prog->modules[prog->module_count];
+    if (!vm_image_is_container(data, len)) return VM_ERR_LINK;
+    vm_status_t status = vm_image_parse(data, len, &mod->img);
+    if (status != VM_OK) return status;
+    if ((mod->img.flags & VM_IMAGE_FLAG_COMPACT) != 0u) return VM_ERR_LINK;
+    /* Handler PCs would need relocating, and vm.handlers is per program */
+    if (mod->img.section[VM_SECTION_HANDLERS] != NULL) return VM_ERR_LINK;
+
+    uint32_t code_len = mod->img.code_len;
+    uint32_t padded = (code_len + 3u) & ~3u;
+    uint32_t funcs = mod->img.section_size[VM_SECTION_FUNCS] / sizeof(vm_image_func_t);
+    uint32_t imports = mod->img.section_size[VM_SECTION_IMPORTS] / 4u;
+    if (padded > VM_LINK_MAX_CODE - prog->code_len) return VM_ERR_PROGRAM_TOO_LARGE;
+    if (funcs == 0u || funcs > VM_LINK_MAX_FUNCS - prog->func_count) return VM_ERR_LINK;
+    if (imports > VM_LINK_MAX_IMPORTS - *import_count) return VM_ERR_LINK;
+
+    mod->base = prog->code_len;
+    mod->func_base = prog->func_count;
+    mod->import_base = *import_count;
+    /* Copied, or unpacked without verification; that happens per function */
+    status = vm_image_unpack_code(&mod->img, &prog->code[mod->base], false);
+    if (status != VM_OK) return status;
+    memset(&prog->code[mod->base + code_len], 0, padded - code_len);
+    for (uint32_t i = 0; i < funcs; i++) {
+        vm_image_func_t src;
+        memcpy(&src, &mod->img.section[VM_SECTION_FUNCS][i * sizeof(src)], sizeof(src));
+        vm_link_func_t* f = &prog->funcs[prog->func_count++];
+        f->pc = src.pc + mod->base;
+        f->len = src.len;
+        f->module = prog->module_count;
+        f->state = VM_LINK_FUNC_PENDING;
+        f->error = VM_OK;
+        f->name = vm_image_symbol(&mod->img, src.name);
+    }
+    prog->code_len += padded;
+    *import_count += imports;
+    prog->module_count++;
+    return VM_OK;
+}
+
+vm_status_t vm_link(vm_linked_t* prog, const uint8_t* const* modules, const uint32_t* lens, uint32_t count) {
+    prog->code_len = 0;
+    prog->entry = 0;
+    prog->module_count = 0;
+    prog->func_count = 0;
+    prog->ready_count = 0;
+    memset(prog->ready, 0, sizeof(prog->ready));
+    if (count == 0u || count > VM_LINK_MAX_MODULES) return VM_ERR_LINK;
+
+    uint32_t import_count = 0;
+    uint32_t used[G_MEMBUF_COUNT / 32u] = {0};
+    for (uint32_t m = 0; m < count; m++) {
+        vm_status_t status = add_module(prog, modules[m], lens[m], &import_count);
+        if (status != VM_OK) return status;
+        if (!claim_data(&prog->modules[m].img, used)) return VM_ERR_LINK;
+    }
+    /* The linked code is attached as a raw image, so it must not look like a container */
+    if (vm_image_is_container(prog->code, prog->code_len)) return VM_ERR_LINK;
+
+    /* Each export name once, and every import resolved */
+    for (uint32_t m = 0; m < prog->module_count; m++) {
+        const vm_link_module_t* mod = &prog->modules[m];
+        uint32_t size = mod->img.section_size[VM_SECTION_EXPORTS];
+        for (uint32_t off = 0; off < size; off += 4u) {
+            uint32_t idx;
+            uint32_t pc;
+            memcpy(&idx, &mod->img.section[VM_SECTION_EXPORTS][off], 4);
+            const char* name = prog->funcs[mod->func_base + idx].name;
+            if (name == NULL || find_export(prog, name, &pc) != 1u) return VM_ERR_LINK;
+        }
+        size = mod->img.section_size[VM_SECTION_IMPORTS];
+        for (uint32_t off = 0; off < size; off += 4u) {
+            uint32_t sym;
+            memcpy(&sym, &mod->img.section[VM_SECTION_IMPORTS][off], 4);
+            uint32_t* target = &prog->imports[mod->import_base + (off / 4u)];
+            if (find_export(prog, vm_image_symbol(&mod->img, sym), target) != 1u) return VM_ERR_LINK;
+        }
+    }
+
+    prog->entry = prog->modules[0].img.entry;
+    return vm_link_load(prog, prog->entry);
+}
+
+vm_status_t vm_link_attach(vm_state_t* vm, vm_linked_t* prog) {
+    vm_status_t status = vm_attach_verified_program(vm, prog->code, prog->code_len);
+    if (status != VM_OK) return status;
+    for (uint32_t m = 0; m < prog->module_count; m++) {
+        vm_image_apply_data(vm, &prog->modules[m].img);
+    }
+    vm->linked = prog;
+    vm->pc = prog->entry;
+    return VM_OK;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "stipple.h"
+#include "vm-image.h"
+
+/*
+ * Stipple VM - Module Linker
+ * A module is a wide container image whose FUNCS table covers its code.
+ * EXPORTS lists the functions other modules may call, IMPORTS names the
+ * functions it calls elsewhere, and each RELOCS entry marks a CALL whose
+ * target is an import. vm_link() copies the modules into one code region
+ * and resolves imports by name without decoding any code. A function is
+ * verified and relocated the first time it is called, so startup work
+ * follows the code that actually runs, and every VM attached to a linked
+ * program shares that work.
+ *
+ * To keep lazy verification sound, a linked function may only jump within
+ * itself, may only call function entries, and must end in RET, JMP,
+ * JMP_TABLE, HALT or TAILCALL. Control therefore reaches an unverified
+ * function only through CALL, which checks it first.
+ */
+
+/* ============================================================================
+ * Link Limits
+ * ============================================================================ */
+
+#define VM_LINK_MAX_MODULES 8u
+#define VM_LINK_MAX_CODE (PROGRAM_MAX_SIZE * 4u)  /* Linked code bytes */
+#define VM_LINK_MAX_FUNCS 1024u                   /* Across all modules */
+#define VM_LINK_MAX_IMPORTS 1024u                 /* Across all modules */
+
+/* ============================================================================
+ * Linked Program
+ * ============================================================================ */
+
+typedef enum {
+	VM_LINK_FUNC_PENDING = 0,  /* Not called yet */
+	VM_LINK_FUNC_READY,        /* Verified and relocated */
+	VM_LINK_FUNC_BAD           /* Failed verification; every call fails with error */
+} vm_link_func_state_t;
+
+typedef struct {
+	uint32_t pc;         /* Entry in the linked code */
+	uint32_t len;        /* Code bytes */
+	uint32_t module;     /* Index of the defining module */
+	uint32_t state;      /* vm_link_func_state_t */
+	vm_status_t error;   /* Why a VM_LINK_FUNC_BAD function failed */
+	const char* name;    /* From the module's SYMBOLS, or NULL */
+} vm_link_func_t;
+
+typedef struct {
+	vm_image_t img;        /* Parsed module; points into the caller's bytes */
+	uint32_t base;         /* Offset of the module's CODE in the linked code */
+	uint32_t func_base;    /* First entry in vm_linked_t.funcs */
+	uint32_t import_base;  /* First entry in vm_linked_t.imports */
+} vm_link_module_t;
+
+/*
+ * Linked program shared by any number of VMs. It is large, so give it static
+ * storage, and keep the module bytes alive and unchanged while it is in use.
+ * Calls update it in place, so its VMs must run on one thread.
+ */
+typedef struct vm_linked {
+	uint8_t code[VM_LINK_MAX_CODE];
+	uint32_t code_len;
+	uint32_t entry;                               /* Main module's entry point */
+	uint32_t module_count;
+	vm_link_module_t modules[VM_LINK_MAX_MODULES];
+	uint32_t func_count;
+	vm_link_func_t funcs[VM_LINK_MAX_FUNCS];      /* Sorted by pc */
+	uint32_t imports[VM_LINK_MAX_IMPORTS];        /* Resolved entry of each import */
+	uint32_t ready[VM_LINK_MAX_CODE / 32u];       /* Bit per code byte: a READY function starts here */
+	uint32_t ready_count;                         /* Functions verified so far */
+} vm_linked_t;
+
+/* ============================================================================
+ * Linker API
+ * ============================================================================ */
+
+/*
+ * Lay out count modules and resolve their imports. modules[0] supplies the
+ * entry point, which must start a function; only that function is verified
+ * here. Fails with VM_ERR_LINK on an unresolved import, a duplicate export,
+ * two modules initializing the same buffer, or a compact module.
+ */
+vm_status_t vm_link(vm_linked_t* prog, const uint8_t* const* modules, const uint32_t* lens, uint32_t count);
+
+/* Run prog on vm: share its code, apply each module's DATA and start at the entry */
+vm_status_t vm_link_attach(vm_state_t* vm, vm_linked_t* prog);
+
+/* Verify and relocate the function starting at pc unless that is already done */
+vm_status_t vm_link_load(vm_linked_t* prog, uint32_t pc);
+
+/* Function containing pc, or NULL */
+const vm_link_func_t* vm_link_function_at(const vm_linked_t* prog, uint32_t pc);
+
+/* CALL check: a bit test once the callee is verified */
+static inline vm_status_t vm_link_enter(vm_linked_t* prog, uint32_t pc)
+{
+	if ((pc < prog->code_len) && ((prog->ready[pc / 32u] & (1u << (pc % 32u))) != 0u)) {
+		return VM_OK;
+	}
+	return vm_link_load(prog, pc);
+}
@@ -0,0 +1,142 @@
+/*
+ * Stipple VM - LZ4 Block Codec
+ * A greedy single-probe compressor, which is enough for bytecode where most
+ * matches are repeated instruction headers and small immediates, and a
+ * bounds-checked decoder that runs sequence by sequence.
+ */
+
+#include "vm-lz4.h"
+#include <string.h>
+
+#define HASH_BITS 12u
+#define LAST_LITERALS 5u   /* A block ends with at least this many literals */
+#define MATCH_LIMIT 12u    /* No match starts within this many bytes of the end */
+
+/* ============================================================================
+ * Decoder
+ * ============================================================================ */
+
+void vm_lz4_stream_init(vm_lz4_stream_t* s, const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len) {
+    s->src = src;
+    s->src_len = src_len;
+    s->src_pos = 0;
+    s->dst = dst;
+    s->dst_len = dst_len;
+    s->dst_pos = 0;
+}
+
+/* Add the 255-run length extension that follows a nibble of 15 */
+static bool read_length(vm_lz4_stream_t* s, uint32_t* len) {
+    if (*len != 15u) return true;
+    uint8_t b;
+    do {
+        if (s->src_pos >= s->src_len) return false;
+        b = s->src[s->src_pos++];
+        *len += b;
+        if (*len > s->dst_len) return false;  /* Also keeps the sum from wrapping */
+    } while (b == 255u);
+    return true;
+}
+
+vm_status_t vm_lz4_stream_decode(vm_lz4_stream_t* s, uint32_t want) {
+    /* Once the output is full, keep going so trailing sequences are checked too */
+    while (s->src_pos < s->src_len && (s->dst_pos < want || s->dst_pos == s->dst_len)) {
+        uint8_t token = s->src[s->src_pos++];
+        uint32_t lit = token >> 4;
+        if (!read_length(s, &lit)) return VM_ERR_INVALID_IMAGE;
+        if (lit > s->src_len - s->src_pos || lit > s->dst_len - s->dst_pos) return VM_ERR_INVALID_IMAGE;
+        memcpy(&s->dst[s->dst_pos], &s->src[s->src_pos], lit);
+        s->src_pos += lit;
+        s->dst_pos += lit;
+        if (s->src_pos == s->src_len) break;  /* Last sequence: literals only */
+
+        if (s->src_len - s->src_pos < 2u) return VM_ERR_INVALID_IMAGE;
+        uint32_t offset = (uint32_t)s->src[s->src_pos] | ((uint32_t)s->src[s->src_pos + 1u] << 8);
+        s->src_pos += 2u;
+        uint32_t match = token & 0xFu;
+        if (!read_length(s, &match)) return VM_ERR_INVALID_IMAGE;
+        match += VM_LZ4_MIN_MATCH;
+        if (offset == 0u || offset > s->dst_pos || match > s->dst_len - s->dst_pos) return VM_ERR_INVALID_IMAGE;
+        /* Byte by byte: the match may overlap the bytes it produces */
+        const uint8_t* from = &s->dst[s->dst_pos - offset];
+        uint8_t* to = &s->dst[s->dst_pos];
+        for (uint32_t i = 0; i < match; i++) to[i] = from[i];
+        s->dst_pos += match;
+    }
+    return VM_OK;
+}
+
+bool vm_lz4_stream_done(const vm_lz4_stream_t* s) {
+    return s->src_pos == s->src_len && s->dst_pos == s->dst_len;
+}
+
+/* ============================================================================
+ * Compressor
+ * ============================================================================ */
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32u - HASH_BITS);
+}
+
+/* Token nibble for n, plus the extension bytes when n >= 15 */
+static bool write_length(uint8_t* out, uint32_t cap, uint32_t* pos, uint32_t n) {
+    if (n < 15u) return true;
+    n -= 15u;
+    while (n >= 255u) {
+        if (*pos >= cap) return false;
+        out[(*pos)++] = 255u;
+        n -= 255u;
+    }
+    if (*pos >= cap) return false;
+    out[(*pos)++] = (uint8_t)n;
+    return true;
+}
+
+/* One sequence; match_len 0 emits the final literals-only sequence */
+static bool emit(uint8_t* out, uint32_t cap, uint32_t* pos, const uint8_t* lit, uint32_t lit_len,
+                 uint32_t offset, uint32_t match_len) {
+    uint32_t m = (match_len != 0u) ? match_len - VM_LZ4_MIN_MATCH : 0u;
+    if (*pos >= cap) return false;
+    out[(*pos)++] = (uint8_t)((((lit_len < 15u) ? lit_len : 15u) << 4) | ((m < 15u) ? m : 15u));
+    if (!write_length(out, cap, pos, lit_len) || lit_len > cap - *pos) return false;
+    memcpy(&out[*pos], lit, lit_len);
+    *pos += lit_len;
+    if (match_len == 0u) return true;
+    if (cap - *pos < 2u) return false;
+    out[(*pos)++] = (uint8_t)(offset & 0xFFu);
+    out[(*pos)++] = (uint8_t)(offset >> 8);
+    return write_length(out, cap, pos, m);
+}
+
+vm_status_t vm_lz4_compress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len) {
+    uint32_t table[1u << HASH_BITS];  /* Position + 1 of the last 4 bytes with each hash; 0 empty */
+    memset(table, 0, sizeof(table));
+    uint32_t pos = 0;
+    uint32_t anchor = 0;
+    uint32_t i = 0;
+    while (len > MATCH_LIMIT && i < len - MATCH_LIMIT) {
+        uint32_t seq = read32(&in[i]);
+        uint32_t h = hash32(seq);
+        uint32_t cand = table[h];
+        table[h] = i + 1u;
+        if (cand == 0u || i - (cand - 1u) > VM_LZ4_MAX_OFFSET || read32(&in[cand - 1u]) != seq) {
+            i++;
+            continue;
+        }
+        cand--;
+        uint32_t match = VM_LZ4_MIN_MATCH;
+        while (i + match < len - LAST_LITERALS && in[cand + match] == in[i + match]) match++;
+        if (!emit(out, cap, &pos, &in[anchor], i - anchor, i - cand, match)) return VM_ERR_PROGRAM_TOO_LARGE;
+        i += match;
+        anchor = i;
+    }
+    if (!emit(out, cap, &pos, &in[anchor], len - anchor, 0u, 0u)) return VM_ERR_PROGRAM_TOO_LARGE;
+    *out_len = pos;
+    return VM_OK;
+}
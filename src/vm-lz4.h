@@ -0,0 +1,44 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - LZ4 Block Codec
+ * The LZ4 block format: each sequence is a token (literal length in the high
+ * nibble, match length - 4 in the low nibble, 15 meaning more length bytes
+ * follow), the literals, a 2-byte little-endian offset back into the output
+ * and the match. The last sequence has literals only. Matches copy from
+ * output already written, so the decoder needs no buffer besides its
+ * destination and can stop after any sequence to let the caller consume
+ * what is complete.
+ */
+
+#define VM_LZ4_MIN_MATCH 4u
+#define VM_LZ4_MAX_OFFSET 65535u
+
+/* Worst-case compressed size of n bytes */
+#define VM_LZ4_BOUND(n) ((n) + ((n) / 255u) + 16u)
+
+/* Decoder position in one block */
+typedef struct {
+	const uint8_t* src;
+	uint32_t src_len;
+	uint32_t src_pos;
+	uint8_t* dst;
+	uint32_t dst_len;   /* Exact decompressed size */
+	uint32_t dst_pos;   /* Bytes written so far */
+} vm_lz4_stream_t;
+
+void vm_lz4_stream_init(vm_lz4_stream_t* s, const uint8_t* src, uint32_t src_len, uint8_t* dst, uint32_t dst_len);
+
+/*
+ * Decode whole sequences until at least want bytes of output exist or the
+ * block ends. VM_ERR_INVALID_IMAGE for malformed input, an offset before
+ * the start of the output, or output that would exceed dst_len.
+ */
+vm_status_t vm_lz4_stream_decode(vm_lz4_stream_t* s, uint32_t want);
+
+/* True once the whole block was decoded into exactly dst_len bytes */
+bool vm_lz4_stream_done(const vm_lz4_stream_t* s);
+
+/* Compress in as one block; VM_ERR_PROGRAM_TOO_LARGE if it does not fit cap */
+vm_status_t vm_lz4_compress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len);
@@ -4,19 +4,92 @@
  * MISRA-C Compliant - No dynamic allocation
  */
 
+#define _GNU_SOURCE
 #include "stipple.h"
+#include "vm-serve.h"
+#include "vm-image.h"
+#include "vm-link.h"
+#include "vm-spec.h"
+#include "vm-memo.h"
+#include "vm-watch.h"
+#include "vm-perf.h"
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Static buffer for loading programs - no dynamic allocation */
-static uint8_t g_program_buffer[PROGRAM_MAX_SIZE];
+static uint8_t g_program_buffer[PROGRAM_IMAGE_MAX_SIZE];
+static uint8_t g_output_buffer[PROGRAM_IMAGE_MAX_SIZE];
+static vm_linked_t g_linked;
+static vm_call_profile_t g_profile;
+static vm_memo_t g_memo;
+static vm_watch_t g_watches[VM_WATCH_MAX];
+static uint32_t g_watch_count;
+
+/* Page-aligned so --watch can protect g_vars without the fields after it */
+static _Alignas(VM_WATCH_ALIGN) vm_state_t g_vm;
+
+/* What convert_file() does to a program */
+typedef enum {
+    CONVERT_COMPACT = 0,
+    CONVERT_COMPRESS,
+    CONVERT_SPECIALIZE,
+    CONVERT_TAILCALL
+} convert_mode_t;
 
 static void print_usage(const char* progname) {
     (void)fputs("Usage: ", stdout);
     (void)fputs(progname, stdout);
     (void)fputs(" <bytecode_file>\n", stdout);
-    (void)fputs("\nLoads and executes Stipple VM bytecode.\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --serve <socket_path> [cache_dir]\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --connect <socket_path> <bytecode_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --compact <bytecode_file> <output_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --compress <bytecode_file> <output_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --link <main_module> [module...]\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --profile <bytecode_file> <output_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --specialize <profiled_file> <output_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --memo-stats <bytecode_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --tailcall <bytecode_file> <output_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --watch g<N>|b<N>[,...] <bytecode_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --break <pc>[,...] <bytecode_file>\n", stdout);
+    (void)fputs("       ", stdout);
+    (void)fputs(progname, stdout);
+    (void)fputs(" --perf <bytecode_file>\n", stdout);
+    (void)fputs("\nLoads and executes Stipple VM bytecode, directly, linked from modules or\n", stdout);
+    (void)fputs("through a job server, or converts it to the compact encoding or compresses it.\n", stdout);
+    (void)fputs("--profile runs a program and saves it with its call profile, which\n", stdout);
+    (void)fputs("--specialize uses to clone functions for their constant arguments.\n", stdout);
+    (void)fputs("--memo-stats runs a program and reports how often CALL_MEMO hit its cache.\n", stdout);
+    (void)fputs("--tailcall rewrites self calls in tail position so they reuse the frame.\n", stdout);
+    (void)fputs("--watch reports each instruction that changes global N or buffer N.\n", stdout);
+    (void)fputs("--break dumps the VM state each time execution reaches one of the PCs.\n", stdout);
+    (void)fputs("--perf writes /tmp/perf-<pid>.map so perf can name opcodes and functions.\n", stdout);
 }
 
 static bool load_file(const char* filename, uint8_t* buffer, uint32_t* size) {
@@ -32,8 +105,8 @@ static bool load_file(const char* filename, uint8_t* buffer, uint32_t* size) {
     const size_t CHUNK_SIZE = 4096;
     size_t total_read = 0;
 
-    while (total_read < PROGRAM_MAX_SIZE) {
-        size_t to_read = PROGRAM_MAX_SIZE - total_read;
+    while (total_read < PROGRAM_IMAGE_MAX_SIZE) {
+        size_t to_read = PROGRAM_IMAGE_MAX_SIZE - total_read;
         if (to_read > CHUNK_SIZE) {
             to_read = CHUNK_SIZE;
         }
@@ -54,7 +127,7 @@ static bool load_file(const char* filename, uint8_t* buffer, uint32_t* size) {
         total_read += n;
         
         /* Check if there's more data beyond max size */
-        if (total_read == PROGRAM_MAX_SIZE) {
+        if (total_read == PROGRAM_IMAGE_MAX_SIZE) {
             int c = fgetc(f);
             if (c != EOF) {
                 (void)fputs("Error: File too large\n", stderr);
@@ -80,12 +153,48 @@ static bool load_file(const char* filename, uint8_t* buffer, uint32_t* size) {
     return true;
 }
 
-static void print_uint32(uint32_t value) {
-    char buf[12];  /* Enough for 4294967295 + null */
+/*
+ * Map a regular file so the VM can run it in place, whatever its size.
+ * The mapping is private: writable asks for copy-on-write pages, which
+ * breakpoints can patch without touching the file. Returns false without
+ * a message for anything that cannot be mapped (pipes, empty files),
+ * leaving load_file() to handle or report it.
+ */
+static bool map_file(const char* filename, bool writable, uint8_t** data, uint32_t* size) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && (uint64_t)st.st_size <= UINT32_MAX) {
+        p = mmap(NULL, (size_t)st.st_size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    (void)close(fd);
+    if (p == MAP_FAILED) return false;
+    *data = p;
+    *size = (uint32_t)st.st_size;
+    return true;
+}
+
+static bool save_file(const char* filename, const uint8_t* buffer, uint32_t size) {
+    FILE* f = fopen(filename, "wb");
+    if (!f) {
+        (void)fputs("Error: Cannot create file '", stderr);
+        (void)fputs(filename, stderr);
+        (void)fputs("'\n", stderr);
+        return false;
+    }
+    bool ok = fwrite(buffer, 1, size, f) == size;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) (void)fputs("Error: Failed to write file\n", stderr);
+    return ok;
+}
+
+static void print_uint64(FILE* out, uint64_t value) {
+    char buf[21];  /* Enough for 18446744073709551615 + null */
     int i = 0;
     
     if (value == 0u) {
-        (void)fputc('0', stdout);
+        (void)fputc('0', out);
         return;
     }
     
@@ -99,66 +208,414 @@ static void print_uint32(uint32_t value) {
     /* Print in correct order */
     while (i > 0) {
         i--;
-        (void)fputc(buf[i], stdout);
+        (void)fputc(buf[i], out);
     }
 }
 
-static void print_hex16_err(uint16_t value) {
+static void print_uint32(FILE* out, uint32_t value) { print_uint64(out, value); }
+
+static void print_hex32_err(uint32_t value) {
     const char hex[] = "0123456789ABCDEF";
     (void)fputc('0', stderr);
     (void)fputc('x', stderr);
-    (void)fputc(hex[(value >> 12) & 0xFu], stderr);
-    (void)fputc(hex[(value >> 8) & 0xFu], stderr);
-    (void)fputc(hex[(value >> 4) & 0xFu], stderr);
-    (void)fputc(hex[value & 0xFu], stderr);
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        (void)fputc(hex[(value >> shift) & 0xFu], stderr);
+    }
+}
+
+/* " in <function> (line N)" when a container image carries FUNCS/LINES covering pc */
+static void print_source_location(const uint8_t* image, uint32_t len, uint32_t pc) {
+    vm_image_t img;
+    if (!vm_image_is_container(image, len) || vm_image_parse(image, len, &img) != VM_OK) return;
+    vm_image_func_t func;
+    const char* name = vm_image_function_at(&img, pc, &func) ? vm_image_symbol(&img, func.name) : NULL;
+    if (name) {
+        (void)fputs(" in ", stderr);
+        (void)fputs(name, stderr);
+    }
+    uint32_t line = vm_image_line_at(&img, pc);
+    if (line != 0u) {
+        (void)fputs(" (line ", stderr);
+        print_uint32(stderr, line);
+        (void)fputc(')', stderr);
+    }
+}
+
+/* Function and line of pc, from the linked program or the image's FUNCS/LINES */
+static void print_location(const uint8_t* program, uint32_t program_size, const vm_linked_t* linked, uint32_t pc) {
+    if (linked) {
+        const vm_link_func_t* func = vm_link_function_at(linked, pc);
+        if (func && func->name) {
+            (void)fputs(" in ", stderr);
+            (void)fputs(func->name, stderr);
+        }
+    } else {
+        print_source_location(program, program_size, pc);
+    }
+}
+
+/* Parse "g5,b17" (global 5, buffer 17) into g_watches */
+static bool parse_watches(const char* list) {
+    g_watch_count = 0;
+    const char* p = list;
+    for (;;) {
+        if (g_watch_count == VM_WATCH_MAX || (*p != 'g' && *p != 'b')) return false;
+        vm_watch_t* w = &g_watches[g_watch_count++];
+        w->kind = (*p == 'g') ? VM_WATCH_GLOBAL : VM_WATCH_BUFFER;
+        w->index = 0;
+        p++;
+        if (*p < '0' || *p > '9') return false;
+        while (*p >= '0' && *p <= '9') {
+            w->index = (w->index * 10u) + (uint32_t)(*p - '0');
+            if (w->index >= 256u) return false;
+            p++;
+        }
+        if (*p == '\0') return true;
+        if (*p != ',') return false;
+        p++;
+    }
+}
+
+/* Parse "0x1C,40" and set a breakpoint at each PC; reports its own errors */
+static bool set_breakpoints(vm_state_t* vm, const char* list) {
+    const char* p = list;
+    for (;;) {
+        uint32_t base = 10u;
+        if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            base = 16u;
+            p += 2;
+        }
+        uint32_t pc = 0;
+        uint32_t digits = 0;
+        for (;; p++) {
+            uint32_t d;
+            if (*p >= '0' && *p <= '9') {
+                d = (uint32_t)(*p - '0');
+            } else if (base == 16u && *p >= 'a' && *p <= 'f') {
+                d = (uint32_t)(*p - 'a') + 10u;
+            } else if (base == 16u && *p >= 'A' && *p <= 'F') {
+                d = (uint32_t)(*p - 'A') + 10u;
+            } else {
+                break;
+            }
+            if (pc > (UINT32_MAX - d) / base) break;
+            pc = (pc * base) + d;
+            digits++;
+        }
+        if (digits == 0u || (*p != ',' && *p != '\0')) {
+            (void)fputs("Error: Bad breakpoint list '", stderr);
+            (void)fputs(list, stderr);
+            (void)fputs("'\n", stderr);
+            return false;
+        }
+        vm_status_t status = vm_break_set(vm, pc);
+        if (status != VM_OK) {
+            (void)fputs("Error: Cannot set breakpoint at PC=", stderr);
+            print_hex32_err(pc);
+            (void)fputs(": ", stderr);
+            (void)fputs(vm_get_error_string(status), stderr);
+            (void)fputc('\n', stderr);
+            return false;
+        }
+        if (*p == '\0') return true;
+        p++;
+    }
+}
+
+/* "Watchpoint b17 changed at PC=0x... by STORE_G in f (line 3)" */
+static void print_watch_hit(const vm_watch_hit_t* hit, const uint8_t* program, uint32_t program_size,
+                            const vm_linked_t* linked) {
+    const vm_watch_t* w = &g_watches[hit->watch];
+    (void)fputs("Watchpoint ", stderr);
+    (void)fputc((w->kind == VM_WATCH_GLOBAL) ? 'g' : 'b', stderr);
+    print_uint32(stderr, w->index);
+    (void)fputs(" changed at PC=", stderr);
+    print_hex32_err(hit->pc);
+    (void)fputs(" by ", stderr);
+    (void)fputs(opcode_to_string((opcode_t)hit->opcode), stderr);
+    print_location(program, program_size, linked, hit->pc);
+    (void)fputc('\n', stderr);
+}
+
+/* Re-encode a program as a compact container, compress its code, or specialize it */
+static int convert_file(const char* in_file, const char* out_file, convert_mode_t mode) {
+    uint32_t in_size;
+    if (!load_file(in_file, g_program_buffer, &in_size)) return 1;
+    uint32_t out_size;
+    const uint32_t cap = (uint32_t)sizeof(g_output_buffer);
+    vm_spec_stats_t stats;
+    uint32_t tail_calls = 0;
+    vm_status_t status;
+    switch (mode) {
+        case CONVERT_COMPRESS:
+            status = vm_image_compress(g_program_buffer, in_size, g_output_buffer, cap, &out_size);
+            break;
+        case CONVERT_SPECIALIZE:
+            status = vm_specialize(g_program_buffer, in_size, g_output_buffer, cap, &out_size, &stats);
+            break;
+        case CONVERT_TAILCALL:
+            status = vm_tailcall(g_program_buffer, in_size, g_output_buffer, cap, &out_size, &tail_calls);
+            break;
+        case CONVERT_COMPACT:
+        default:
+            status = vm_image_compact(g_program_buffer, in_size, g_output_buffer, cap, &out_size);
+            break;
+    }
+    if (status != VM_OK) {
+        (void)fputs("Error converting program: ", stderr);
+        (void)fputs(vm_get_error_string(status), stderr);
+        (void)fputs("\n", stderr);
+        return 1;
+    }
+    if (!save_file(out_file, g_output_buffer, out_size)) return 1;
+    if (mode == CONVERT_SPECIALIZE) {
+        (void)fputs("Specialized ", stdout);
+        print_uint32(stdout, stats.sites);
+        (void)fputs(" call sites into ", stdout);
+        print_uint32(stdout, stats.clones);
+        (void)fputs(" clones, ", stdout);
+        print_uint32(stdout, stats.folded);
+        (void)fputs(" instructions folded\n", stdout);
+    } else if (mode == CONVERT_TAILCALL) {
+        (void)fputs("Converted ", stdout);
+        print_uint32(stdout, tail_calls);
+        (void)fputs(" self calls to TAILCALL\n", stdout);
+    }
+    print_uint32(stdout, in_size);
+    (void)fputs(" -> ", stdout);
+    print_uint32(stdout, out_size);
+    (void)fputs(" bytes\n", stdout);
+    return 0;
+}
+
+/* Run to completion and report; program/linked locate errors in the source */
+static int execute(vm_state_t* vm, const uint8_t* program, uint32_t program_size, const vm_linked_t* linked) {
+    (void)fputs("Executing...\n", stdout);
+    /* Stdio input never waits, so a YIELD only needs resuming */
+    vm_status_t status;
+    vm_watch_hit_t hit;
+    for (;;) {
+        /* vm_perf_run() is vm_run() unless --perf started profiling */
+        status = (g_watch_count == 0u) ? vm_perf_run(vm) : vm_watch_run(vm, &hit);
+        if (status == VM_YIELD) continue;
+        if (status != VM_BREAK) break;
+        if (g_watch_count != 0u && hit.watch != VM_WATCH_NONE) {
+            print_watch_hit(&hit, program, program_size, linked);
+            continue;
+        }
+        (void)fputs("Breakpoint at PC=", stderr);
+        print_hex32_err(vm->pc);
+        print_location(program, program_size, linked, vm->pc);
+        (void)fputc('\n', stderr);
+        vm_dump_state(vm);
+        status = vm_break_continue(vm);
+        if (status != VM_OK && status != VM_YIELD) break;
+    }
+    if (status == VM_ERR_HALT) status = VM_OK;  /* The instruction under a breakpoint was HALT */
+    
+    /* Report results */
+    if (status == VM_OK) {
+        (void)fputs("\nProgram completed successfully.\n", stdout);
+    } else {
+        (void)fputs("\nProgram error at PC=", stderr);
+        print_hex32_err(vm->pc);
+        print_location(program, program_size, linked, vm->pc);
+        (void)fputs(": ", stderr);
+        (void)fputs(vm_get_error_string(status), stderr);
+        (void)fputs("\n", stderr);
+        vm_dump_state(vm);
+    }
+    
+    return (status == VM_OK) ? 0 : 1;
+}
+
+/* CALL_MEMO cache counters after a --memo-stats run */
+static void print_memo_stats(const vm_memo_stats_t* stats) {
+    (void)fputs("Memo: ", stdout);
+    print_uint64(stdout, stats->hits);
+    (void)fputs(" hits, ", stdout);
+    print_uint64(stdout, stats->misses);
+    (void)fputs(" misses, ", stdout);
+    print_uint64(stdout, stats->stores);
+    (void)fputs(" stores, ", stdout);
+    print_uint64(stdout, stats->evictions);
+    (void)fputs(" evictions\n", stdout);
+}
+
+/* Run a program with a call profile and save it with the profile attached */
+static int profile_file(const char* in_file, const char* out_file) {
+    uint32_t in_size;
+    if (!load_file(in_file, g_program_buffer, &in_size)) return 1;
+    vm_state_t vm;
+    vm_init(&vm);
+    vm_status_t status = vm_attach_program(&vm, g_program_buffer, in_size);
+    if (status != VM_OK) {
+        (void)fputs("Error loading program: ", stderr);
+        (void)fputs(vm_get_error_string(status), stderr);
+        (void)fputs("\n", stderr);
+        return 1;
+    }
+    vm_profile_init(&g_profile);
+    vm.call_profile = &g_profile;
+    if (execute(&vm, g_program_buffer, in_size, NULL) != 0) return 1;
+
+    uint32_t out_size;
+    status = vm_profile_save(&g_profile, g_program_buffer, in_size, g_output_buffer,
+                             (uint32_t)sizeof(g_output_buffer), &out_size);
+    if (status != VM_OK) {
+        (void)fputs("Error saving profile: ", stderr);
+        (void)fputs(vm_get_error_string(status), stderr);
+        (void)fputs("\n", stderr);
+        return 1;
+    }
+    if (!save_file(out_file, g_output_buffer, out_size)) return 1;
+    (void)fputs("Profiled ", stdout);
+    print_uint32(stdout, g_profile.site_count);
+    (void)fputs(" call sites\n", stdout);
+    return 0;
+}
+
+/* Link mapped modules (the first one supplies the entry point) and run them */
+static int link_and_run(char** files, uint32_t count) {
+    const uint8_t* modules[VM_LINK_MAX_MODULES];
+    uint32_t lens[VM_LINK_MAX_MODULES];
+    if (count > VM_LINK_MAX_MODULES) {
+        (void)fputs("Error: Too many modules\n", stderr);
+        return 1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* module;
+        if (!map_file(files[i], false, &module, &lens[i])) {
+            (void)fputs("Error: Cannot map module '", stderr);
+            (void)fputs(files[i], stderr);
+            (void)fputs("'\n", stderr);
+            return 1;
+        }
+        modules[i] = module;
+    }
+    
+    vm_state_t vm;
+    vm_init(&vm);
+    vm_status_t status = vm_link(&g_linked, modules, lens, count);
+    if (status == VM_OK) status = vm_link_attach(&vm, &g_linked);
+    if (status != VM_OK) {
+        (void)fputs("Error linking program: ", stderr);
+        (void)fputs(vm_get_error_string(status), stderr);
+        (void)fputs("\n", stderr);
+        return 1;
+    }
+    (void)fputs("Linked ", stdout);
+    print_uint32(stdout, count);
+    (void)fputs(" modules, ", stdout);
+    print_uint32(stdout, g_linked.func_count);
+    (void)fputs(" functions\n", stdout);
+    
+    vm_memo_init(&g_memo);
+    vm_memo_attach(&vm, &g_memo);
+    int rc = execute(&vm, NULL, 0, &g_linked);
+    (void)fputs("Verified ", stdout);
+    print_uint32(stdout, g_linked.ready_count);
+    (void)fputs(" of ", stdout);
+    print_uint32(stdout, g_linked.func_count);
+    (void)fputs(" functions\n", stdout);
+    return rc;
 }
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--serve") == 0) {
+        return vm_serve(argv[2], (argc == 4) ? argv[3] : NULL);
+    }
+    if (argc == 4 && strcmp(argv[1], "--connect") == 0) {
+        return vm_serve_client(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--compact") == 0) {
+        return convert_file(argv[2], argv[3], CONVERT_COMPACT);
+    }
+    if (argc == 4 && strcmp(argv[1], "--compress") == 0) {
+        return convert_file(argv[2], argv[3], CONVERT_COMPRESS);
+    }
+    if (argc == 4 && strcmp(argv[1], "--profile") == 0) {
+        return profile_file(argv[2], argv[3]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--specialize") == 0) {
+        return convert_file(argv[2], argv[3], CONVERT_SPECIALIZE);
+    }
+    if (argc == 4 && strcmp(argv[1], "--tailcall") == 0) {
+        return convert_file(argv[2], argv[3], CONVERT_TAILCALL);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--link") == 0) {
+        return link_and_run(&argv[2], (uint32_t)(argc - 2));
+    }
+    const bool memo_stats = (argc == 3 && strcmp(argv[1], "--memo-stats") == 0);
+    const bool perf = (argc == 3 && strcmp(argv[1], "--perf") == 0);
+    const bool watch = (argc == 4 && strcmp(argv[1], "--watch") == 0);
+    const bool breaks = (argc == 4 && strcmp(argv[1], "--break") == 0);
+    if (argc != 2 && !memo_stats && !perf && !watch && !breaks) {
         print_usage(argv[0]);
         return 1;
     }
+    if (watch && !parse_watches(argv[2])) {
+        (void)fputs("Error: Bad watch list '", stderr);
+        (void)fputs(argv[2], stderr);
+        (void)fputs("'\n", stderr);
+        return 1;
+    }
+    const char* path = argv[argc - 1];
     
-    /* Load bytecode into static buffer */
+    /* Map the bytecode, or read it into the static buffer if it cannot be mapped */
+    uint8_t* image = g_program_buffer;
     uint32_t program_size;
-    if (!load_file(argv[1], g_program_buffer, &program_size)) {
+    if (!map_file(path, breaks, &image, &program_size) &&
+        !load_file(path, g_program_buffer, &program_size)) {
         return 1;
     }
+    const uint8_t* program = image;
     
     (void)fputs("Loaded ", stdout);
-    print_uint32(program_size);
+    print_uint32(stdout, program_size);
     (void)fputs(" bytes from '", stdout);
-    (void)fputs(argv[1], stdout);
+    (void)fputs(path, stdout);
     (void)fputs("'\n", stdout);
     
     /* Initialize VM */
-    vm_state_t vm;
-    vm_init(&vm);
+    vm_state_t* vm = &g_vm;
+    vm_init(vm);
     
-    /* Load program */
-    vm_status_t status = vm_load_program(&vm, g_program_buffer, program_size);
+    /* Run it in place; the mapping or buffer lives until exit */
+    vm_status_t status = vm_attach_program(vm, program, program_size);
     if (status != VM_OK) {
         (void)fputs("Error loading program: ", stderr);
         (void)fputs(vm_get_error_string(status), stderr);
         (void)fputs("\n", stderr);
         return 1;
     }
-    
-    /* Execute */
-    (void)fputs("Executing...\n", stdout);
-    status = vm_run(&vm);
-    
-    /* Report results */
-    if (status == VM_OK) {
-        (void)fputs("\nProgram completed successfully.\n", stdout);
-    } else {
-        (void)fputs("\nProgram error at PC=", stderr);
-        print_hex16_err((uint16_t)vm.pc);
-        (void)fputs(": ", stderr);
-        (void)fputs(vm_get_error_string(status), stderr);
-        (void)fputs("\n", stderr);
-        vm_dump_state(&vm);
+    vm_memo_init(&g_memo);
+    vm_memo_attach(vm, &g_memo);
+    /*
+     * Patch the private mapping or buffer; compressed code is already in
+     * program[]. The instruction-start bitmap lives beside the mapping and
+     * covers only this program; without it, code that fits is copied instead.
+     */
+    if (breaks) {
+        const uint32_t words = VM_BREAK_STARTS_WORDS(vm->program_len);
+        void* starts = mmap(NULL, (size_t)words * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (starts != MAP_FAILED) (void)vm_break_allow_patch(vm, image, program_size, starts, words);
+    }
+    if (breaks && !set_breakpoints(vm, argv[2])) return 1;
+    if (perf && !vm_perf_start(vm, program, program_size)) {
+        (void)fputs("Error: Cannot set up perf trampolines\n", stderr);
+        return 1;
+    }
+    /* After loading, so DATA does not count as a change */
+    if (watch && !vm_watch_start(vm, g_watches, g_watch_count)) {
+        (void)fputs("Error: Cannot set watchpoints\n", stderr);
+        return 1;
     }
     
-    return (status == VM_OK) ? 0 : 1;
+    int rc = execute(vm, program, program_size, NULL);
+    vm_watch_stop();
+    vm_perf_stop();
+    if (memo_stats) print_memo_stats(&g_memo.stats);
+    return rc;
 }
@@ -0,0 +1,120 @@
+/*
+ * Stipple VM - Call Memoization
+ * Keys hash with FNV-1a over the callee entry and each argument's type and
+ * value. A set is searched linearly; its ways are few enough that this is
+ * cheaper than the call it saves.
+ */
+
+#include "vm-memo.h"
+#include <string.h>
+
+_Static_assert((VM_MEMO_SETS & (VM_MEMO_SETS - 1u)) == 0u, "VM_MEMO_SETS must be a power of two");
+
+/* ============================================================================
+ * Keys
+ * ============================================================================ */
+
+static inline bool is_wide(var_value_type_t type) {
+    return type == V_I64 || type == V_U64;
+}
+
+static inline uint32_t fnv_word(uint32_t h, uint32_t w) {
+    for (uint32_t i = 0; i < 4u; i++) {
+        h ^= (w >> (i * 8u)) & 0xFFu;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t hash_key(uint32_t target, uint32_t argc, const var_value_t* args) {
+    uint32_t h = fnv_word(2166136261u, target);
+    for (uint32_t i = 0; i < argc; i++) {
+        h = fnv_word(h, (uint32_t)args[i].type);
+        if (args[i].type == V_VOID) continue;
+        h = fnv_word(h, args[i].val.u32);
+        if (is_wide(args[i].type)) h = fnv_word(h, (uint32_t)(args[i].val.u64 >> 32));
+    }
+    return h;
+}
+
+/* Same type and value; the union bytes a type does not use are ignored */
+static bool same_value(const var_value_t* a, const var_value_t* b) {
+    if (a->type != b->type) return false;
+    if (a->type == V_VOID) return true;
+    if (is_wide(a->type)) return a->val.u64 == b->val.u64;
+    return a->val.u32 == b->val.u32;
+}
+
+static bool same_key(const vm_memo_entry_t* e, uint32_t hash, uint32_t target, uint32_t argc,
+                     const var_value_t* args) {
+    if (!e->used || e->hash != hash || e->target != target || e->argc != argc) return false;
+    for (uint32_t i = 0; i < argc; i++) {
+        if (!same_value(&e->args[i], &args[i])) return false;
+    }
+    return true;
+}
+
+static inline vm_memo_entry_t* set_of(vm_memo_t* memo, uint32_t hash) {
+    return &memo->entries[(hash & (VM_MEMO_SETS - 1u)) * VM_MEMO_WAYS];
+}
+
+/* ============================================================================
+ * Memoization API
+ * ============================================================================ */
+
+void vm_memo_init(vm_memo_t* memo) {
+    memset(memo, 0, sizeof(*memo));
+}
+
+void vm_memo_attach(vm_state_t* vm, vm_memo_t* memo) {
+    vm->memo = memo;
+    if (memo == NULL) return;
+    for (uint32_t i = 0; i < STACK_DEPTH; i++) memo->pending[i].used = false;
+}
+
+bool vm_memo_lookup(vm_memo_t* memo, uint32_t frame, uint32_t target, uint32_t argc,
+                    const var_value_t* args, var_value_t* ret) {
+    const uint32_t hash = hash_key(target, argc, args);
+    vm_memo_entry_t* set = set_of(memo, hash);
+    for (uint32_t w = 0; w < VM_MEMO_WAYS; w++) {
+        if (same_key(&set[w], hash, target, argc, args)) {
+            set[w].last_use = ++memo->clock;
+            *ret = set[w].ret;
+            memo->stats.hits++;
+            return true;
+        }
+    }
+    memo->stats.misses++;
+    vm_memo_entry_t* p = &memo->pending[frame];
+    p->used = true;
+    p->argc = (uint8_t)argc;
+    p->target = target;
+    p->hash = hash;
+    memcpy(p->args, args, argc * sizeof(var_value_t));
+    return false;
+}
+
+void vm_memo_return(vm_memo_t* memo, uint32_t frame, const var_value_t* ret) {
+    vm_memo_entry_t* p = &memo->pending[frame];
+    if (!p->used) return;
+    p->used = false;
+
+    /* A recursive call may have stored the same key meanwhile; refresh it */
+    vm_memo_entry_t* set = set_of(memo, p->hash);
+    vm_memo_entry_t* victim = NULL;
+    for (uint32_t w = 0; w < VM_MEMO_WAYS && victim == NULL; w++) {
+        if (same_key(&set[w], p->hash, p->target, p->argc, p->args)) victim = &set[w];
+    }
+    if (victim == NULL) {
+        victim = &set[0];
+        for (uint32_t w = 1; w < VM_MEMO_WAYS && victim->used; w++) {
+            if (!set[w].used || set[w].last_use < victim->last_use) victim = &set[w];
+        }
+        if (victim->used) memo->stats.evictions++;
+    }
+    *victim = *p;
+    victim->used = true;
+    victim->ret = *ret;
+    victim->last_use = ++memo->clock;
+    memo->stats.stores++;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - Call Memoization
+ * CALL_MEMO calls a function the program declares pure: its result depends
+ * only on its first N stack vars (N = the instruction's operand). While
+ * vm.memo is set, the VM keeps (entry PC, argument values) -> ret_val in a
+ * bounded set-associative table. A hit writes the cached ret_val into frame
+ * SP+1 and skips the call; a miss runs the call and stores its ret_val when
+ * the callee returns. Without vm.memo, CALL_MEMO is a plain CALL.
+ *
+ * A hit leaves the callee frame's stack vars, locals and the flags as they
+ * were, so callers may only rely on ret_val. Results are keyed by PC, so a
+ * table must only be shared by runs of the same program.
+ */
+
+/* ============================================================================
+ * Memo Table Limits
+ * ============================================================================ */
+
+#define VM_MEMO_WAYS 4u    /* Entries per set; the least recently used is evicted */
+#define VM_MEMO_SETS 64u   /* Power of two */
+
+/* ============================================================================
+ * Memo Table
+ * ============================================================================ */
+
+/* One cached call, or the key of a call in progress */
+typedef struct {
+	bool used;
+	uint8_t argc;                       /* Stack vars in the key */
+	uint32_t target;                    /* Callee entry */
+	uint32_t hash;                      /* Of target and args */
+	uint32_t last_use;                  /* vm_memo_t.clock at the last hit or store */
+	var_value_t args[STACK_VAR_COUNT];  /* First argc are meaningful */
+	var_value_t ret;
+} vm_memo_entry_t;
+
+typedef struct {
+	uint64_t hits;       /* Calls answered from the table */
+	uint64_t misses;     /* Calls that ran */
+	uint64_t stores;     /* Results added when a missed call returned */
+	uint64_t evictions;  /* Stores that replaced another result */
+} vm_memo_stats_t;
+
+/* Per-VM table; large, so give it static storage */
+typedef struct vm_memo {
+	vm_memo_entry_t entries[VM_MEMO_SETS * VM_MEMO_WAYS];
+	vm_memo_entry_t pending[STACK_DEPTH];  /* Key of the missed call that entered each frame */
+	uint32_t clock;
+	vm_memo_stats_t stats;
+} vm_memo_t;
+
+/* ============================================================================
+ * Memoization API
+ * ============================================================================ */
+
+/* Empty the table and zero the statistics */
+void vm_memo_init(vm_memo_t* memo);
+
+/* Set vm.memo, dropping calls in progress from an earlier run; NULL detaches */
+void vm_memo_attach(vm_state_t* vm, vm_memo_t* memo);
+
+/*
+ * CALL_MEMO hook before entering frame: on a hit, copy the cached result to
+ * *ret and return true. On a miss, remember the key for frame and return
+ * false; the caller then performs the call.
+ */
+bool vm_memo_lookup(vm_memo_t* memo, uint32_t frame, uint32_t target, uint32_t argc,
+                    const var_value_t* args, var_value_t* ret);
+
+/* RET hook: frame is returning ret; stores it if a missed CALL_MEMO entered frame */
+void vm_memo_return(vm_memo_t* memo, uint32_t frame, const var_value_t* ret);
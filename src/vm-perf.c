@@ -0,0 +1,218 @@
+/*
+ * Stipple VM - Linux perf Integration
+ * A trampoline only builds a frame and calls on, so perf's frame-pointer
+ * unwinder finds its return address in the chain. Opcode trampolines call
+ * vm_step(); function trampolines call the opcode trampoline they are
+ * given. The code is written while mapped read-write, then made
+ * read-execute.
+ */
+
+#define _GNU_SOURCE
+#include "vm-perf.h"
+#include "vm-image.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef vm_status_t (*op_stub_t)(vm_state_t* vm);
+typedef vm_status_t (*fn_stub_t)(vm_state_t* vm, op_stub_t step);
+
+#define OP_STUBS 256u
+#define STUB_AREA ((OP_STUBS + VM_PERF_MAX_FUNCS) * VM_PERF_STUB_SIZE)
+#define NO_FUNC 0xFFFFFFFFu
+
+/* One profiling session */
+static struct {
+    uint8_t* area;                         /* OP_STUBS opcode stubs, then the function stubs */
+    uint32_t func_count;
+    uint32_t func_pc[VM_PERF_MAX_FUNCS];   /* Sorted FUNCS ranges */
+    uint32_t func_end[VM_PERF_MAX_FUNCS];
+} g_perf;
+
+/* ============================================================================
+ * Code Generation
+ * ============================================================================ */
+
+#if defined(__x86_64__)
+#define PERF_SUPPORTED 1
+/* push rbp; mov rbp, rsp; mov rax, target; call rax; pop rbp; ret */
+static void emit_call(uint8_t* p, uintptr_t target) {
+    static const uint8_t head[] = { 0x55u, 0x48u, 0x89u, 0xE5u, 0x48u, 0xB8u };
+    static const uint8_t tail[] = { 0xFFu, 0xD0u, 0x5Du, 0xC3u };
+    const uint64_t t = target;
+    memcpy(p, head, sizeof(head));
+    memcpy(&p[sizeof(head)], &t, 8);
+    memcpy(&p[sizeof(head) + 8u], tail, sizeof(tail));
+}
+/* push rbp; mov rbp, rsp; call rsi; pop rbp; ret */
+static void emit_call_arg(uint8_t* p) {
+    static const uint8_t code[] = { 0x55u, 0x48u, 0x89u, 0xE5u, 0xFFu, 0xD6u, 0x5Du, 0xC3u };
+    memcpy(p, code, sizeof(code));
+}
+#elif defined(__aarch64__)
+#define PERF_SUPPORTED 1
+static void put_words(uint8_t* p, const uint32_t* words, uint32_t count) {
+    memcpy(p, words, count * 4u);
+}
+/* stp x29, x30, [sp, #-16]!; mov x29, sp; ldr x16, target; blr x16; ldp x29, x30, [sp], #16; ret; target */
+static void emit_call(uint8_t* p, uintptr_t target) {
+    static const uint32_t code[] = { 0xA9BF7BFDu, 0x910003FDu, 0x58000090u, 0xD63F0200u, 0xA8C17BFDu, 0xD65F03C0u };
+    const uint64_t t = target;
+    put_words(p, code, 6u);
+    memcpy(&p[24], &t, 8);
+}
+/* stp x29, x30, [sp, #-16]!; mov x29, sp; blr x1; ldp x29, x30, [sp], #16; ret */
+static void emit_call_arg(uint8_t* p) {
+    static const uint32_t code[] = { 0xA9BF7BFDu, 0x910003FDu, 0xD63F0020u, 0xA8C17BFDu, 0xD65F03C0u };
+    put_words(p, code, 5u);
+}
+#else
+#define PERF_SUPPORTED 0
+#endif
+
+static inline uint8_t* op_stub(uint32_t opcode) {
+    return &g_perf.area[opcode * VM_PERF_STUB_SIZE];
+}
+
+static inline uint8_t* fn_stub(uint32_t func) {
+    return &g_perf.area[(OP_STUBS + func) * VM_PERF_STUB_SIZE];
+}
+
+/* ============================================================================
+ * Perf Map
+ * ============================================================================ */
+
+static void put_hex(FILE* f, uintptr_t value) {
+    const char hex[] = "0123456789abcdef";
+    bool started = false;
+    for (int shift = (int)(sizeof(value) * 8u) - 4; shift >= 0; shift -= 4) {
+        uint32_t d = (uint32_t)(value >> shift) & 0xFu;
+        if (d != 0u || started || shift == 0) {
+            (void)fputc(hex[d], f);
+            started = true;
+        }
+    }
+}
+
+/* "<start> <size> stipple:<kind>:<name>" */
+static void put_entry(FILE* f, const uint8_t* stub, const char* kind, const char* name, uint32_t pc) {
+    put_hex(f, (uintptr_t)stub);
+    (void)fputc(' ', f);
+    put_hex(f, VM_PERF_STUB_SIZE);
+    (void)fputs(" stipple:", f);
+    (void)fputs(kind, f);
+    (void)fputc(':', f);
+    if (name != NULL) {
+        (void)fputs(name, f);
+    } else {
+        (void)fputs("0x", f);
+        put_hex(f, pc);
+    }
+    (void)fputc('\n', f);
+}
+
+static FILE* open_map(void) {
+    char path[48] = "/tmp/perf-";
+    char digits[12];
+    uint32_t n = 0;
+    for (pid_t pid = getpid(); pid > 0; pid /= 10) {
+        digits[n++] = (char)('0' + (pid % 10));
+    }
+    size_t len = strlen(path);
+    while (n > 0u) path[len++] = digits[--n];
+    memcpy(&path[len], ".map", 5);
+    return fopen(path, "a");
+}
+
+/* ============================================================================
+ * Profiling API
+ * ============================================================================ */
+
+bool vm_perf_start(const vm_state_t* vm, const uint8_t* image, uint32_t len) {
+#if PERF_SUPPORTED
+    if (g_perf.area != NULL || vm->linked != NULL) return false;
+    vm_image_t img;
+    bool funcs = image != NULL && vm_image_is_container(image, len) && vm_image_parse(image, len, &img) == VM_OK;
+    uint32_t count = funcs ? img.section_size[VM_SECTION_FUNCS] / sizeof(vm_image_func_t) : 0u;
+    if (count > VM_PERF_MAX_FUNCS) count = VM_PERF_MAX_FUNCS;  /* The rest run without a function frame */
+
+    void* area = mmap(NULL, STUB_AREA, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) return false;
+    g_perf.area = area;
+    for (uint32_t op = 0; op < OP_STUBS; op++) emit_call(op_stub(op), (uintptr_t)vm_step);
+    for (uint32_t i = 0; i < count; i++) emit_call_arg(fn_stub(i));
+    __builtin___clear_cache((char*)g_perf.area, (char*)&g_perf.area[STUB_AREA]);
+    FILE* map = open_map();
+    if (mprotect(g_perf.area, STUB_AREA, PROT_READ | PROT_EXEC) != 0 || map == NULL) {
+        if (map != NULL) (void)fclose(map);
+        vm_perf_stop();
+        return false;
+    }
+
+    for (uint32_t op = 0; op < OP_MAX; op++) {
+        const char* name = opcode_to_string((opcode_t)op);
+        if (strcmp(name, "unknown") != 0) put_entry(map, op_stub(op), "op", name, op);
+    }
+    g_perf.func_count = count;
+    for (uint32_t i = 0; i < count; i++) {
+        vm_image_func_t f;
+        memcpy(&f, &img.section[VM_SECTION_FUNCS][i * sizeof(f)], sizeof(f));
+        g_perf.func_pc[i] = f.pc;
+        g_perf.func_end[i] = f.pc + f.len;
+        put_entry(map, fn_stub(i), "fn", vm_image_symbol(&img, f.name), f.pc);
+    }
+    return fclose(map) == 0;
+#else
+    (void)vm;
+    (void)image;
+    (void)len;
+    return false;
+#endif
+}
+
+/* FUNCS entry covering pc, or NO_FUNC */
+static uint32_t find_func(uint32_t pc) {
+    uint32_t lo = 0;
+    uint32_t hi = g_perf.func_count;
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2u);
+        if (g_perf.func_end[mid] <= pc) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < g_perf.func_count && g_perf.func_pc[lo] <= pc) ? lo : NO_FUNC;
+}
+
+vm_status_t vm_perf_run(vm_state_t* vm) {
+    if (g_perf.area == NULL) return vm_run(vm);
+    /* The function is looked up again only once the PC leaves its range */
+    uint32_t func = NO_FUNC;
+    uint32_t lo = 1;
+    uint32_t hi = 0;
+    vm_status_t status;
+    do {
+        const uint32_t pc = vm->pc;
+        if (pc < lo || pc >= hi) {
+            func = find_func(pc);
+            lo = (func != NO_FUNC) ? g_perf.func_pc[func] : pc;
+            hi = (func != NO_FUNC) ? g_perf.func_end[func] : pc + 1u;
+        }
+        /* Fetch checks the PC; an opcode from outside the code is never executed */
+        op_stub_t step = (op_stub_t)(uintptr_t)op_stub((pc < vm->program_len) ? vm->code[pc] : 0u);
+        if (func != NO_FUNC) {
+            status = ((fn_stub_t)(uintptr_t)fn_stub(func))(vm, step);
+        } else {
+            status = step(vm);
+        }
+    } while (status == VM_OK);
+    return (status == VM_ERR_HALT) ? VM_OK : status;
+}
+
+void vm_perf_stop(void) {
+    if (g_perf.area != NULL) (void)munmap(g_perf.area, STUB_AREA);
+    g_perf.area = NULL;
+    g_perf.func_count = 0;
+}
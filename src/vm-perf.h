@@ -0,0 +1,48 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - Linux perf Integration
+ * Under perf every interpreted instruction is a sample in vm_step(). While
+ * vm_perf_run() executes, each step is called through a small generated
+ * trampoline per opcode, and, when the image has FUNCS, through one per
+ * bytecode function around it. The trampolines live in anonymous
+ * executable memory and are named in /tmp/perf-<pid>.map, which perf reads
+ * for code it cannot find in a file. With frame pointers (build with
+ * -fno-omit-frame-pointer), `perf record -g` then shows
+ *
+ *     vm_step <- stipple:op:add.i32 <- stipple:fn:fib <- vm_perf_run
+ *
+ * and `perf report --children` charges the time to opcodes and functions.
+ * The default software event (cpu-clock) is enough; no PMU is needed.
+ * Runs without vm_perf_start() are unaffected.
+ *
+ * x86-64 and AArch64 Linux only. The trampolines are process-wide, so one
+ * VM can be profiled at a time.
+ */
+
+/* ============================================================================
+ * Profiling Limits
+ * ============================================================================ */
+
+#define VM_PERF_MAX_FUNCS 256u   /* FUNCS entries that get a trampoline */
+#define VM_PERF_STUB_SIZE 32u    /* Bytes per trampoline */
+
+/* ============================================================================
+ * Profiling API
+ * ============================================================================ */
+
+/*
+ * Generate the trampolines for the program loaded in vm and append them to
+ * /tmp/perf-<pid>.map. image is the raw or container image vm was loaded
+ * from; its FUNCS and SYMBOLS name the function trampolines (it may be
+ * NULL). Returns false on other architectures, for linked programs, or if
+ * the memory or the map file cannot be set up.
+ */
+bool vm_perf_start(const vm_state_t* vm, const uint8_t* image, uint32_t len);
+
+/* vm_run() through the trampolines; plain vm_run() without vm_perf_start() */
+vm_status_t vm_perf_run(vm_state_t* vm);
+
+/* Release the trampolines; perf has already recorded the map by then */
+void vm_perf_stop(void);
@@ -0,0 +1,376 @@
+/*
+ * Stipple VM - Job Server
+ * Long-lived daemon behind `stipple-vm --serve`. Jobs arrive as framed
+ * requests on a Unix socket (see vm-serve.h) and run on pre-initialized VM
+ * contexts; verified programs are cached by content hash (vm-cache.c) so
+ * repeat jobs can send only the hash. No dynamic allocation - all buffers are static.
+ */
+
+#define _GNU_SOURCE
+#include "vm-serve.h"
+#include "vm-cache.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static vm_state_t g_pool[SERVE_POOL_SIZE];
+static bool g_pool_warm[SERVE_POOL_SIZE];
+
+static uint8_t g_program[PROGRAM_IMAGE_MAX_SIZE];
+static uint8_t g_input[SERVE_MAX_INPUT];
+static uint8_t g_output[SERVE_MAX_OUTPUT];
+
+/* ============================================================================
+ * Helpers
+ * ============================================================================ */
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000u) + ((uint64_t)ts.tv_nsec / 1000u);
+}
+
+/* Wait for a non-blocking fd; false once deadline (now_us() time, 0: none) has passed */
+static bool wait_ready(int fd, short events, uint64_t deadline) {
+    for (;;) {
+        int timeout = -1;
+        if (deadline != 0u) {
+            uint64_t now = now_us();
+            if (now >= deadline) return false;
+            timeout = (int)((deadline - now + 999u) / 1000u);
+        }
+        struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+        int rc = poll(&pfd, 1, timeout);
+        if (rc > 0) return true;
+        if (rc < 0 && errno != EINTR) return false;
+    }
+}
+
+static bool read_full(int fd, void* buf, size_t len, uint64_t deadline) {
+    uint8_t* p = buf;
+    while (len > 0u) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN && wait_ready(fd, POLLIN, deadline)) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void* buf, size_t len, uint64_t deadline) {
+    const uint8_t* p = buf;
+    while (len > 0u) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN && wait_ready(fd, POLLOUT, deadline)) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void print_u64_err(uint64_t value) {
+    char buf[21];
+    int i = 0;
+    do {
+        buf[i] = (char)('0' + (value % 10u));
+        value /= 10u;
+        i++;
+    } while (value > 0u);
+    while (i > 0) {
+        i--;
+        (void)fputc(buf[i], stderr);
+    }
+}
+
+static const char* serve_status_string(uint32_t status) {
+    switch (status) {
+        case SERVE_ERR_UNKNOWN_PROGRAM: return "Program not cached";
+        case SERVE_ERR_BAD_REQUEST:     return "Bad request";
+        case SERVE_ERR_STEP_LIMIT:      return "Step limit exceeded";
+        case SERVE_ERR_OUTPUT_LIMIT:    return "Output limit exceeded";
+        default:                        return vm_get_error_string((vm_status_t)status);
+    }
+}
+
+static int open_unix(const char* path, bool serve) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1u);
+    int rc;
+    if (serve) {
+        (void)unlink(path);
+        rc = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+        if (rc == 0) rc = listen(fd, 16);
+    } else {
+        rc = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+    if (rc != 0) {
+        (void)close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* ============================================================================
+ * VM Pool
+ * ============================================================================ */
+
+static void warm(uint32_t i) {
+    vm_init(&g_pool[i]);
+    vm_set_io_mode(&g_pool[i], VM_IO_HOST);
+    g_pool_warm[i] = true;
+}
+
+/* Clean contexts are handed out; used ones are rewarmed after the reply is sent */
+static vm_state_t* pool_acquire(uint32_t* idx) {
+    for (uint32_t i = 0; i < SERVE_POOL_SIZE; i++) {
+        if (g_pool_warm[i]) {
+            g_pool_warm[i] = false;
+            *idx = i;
+            return &g_pool[i];
+        }
+    }
+    warm(0);
+    g_pool_warm[0] = false;
+    *idx = 0;
+    return &g_pool[0];
+}
+
+/* ============================================================================
+ * Job Execution
+ * ============================================================================ */
+
+static bool drain_output(vm_state_t* vm, uint32_t* out_len, uint32_t max_output) {
+    uint32_t len;
+    const uint8_t* data = vm_pending_output(vm, &len);
+    if (len > max_output - *out_len) return false;
+    memcpy(&g_output[*out_len], data, len);
+    *out_len += len;
+    vm_consume_output(vm, len);
+    return true;
+}
+
+static void run_job(vm_state_t* vm, const serve_request_t* req, serve_response_t* resp) {
+    uint64_t max_steps = (req->max_steps != 0u) ? req->max_steps : SERVE_DEFAULT_STEPS;
+    uint32_t max_output = (req->max_output != 0u && req->max_output < SERVE_MAX_OUTPUT)
+                          ? req->max_output : SERVE_MAX_OUTPUT;
+    uint32_t fed = vm_feed_input(vm, g_input, req->input_len);
+    if (fed == req->input_len) vm_close_input(vm);
+
+    uint64_t steps = 0;
+    uint32_t status = SERVE_ERR_STEP_LIMIT;
+    while (steps < max_steps) {
+        vm_status_t s = vm_step(vm);
+        steps++;
+        if (s == VM_OK) continue;
+        if (s != VM_YIELD) {
+            status = (s == VM_ERR_HALT) ? VM_OK : s;
+            break;
+        }
+        /* Input is all in memory, so a yield only means a buffer needs servicing */
+        if (!drain_output(vm, &resp->output_len, max_output)) {
+            status = SERVE_ERR_OUTPUT_LIMIT;
+            break;
+        }
+        if (fed < req->input_len) {
+            fed += vm_feed_input(vm, &g_input[fed], req->input_len - fed);
+            if (fed == req->input_len) vm_close_input(vm);
+        }
+    }
+    if (status != SERVE_ERR_OUTPUT_LIMIT && !drain_output(vm, &resp->output_len, max_output)) {
+        status = SERVE_ERR_OUTPUT_LIMIT;
+    }
+    resp->status = status;
+    resp->pc = vm->pc;
+    resp->steps = steps;
+}
+
+/*
+ * Returns false when the connection must be closed. Waiting for the
+ * request, then sending the reply, may each take SERVE_IO_TIMEOUT_MS; the
+ * job itself is bounded by its step limit.
+ */
+static bool handle_request(int fd) {
+    serve_request_t req;
+    serve_response_t resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.magic = SERVE_RESP_MAGIC;
+
+    uint64_t deadline = now_us() + (SERVE_IO_TIMEOUT_MS * 1000u);
+    if (!read_full(fd, &req, sizeof(req), deadline)) return false;
+    if (req.magic != SERVE_REQ_MAGIC || req.program_len > PROGRAM_IMAGE_MAX_SIZE || req.input_len > SERVE_MAX_INPUT ||
+        !read_full(fd, g_program, req.program_len, deadline) || !read_full(fd, g_input, req.input_len, deadline)) {
+        resp.status = SERVE_ERR_BAD_REQUEST;
+        (void)write_full(fd, &resp, sizeof(resp), now_us() + (SERVE_IO_TIMEOUT_MS * 1000u));
+        return false;
+    }
+
+    uint64_t start = now_us();
+    uint32_t idx;
+    vm_state_t* vm = pool_acquire(&idx);
+    vm_status_t status;
+    bool hit;
+    if (req.program_len != 0u) {
+        /* The server hashes what it received; the client's hash is only a lookup key */
+        status = vm_cache_load(vm, g_program, req.program_len, &hit);
+    } else {
+        hit = vm_cache_attach(vm, req.hash);
+        status = hit ? VM_OK : (vm_status_t)SERVE_ERR_UNKNOWN_PROGRAM;
+    }
+    if (hit) resp.flags |= SERVE_FLAG_CACHE_HIT;
+    if (status != VM_OK) {
+        resp.status = status;
+        warm(idx);
+        return write_full(fd, &resp, sizeof(resp), now_us() + (SERVE_IO_TIMEOUT_MS * 1000u));
+    }
+    run_job(vm, &req, &resp);
+    resp.run_us = (uint32_t)(now_us() - start);
+
+    deadline = now_us() + (SERVE_IO_TIMEOUT_MS * 1000u);
+    bool ok = write_full(fd, &resp, sizeof(resp), deadline) && write_full(fd, g_output, resp.output_len, deadline);
+    /* Reset off the latency path: the reply is already on its way */
+    warm(idx);
+    return ok;
+}
+
+int vm_serve(const char* sock_path, const char* cache_dir) {
+    /* Clients that disconnect early must not kill the daemon */
+    (void)signal(SIGPIPE, SIG_IGN);
+    if (!vm_cache_init(cache_dir)) {
+        (void)fputs("Error: Cannot use cache directory '", stderr);
+        (void)fputs(cache_dir, stderr);
+        (void)fputs("'\n", stderr);
+        return 1;
+    }
+    int lfd = open_unix(sock_path, true);
+    if (lfd < 0) {
+        (void)fputs("Error: Cannot listen on '", stderr);
+        (void)fputs(sock_path, stderr);
+        (void)fputs("'\n", stderr);
+        return 1;
+    }
+    for (uint32_t i = 0; i < SERVE_POOL_SIZE; i++) warm(i);
+
+    (void)fputs("Serving on ", stdout);
+    (void)fputs(sock_path, stdout);
+    (void)fputc('\n', stdout);
+    (void)fflush(stdout);
+
+    /*
+     * Connections are served one at a time; each may carry many jobs. A
+     * client that stalls is dropped after SERVE_IO_TIMEOUT_MS, so it can
+     * hold up the others for at most that long.
+     */
+    for (;;) {
+        int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            (void)fputs("Error: accept failed\n", stderr);
+            (void)close(lfd);
+            return 1;
+        }
+        while (handle_request(cfd)) {}
+        (void)close(cfd);
+    }
+}
+
+/* ============================================================================
+ * Client
+ * ============================================================================ */
+
+static bool read_all(int fd, uint8_t* buf, uint32_t cap, uint32_t* len) {
+    uint32_t total = 0;
+    for (;;) {
+        ssize_t n = read(fd, buf + total, cap - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) break;
+        total += (uint32_t)n;
+        if (total == cap) {
+            uint8_t extra;
+            if (read(fd, &extra, 1) > 0) return false;
+            break;
+        }
+    }
+    *len = total;
+    return true;
+}
+
+static bool exchange(int fd, serve_request_t* req, bool send_program, serve_response_t* resp) {
+    req->program_len = send_program ? req->program_len : 0u;
+    if (!write_full(fd, req, sizeof(*req), 0) ||
+        !write_full(fd, g_program, req->program_len, 0) ||
+        !write_full(fd, g_input, req->input_len, 0) ||
+        !read_full(fd, resp, sizeof(*resp), 0) ||
+        resp->magic != SERVE_RESP_MAGIC || resp->output_len > SERVE_MAX_OUTPUT) {
+        return false;
+    }
+    return read_full(fd, g_output, resp->output_len, 0);
+}
+
+int vm_serve_client(const char* sock_path, const char* bytecode_file) {
+    uint32_t program_len;
+    int pfd = open(bytecode_file, O_RDONLY | O_CLOEXEC);
+    bool ok = (pfd >= 0) && read_all(pfd, g_program, PROGRAM_IMAGE_MAX_SIZE, &program_len) && program_len > 0u;
+    if (pfd >= 0) (void)close(pfd);
+    if (!ok) {
+        (void)fputs("Error: Cannot read '", stderr);
+        (void)fputs(bytecode_file, stderr);
+        (void)fputs("'\n", stderr);
+        return 1;
+    }
+    serve_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.magic = SERVE_REQ_MAGIC;
+    req.hash = vm_program_hash(g_program, program_len);
+    if (!read_all(STDIN_FILENO, g_input, SERVE_MAX_INPUT, &req.input_len)) {
+        (void)fputs("Error: Input too large\n", stderr);
+        return 1;
+    }
+
+    int fd = open_unix(sock_path, false);
+    if (fd < 0) {
+        (void)fputs("Error: Cannot connect to '", stderr);
+        (void)fputs(sock_path, stderr);
+        (void)fputs("'\n", stderr);
+        return 1;
+    }
+    /* Try by hash first; only ship the program when the server lacks it */
+    serve_response_t resp;
+    req.program_len = program_len;
+    ok = exchange(fd, &req, false, &resp);
+    if (ok && resp.status == SERVE_ERR_UNKNOWN_PROGRAM) {
+        req.program_len = program_len;
+        ok = exchange(fd, &req, true, &resp);
+    }
+    (void)close(fd);
+    if (!ok) {
+        (void)fputs("Error: Protocol failure\n", stderr);
+        return 1;
+    }
+
+    (void)write_full(STDOUT_FILENO, g_output, resp.output_len, 0);
+    (void)fputs("[", stderr);
+    (void)fputs(serve_status_string(resp.status), stderr);
+    (void)fputs("] steps=", stderr);
+    print_u64_err(resp.steps);
+    (void)fputs(" time_us=", stderr);
+    print_u64_err(resp.run_us);
+    (void)fputs(((resp.flags & SERVE_FLAG_CACHE_HIT) != 0u) ? " cache=hit\n" : " cache=miss\n", stderr);
+    return (resp.status == VM_OK) ? 0 : 1;
+}
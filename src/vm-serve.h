@@ -0,0 +1,70 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - Job Server Protocol
+ * Framed request/response protocol spoken over a Unix stream socket by
+ * `stipple-vm --serve` and `stipple-vm --connect`. Fields are in host byte
+ * order; both ends run on the same machine.
+ */
+
+/* ============================================================================
+ * Server Configuration Constants
+ * ============================================================================ */
+
+#define SERVE_POOL_SIZE 2                   /* Pre-initialized VM contexts */
+#define SERVE_MAX_INPUT (1024u * 1024u)     /* Input bytes per job */
+#define SERVE_MAX_OUTPUT (1024u * 1024u)    /* Output bytes per job */
+#define SERVE_DEFAULT_STEPS 100000000u      /* Step limit when a job sets none */
+#define SERVE_IO_TIMEOUT_MS 5000u           /* Longest wait for a request, or to send a reply */
+
+#define SERVE_REQ_MAGIC  0x4A505453u  /* "STPJ" */
+#define SERVE_RESP_MAGIC 0x52505453u  /* "STPR" */
+
+/* Job-level results, reported in serve_response_t.status next to vm_status_t values */
+#define SERVE_ERR_UNKNOWN_PROGRAM 0x100u  /* Hash-only request missed the cache; resend the program */
+#define SERVE_ERR_BAD_REQUEST     0x101u  /* Malformed frame; the connection is closed */
+#define SERVE_ERR_STEP_LIMIT      0x102u  /* max_steps reached before HALT */
+#define SERVE_ERR_OUTPUT_LIMIT    0x103u  /* Program produced more than max_output bytes */
+
+/* serve_response_t.flags */
+#define SERVE_FLAG_CACHE_HIT 0x01u  /* Program came from the cache (no verification) */
+
+/* ============================================================================
+ * Frames
+ * ============================================================================ */
+
+/* Request header, followed by program_len program bytes and input_len input bytes */
+typedef struct {
+	uint32_t magic;        /* SERVE_REQ_MAGIC */
+	uint32_t program_len;  /* 0: run the cached program named by hash */
+	uint64_t hash;         /* vm_program_hash() of the program */
+	uint32_t input_len;    /* Bytes fed to OP_READ_*; EOF follows */
+	uint32_t max_output;   /* 0: SERVE_MAX_OUTPUT */
+	uint64_t max_steps;    /* 0: SERVE_DEFAULT_STEPS */
+} serve_request_t;
+
+/* Response header, followed by output_len bytes of program output */
+typedef struct {
+	uint32_t magic;        /* SERVE_RESP_MAGIC */
+	uint32_t status;       /* vm_status_t (VM_OK on HALT) or SERVE_ERR_* */
+	uint32_t pc;           /* PC where execution stopped */
+	uint32_t output_len;
+	uint64_t steps;        /* Instructions executed */
+	uint32_t flags;        /* SERVE_FLAG_* */
+	uint32_t run_us;       /* Load plus execution time in microseconds */
+} serve_response_t;
+
+_Static_assert(sizeof(serve_request_t) == 32, "serve_request_t must have no padding");
+_Static_assert(sizeof(serve_response_t) == 32, "serve_response_t must have no padding");
+
+/* ============================================================================
+ * Entry Points
+ * ============================================================================ */
+
+/* Serve jobs on a Unix socket at sock_path until killed; returns nonzero on setup failure.
+ * cache_dir (may be NULL) persists verified programs across restarts. */
+int vm_serve(const char* sock_path, const char* cache_dir);
+
+/* Run bytecode_file on the server with stdin as input; output goes to stdout */
+int vm_serve_client(const char* sock_path, const char* bytecode_file);
@@ -0,0 +1,957 @@
+/*
+ * Stipple VM - Call Profiles and Function Specialization
+ * The specializer propagates constants forward through one function at a
+ * time. An operation whose inputs are all known is evaluated by vm_step()
+ * on a scratch VM, so a folded result is exactly what the interpreter
+ * would have produced. An operation that would fail is left in place to
+ * fail at run time.
+ */
+
+#include "vm-spec.h"
+#include <string.h>
+
+#define NO_INDEX 0xFFFFFFFFu
+#define ALL_VARS ((uint32_t)((1ull << STACK_VAR_COUNT) - 1u))
+#define SITE_WORDS 4u  /* pc, target, calls, const_mask; then type, low, high per constant */
+
+/* ============================================================================
+ * Call Profile
+ * ============================================================================ */
+
+static uint32_t g_words[2u + (VM_SPEC_MAX_SITES * (SITE_WORDS + (3u * STACK_VAR_COUNT)))];
+
+void vm_profile_init(vm_call_profile_t* profile) {
+    memset(profile, 0, sizeof(*profile));
+}
+
+/* Same type and bits; 32-bit types ignore the unused half of the union */
+static bool same_value(const var_value_t* a, const var_value_t* b) {
+    if (a->type != b->type) return false;
+    if (a->type == V_I64 || a->type == V_U64) return a->val.u64 == b->val.u64;
+    return a->val.u32 == b->val.u32;
+}
+
+void vm_profile_call(vm_call_profile_t* profile, uint32_t pc, uint32_t target, const var_value_t* args) {
+    uint32_t slot = ((pc >> 2) * 2654435761u) >> 16;
+    for (uint32_t probe = 0; probe < VM_SPEC_MAX_SITES; probe++) {
+        vm_call_site_t* site = &profile->sites[(slot + probe) & (VM_SPEC_MAX_SITES - 1u)];
+        if (site->calls == 0u) {
+            site->pc = pc;
+            site->target = target;
+            site->calls = 1;
+            site->const_mask = 0;
+            for (uint32_t i = 0; i < STACK_VAR_COUNT; i++) {
+                site->args[i] = args[i];
+                if (args[i].type != V_VOID) site->const_mask |= 1u << i;
+            }
+            profile->site_count++;
+            return;
+        }
+        if (site->pc == pc) {
+            if (site->calls < UINT32_MAX) site->calls++;
+            for (uint32_t i = 0; i < STACK_VAR_COUNT; i++) {
+                if (((site->const_mask >> i) & 1u) != 0u && !same_value(&site->args[i], &args[i])) {
+                    site->const_mask &= ~(1u << i);
+                }
+            }
+            return;
+        }
+    }
+    profile->dropped++;
+}
+
+vm_status_t vm_profile_save(const vm_call_profile_t* profile, const uint8_t* in, uint32_t len,
+                            uint8_t* out, uint32_t cap, uint32_t* out_len) {
+    vm_image_t img;
+    if (vm_image_is_container(in, len)) {
+        vm_status_t status = vm_image_parse(in, len, &img);
+        if (status != VM_OK) return status;
+    } else {
+        memset(&img, 0, sizeof(img));
+        img.section[VM_SECTION_CODE] = in;
+        img.section_size[VM_SECTION_CODE] = len;
+        img.code_len = len;
+    }
+
+    uint32_t n = 0;
+    g_words[n++] = VM_SPEC_PROFILE_TAG;
+    g_words[n++] = profile->site_count;
+    for (uint32_t s = 0; s < VM_SPEC_MAX_SITES; s++) {
+        const vm_call_site_t* site = &profile->sites[s];
+        if (site->calls == 0u) continue;
+        g_words[n++] = site->pc;
+        g_words[n++] = site->target;
+        g_words[n++] = site->calls;
+        g_words[n++] = site->const_mask;
+        for (uint32_t i = 0; i < STACK_VAR_COUNT; i++) {
+            if (((site->const_mask >> i) & 1u) == 0u) continue;
+            g_words[n++] = (uint32_t)site->args[i].type;
+            g_words[n++] = (uint32_t)site->args[i].val.u64;
+            g_words[n++] = (uint32_t)(site->args[i].val.u64 >> 32);
+        }
+    }
+    img.section[VM_SECTION_PROFILE] = (const uint8_t*)g_words;
+    img.section_size[VM_SECTION_PROFILE] = n * 4u;
+    return vm_image_build(&img, out, cap, out_len);
+}
+
+/* ============================================================================
+ * Opcode Shapes
+ * ============================================================================ */
+
+/* What an opcode does to the frame's stack vars and the flags */
+enum {
+    SHAPE_OTHER = 0,  /* May read or write any stack var and the flags */
+    SHAPE_PURE,       /* operand = f(sources), flags untouched */
+    SHAPE_COMPARE,    /* flags = f(sources) */
+    SHAPE_WRITE,      /* operand = a value not known statically */
+    SHAPE_READ,       /* Only reads its sources */
+    SHAPE_BRANCH,     /* Jcc */
+    SHAPE_JUMP,
+    SHAPE_TABLE,
+    SHAPE_END         /* RET, HALT, TAILCALL */
+};
+
+/* Which instruction fields name source stack vars */
+#define SRC_OPERAND 0x01u
+#define SRC_IMM1    0x02u
+#define SRC_IMM2    0x04u
+#define SRC_IMM3    0x08u
+#define READS_FLAGS 0x10u
+
+#define SRC_UNARY   SRC_IMM1
+#define SRC_BINARY  (SRC_IMM1 | SRC_IMM2)
+
+typedef struct {
+    uint8_t shape;
+    uint8_t srcs;
+} op_shape_t;
+
+static const op_shape_t g_shapes[256] = {
+    [OP_NOP] = { SHAPE_READ, 0 }, [OP_HALT] = { SHAPE_END, 0 }, [OP_RET] = { SHAPE_END, 0 },
+    [OP_TAILCALL] = { SHAPE_END, 0 },
+    [OP_JMP] = { SHAPE_JUMP, 0 }, [OP_JMP_TABLE] = { SHAPE_TABLE, SRC_OPERAND },
+    [OP_JZ] = { SHAPE_BRANCH, READS_FLAGS }, [OP_JNZ] = { SHAPE_BRANCH, READS_FLAGS },
+    [OP_JLT] = { SHAPE_BRANCH, READS_FLAGS }, [OP_JGT] = { SHAPE_BRANCH, READS_FLAGS },
+    [OP_JLE] = { SHAPE_BRANCH, READS_FLAGS }, [OP_JGE] = { SHAPE_BRANCH, READS_FLAGS },
+    [OP_LOAD_G] = { SHAPE_WRITE, 0 }, [OP_LOAD_L] = { SHAPE_WRITE, 0 },
+    [OP_LOAD_S] = { SHAPE_WRITE, 0 }, [OP_LOAD_RET] = { SHAPE_WRITE, 0 },
+    [OP_LOAD_I_I32] = { SHAPE_PURE, 0 }, [OP_LOAD_I_U32] = { SHAPE_PURE, 0 },
+    [OP_LOAD_I_F32] = { SHAPE_PURE, 0 }, [OP_LOAD_I_I64] = { SHAPE_PURE, 0 },
+    [OP_LOAD_I_U64] = { SHAPE_PURE, 0 },
+    [OP_STORE_G] = { SHAPE_READ, SRC_OPERAND }, [OP_STORE_L] = { SHAPE_READ, SRC_OPERAND },
+    [OP_STORE_RET] = { SHAPE_READ, SRC_OPERAND },
+    [OP_ADD_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_I32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_DIV_I32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MOD_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_NEG_I32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_ADD_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_DIV_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MOD_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_ADD_F32] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_F32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_F32] = { SHAPE_PURE, SRC_BINARY }, [OP_DIV_F32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_NEG_F32] = { SHAPE_PURE, SRC_UNARY }, [OP_ABS_F32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_SQRT_F32] = { SHAPE_PURE, SRC_UNARY }, [OP_EXP_F32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_LOG_F32] = { SHAPE_PURE, SRC_UNARY }, [OP_SIN_F32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_COS_F32] = { SHAPE_PURE, SRC_UNARY }, [OP_POW_F32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_FLOOR_F32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_FMA_F32] = { SHAPE_PURE, SRC_IMM1 | SRC_IMM2 | SRC_IMM3 },
+    [OP_AND_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_OR_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_XOR_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_NOT_U32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_SHL_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_SHR_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_CMP_I32] = { SHAPE_COMPARE, SRC_BINARY }, [OP_CMP_U32] = { SHAPE_COMPARE, SRC_BINARY },
+    [OP_CMP_F32] = { SHAPE_COMPARE, SRC_BINARY }, [OP_CMP_I64] = { SHAPE_COMPARE, SRC_BINARY },
+    [OP_CMP_U64] = { SHAPE_COMPARE, SRC_BINARY },
+    [OP_SELECT] = { SHAPE_PURE, SRC_IMM1 | SRC_IMM2 | SRC_IMM3 },
+    [OP_CMOV] = { SHAPE_PURE, SRC_IMM2 | SRC_IMM3 | READS_FLAGS },
+    [OP_TEST_CONST] = { SHAPE_COMPARE, SRC_OPERAND },
+    [OP_I32_TO_U32] = { SHAPE_PURE, SRC_UNARY }, [OP_U32_TO_I32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_I32_TO_F32] = { SHAPE_PURE, SRC_UNARY }, [OP_U32_TO_F32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_F32_TO_I32] = { SHAPE_PURE, SRC_UNARY }, [OP_F32_TO_U32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_I32_TO_I64] = { SHAPE_PURE, SRC_UNARY }, [OP_I64_TO_I32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_U32_TO_U64] = { SHAPE_PURE, SRC_UNARY }, [OP_U64_TO_U32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_I64_TO_U64] = { SHAPE_PURE, SRC_UNARY }, [OP_U64_TO_I64] = { SHAPE_PURE, SRC_UNARY },
+    [OP_I64_TO_F32] = { SHAPE_PURE, SRC_UNARY }, [OP_F32_TO_I64] = { SHAPE_PURE, SRC_UNARY },
+    [OP_PRINT_I32] = { SHAPE_READ, SRC_IMM1 }, [OP_PRINT_U32] = { SHAPE_READ, SRC_IMM1 },
+    [OP_PRINT_F32] = { SHAPE_READ, SRC_IMM1 }, [OP_PRINT_I64] = { SHAPE_READ, SRC_IMM1 },
+    [OP_PRINT_U64] = { SHAPE_READ, SRC_IMM1 }, [OP_PRINT_STR] = { SHAPE_READ, 0 },
+    [OP_PRINTLN] = { SHAPE_READ, 0 },
+    [OP_ADD_I64] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_I64] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_I64] = { SHAPE_PURE, SRC_BINARY }, [OP_DIV_I64] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MOD_I64] = { SHAPE_PURE, SRC_BINARY }, [OP_NEG_I64] = { SHAPE_PURE, SRC_UNARY },
+    [OP_ADD_U64] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_U64] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_U64] = { SHAPE_PURE, SRC_BINARY }, [OP_DIV_U64] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MOD_U64] = { SHAPE_PURE, SRC_BINARY },
+    [OP_ADD_PK] = { SHAPE_PURE, SRC_BINARY }, [OP_ADDS_PK] = { SHAPE_PURE, SRC_BINARY },
+    [OP_SUB_PK] = { SHAPE_PURE, SRC_BINARY }, [OP_SUBS_PK] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MIN_PK] = { SHAPE_PURE, SRC_BINARY }, [OP_MAX_PK] = { SHAPE_PURE, SRC_BINARY },
+    [OP_CMPEQ_PK] = { SHAPE_PURE, SRC_BINARY }, [OP_CMPGT_PK] = { SHAPE_PURE, SRC_BINARY },
+    [OP_SHUF_PK] = { SHAPE_PURE, SRC_UNARY }, [OP_U32_TO_PK] = { SHAPE_PURE, SRC_UNARY },
+    [OP_PK_TO_U32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_ADD_WRAP_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_WRAP_I32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_WRAP_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_ADD_WRAP_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_SUB_WRAP_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_MUL_WRAP_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_ADD_SAT_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_SUB_SAT_I32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_SAT_I32] = { SHAPE_PURE, SRC_BINARY }, [OP_ADD_SAT_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_SUB_SAT_U32] = { SHAPE_PURE, SRC_BINARY }, [OP_MUL_SAT_U32] = { SHAPE_PURE, SRC_BINARY },
+    [OP_MUL_FX] = { SHAPE_PURE, SRC_BINARY }, [OP_DIV_FX] = { SHAPE_PURE, SRC_BINARY },
+    [OP_I32_TO_FX] = { SHAPE_PURE, SRC_UNARY }, [OP_FX_TO_I32] = { SHAPE_PURE, SRC_UNARY },
+    [OP_F32_TO_FX] = { SHAPE_PURE, SRC_UNARY }, [OP_FX_TO_F32] = { SHAPE_PURE, SRC_UNARY }
+};
+
+/* ============================================================================
+ * Constant Propagation
+ * ============================================================================ */
+
+/* Flags lattice, from most to least precise */
+enum {
+    FLAGS_KNOWN = 0,
+    FLAGS_UNKNOWN,
+    FLAGS_CALLER      /* Still as the caller left them: a clone's guards clobber these */
+};
+
+/* What the clone does with an instruction */
+enum {
+    ACT_KEEP = 0,
+    ACT_FOLD,         /* Becomes a LOAD_I_* of value */
+    ACT_JUMP,         /* Jcc that is always taken: becomes JMP */
+    ACT_DROP          /* Jcc never taken, or a jump to the next emitted instruction */
+};
+
+typedef struct {
+    uint32_t known;                     /* Bit i: vars[i] is a known constant */
+    uint32_t entry;                     /* Bit i: stack var i still holds the caller's argument */
+    uint8_t flags_state;                /* FLAGS_* */
+    uint8_t flags;                      /* Value when FLAGS_KNOWN */
+    var_value_t vars[STACK_VAR_COUNT];
+} spec_state_t;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t end;          /* After the instruction and any JMP_TABLE entries */
+    vm_instruction_t insn;
+    bool reached;
+    uint8_t action;        /* ACT_* */
+    var_value_t value;     /* Result for ACT_FOLD */
+    uint32_t new_pc;       /* In the clone */
+    spec_state_t in;
+} spec_insn_t;
+
+/* One function being analyzed */
+static spec_insn_t g_insns[VM_SPEC_MAX_INSNS];
+static uint32_t g_insn_count;
+
+/* Scratch VM that evaluates instructions with known inputs */
+static vm_state_t g_eval;
+
+/* Successor PCs of one instruction (a JMP_TABLE may have many) */
+static uint32_t g_succ[(PROGRAM_MAX_SIZE / 4u) + 1u];
+
+static uint32_t insn_index(uint32_t pc) {
+    uint32_t lo = 0;
+    uint32_t hi = g_insn_count;
+    while (lo < hi) {
+        uint32_t mid = lo + ((hi - lo) / 2u);
+        if (g_insns[mid].pc == pc) return mid;
+        if (g_insns[mid].pc < pc) {
+            lo = mid + 1u;
+        } else {
+            hi = mid;
+        }
+    }
+    return NO_INDEX;
+}
+
+static bool branch_taken(uint8_t opcode, uint8_t flags) {
+    switch (opcode) {
+        case OP_JZ:  return (flags & FLAG_ZERO) != 0u;
+        case OP_JNZ: return (flags & FLAG_ZERO) == 0u;
+        case OP_JLT: return (flags & FLAG_LESS) != 0u;
+        case OP_JGT: return (flags & FLAG_GREATER) != 0u;
+        case OP_JLE: return (flags & (FLAG_LESS | FLAG_ZERO)) != 0u;
+        case OP_JGE: return (flags & (FLAG_GREATER | FLAG_ZERO)) != 0u;
+        default:     return false;
+    }
+}
+
+/* Run one instruction on the scratch VM; false if it fails */
+static bool evaluate(const uint8_t* code, const spec_insn_t* si, const spec_state_t* st,
+                     var_value_t* result, uint8_t* flags) {
+    vm_state_t* vm = &g_eval;
+    if (vm_attach_verified_program(vm, &code[si->pc], si->insn.size) != VM_OK) return false;
+    vm->sp = 0;
+    memcpy(vm->stack_frames[0].stack_vars, st->vars, sizeof(st->vars));
+    vm->flags = st->flags;
+    if (vm_step(vm) != VM_OK) return false;
+    if (si->insn.header.operand < STACK_VAR_COUNT) *result = vm->stack_frames[0].stack_vars[si->insn.header.operand];
+    *flags = vm->flags;
+    return true;
+}
+
+/* Stack vars an instruction reads, or false if one is out of range (it fails at run time) */
+static bool source_vars(const spec_insn_t* si, uint8_t srcs, uint32_t* vars) {
+    const uint32_t slots[4] = {
+        si->insn.header.operand, si->insn.imm[0].u32 & 0xFFu,
+        si->insn.imm[1].u32 & 0xFFu, si->insn.imm[2].u32 & 0xFFu
+    };
+    *vars = 0;
+    for (uint32_t k = 0; k < 4u; k++) {
+        if (((srcs >> k) & 1u) == 0u) continue;
+        if (slots[k] >= STACK_VAR_COUNT) return false;
+        *vars |= 1u << slots[k];
+    }
+    return true;
+}
+
+/*
+ * State after si, and what the clone does with it. Reads of unmodified
+ * arguments are added to *used. False if the instruction reads flags the
+ * caller set, or returns or calls out while they are still the caller's:
+ * the clone's guards would have overwritten them.
+ */
+static bool transfer(const uint8_t* code, spec_insn_t* si, spec_state_t* out, uint32_t* used) {
+    const op_shape_t sh = g_shapes[si->insn.header.opcode];
+    const uint8_t dest = si->insn.header.operand;
+    *out = si->in;
+    si->action = ACT_KEEP;
+
+    if ((sh.shape == SHAPE_OTHER || sh.shape == SHAPE_END) && out->flags_state == FLAGS_CALLER) return false;
+    if (sh.shape == SHAPE_OTHER) {
+        *used |= out->entry;
+        out->known = 0;
+        out->entry = 0;
+        out->flags_state = FLAGS_UNKNOWN;
+        return true;
+    }
+    uint32_t srcs;
+    if (!source_vars(si, sh.srcs, &srcs)) return true;
+    *used |= srcs & out->entry;
+    if ((sh.srcs & READS_FLAGS) != 0u && out->flags_state == FLAGS_CALLER) return false;
+
+    bool inputs_known = ((srcs & ~out->known) == 0u) &&
+                        ((sh.srcs & READS_FLAGS) == 0u || out->flags_state == FLAGS_KNOWN);
+    var_value_t result;
+    uint8_t flags;
+    switch (sh.shape) {
+        case SHAPE_PURE:
+        case SHAPE_WRITE:
+            if (dest >= STACK_VAR_COUNT) break;
+            out->entry &= ~(1u << dest);
+            if (sh.shape == SHAPE_PURE && inputs_known && evaluate(code, si, out, &result, &flags)) {
+                out->vars[dest] = result;
+                out->known |= 1u << dest;
+                if (srcs != 0u) {
+                    si->action = ACT_FOLD;
+                    si->value = result;
+                }
+            } else {
+                out->known &= ~(1u << dest);
+            }
+            break;
+        case SHAPE_COMPARE:
+            if (inputs_known && evaluate(code, si, out, &result, &flags)) {
+                out->flags_state = FLAGS_KNOWN;
+                out->flags = flags;
+            } else {
+                out->flags_state = FLAGS_UNKNOWN;
+            }
+            break;
+        case SHAPE_BRANCH:
+            if (out->flags_state == FLAGS_KNOWN) {
+                si->action = branch_taken(si->insn.header.opcode, out->flags) ? ACT_JUMP : ACT_DROP;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/* Merge st into the entry state of instruction i; true if that changed it */
+static bool merge(uint32_t i, const spec_state_t* st) {
+    spec_state_t* in = &g_insns[i].in;
+    if (!g_insns[i].reached) {
+        g_insns[i].reached = true;
+        *in = *st;
+        return true;
+    }
+    spec_state_t old = *in;
+    in->entry &= st->entry;
+    in->known &= st->known;
+    for (uint32_t v = 0; v < STACK_VAR_COUNT; v++) {
+        if (((in->known >> v) & 1u) != 0u && !same_value(&in->vars[v], &st->vars[v])) {
+            in->known &= ~(1u << v);
+        }
+    }
+    if (st->flags_state > in->flags_state) {
+        in->flags_state = st->flags_state;
+    } else if (st->flags_state == FLAGS_KNOWN && in->flags_state == FLAGS_KNOWN && st->flags != in->flags) {
+        in->flags_state = FLAGS_UNKNOWN;
+    }
+    return (old.known != in->known) || (old.entry != in->entry) || (old.flags_state != in->flags_state);
+}
+
+/* Decode [start, end) into g_insns; false if it does not decode or is too long */
+static bool decode_function(const uint8_t* code, uint32_t start, uint32_t end) {
+    g_insn_count = 0;
+    uint32_t pc = start;
+    while (pc < end) {
+        if (g_insn_count == VM_SPEC_MAX_INSNS) return false;
+        spec_insn_t* si = &g_insns[g_insn_count];
+        if (vm_decode_instruction(code, end, pc, VM_ENCODING_WIDE, &si->insn) != VM_OK) return false;
+        si->pc = pc;
+        si->end = pc + si->insn.size;
+        if (si->insn.header.opcode == OP_JMP_TABLE) {
+            if (si->insn.imm[0].u32 > (end - si->end) / 4u) return false;
+            si->end += si->insn.imm[0].u32 * 4u;
+        }
+        pc = si->end;
+        g_insn_count++;
+    }
+    return true;
+}
+
+/* Successor PCs of instruction i given its action; returns how many */
+static uint32_t successors(const uint8_t* code, const spec_insn_t* si, uint32_t* out, uint32_t cap) {
+    const op_shape_t sh = g_shapes[si->insn.header.opcode];
+    switch (sh.shape) {
+        case SHAPE_END:
+            return 0;
+        case SHAPE_JUMP:
+            out[0] = si->insn.imm[0].u32;
+            return 1;
+        case SHAPE_BRANCH:
+            if (si->action == ACT_JUMP) {
+                out[0] = si->insn.imm[0].u32;
+                return 1;
+            }
+            out[0] = si->end;
+            if (si->action == ACT_DROP) return 1;
+            out[1] = si->insn.imm[0].u32;
+            return 2;
+        case SHAPE_TABLE: {
+            uint32_t count = si->insn.imm[0].u32;
+            if (count + 1u > cap) count = cap - 1u;  /* Never: decode_function() bounds it */
+            for (uint32_t k = 0; k < count; k++) memcpy(&out[k], &code[si->pc + si->insn.size + (k * 4u)], 4);
+            out[count] = si->insn.imm[1].u32;
+            return count + 1u;
+        }
+        default:
+            out[0] = si->end;
+            return 1;
+    }
+}
+
+/*
+ * Propagate seed through the decoded function until nothing changes.
+ * False if control can leave the function other than by RET or HALT, or
+ * flags from the caller can be read or handed back (see transfer()).
+ */
+static bool propagate(const uint8_t* code, const spec_state_t* seed, uint32_t* used) {
+    for (uint32_t i = 0; i < g_insn_count; i++) g_insns[i].reached = false;
+    (void)merge(0, seed);
+    *used = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t i = 0; i < g_insn_count; i++) {
+            spec_insn_t* si = &g_insns[i];
+            if (!si->reached) continue;
+            spec_state_t out;
+            if (!transfer(code, si, &out, used)) return false;
+            uint32_t n = successors(code, si, g_succ, (uint32_t)(sizeof(g_succ) / sizeof(g_succ[0])));
+            for (uint32_t k = 0; k < n; k++) {
+                uint32_t j = insn_index(g_succ[k]);
+                if (j == NO_INDEX) return false;
+                if (merge(j, &out)) changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+/* ============================================================================
+ * Clone Emission
+ * ============================================================================ */
+
+typedef struct {
+    uint32_t target;                    /* Original function entry */
+    uint32_t end;                       /* End of the code it may occupy */
+    uint32_t mask;                      /* Guarded stack vars */
+    var_value_t args[STACK_VAR_COUNT];  /* Their values */
+    uint32_t pc;                        /* Clone entry, or NO_INDEX if none was made */
+} spec_clone_t;
+
+/* Result of the unseeded analysis of one callee */
+typedef struct {
+    uint32_t target;
+    bool ok;        /* Can be specialized */
+    uint32_t used;  /* Arguments read before being overwritten */
+} spec_func_t;
+
+static uint8_t g_code[PROGRAM_MAX_SIZE];
+static uint8_t g_meta[PROGRAM_IMAGE_MAX_SIZE];
+static uint32_t g_starts[PROGRAM_MAX_SIZE / 32u];   /* Bit per code byte: an instruction starts here */
+static uint32_t g_entries[PROGRAM_MAX_SIZE / 32u];  /* Bit per code byte: a function starts here */
+static spec_clone_t g_clones[VM_SPEC_MAX_CLONES];
+static spec_func_t g_funcs[VM_SPEC_MAX_SITES];
+static vm_call_site_t g_sites[VM_SPEC_MAX_SITES];
+static uint32_t g_site_clone[VM_SPEC_MAX_SITES];
+
+static inline bool bit_test(const uint32_t* bits, uint32_t i) {
+    return ((bits[i / 32u] >> (i % 32u)) & 1u) != 0u;
+}
+
+static inline void bit_set(uint32_t* bits, uint32_t i) {
+    bits[i / 32u] |= 1u << (i % 32u);
+}
+
+/* Wide instruction with count immediates; returns its size */
+static uint32_t put_insn(uint8_t* p, uint8_t opcode, uint8_t operand, uint32_t count, const uint32_t* imms) {
+    instruction_header_t hdr = { .opcode = opcode, .operand = operand, .flags = 0, .types = 0 };
+    SET_INSTR_PAYLOAD_LEN(hdr, count);
+    memcpy(p, &hdr, sizeof(hdr));
+    memcpy(&p[sizeof(hdr)], imms, count * 4u);
+    return get_instruction_size((uint8_t)count);
+}
+
+/* LOAD_I_* for value, or 0 when the type has no immediate load */
+static uint8_t load_opcode(const var_value_t* value, uint32_t* size) {
+    switch (value->type) {
+        case V_I32:   *size = 8u;  return OP_LOAD_I_I32;
+        case V_U32:   *size = 8u;  return OP_LOAD_I_U32;
+        case V_FLOAT: *size = 8u;  return OP_LOAD_I_F32;
+        case V_I64:   *size = 12u; return OP_LOAD_I_I64;
+        case V_U64:   *size = 12u; return OP_LOAD_I_U64;
+        default:      *size = 0u;  return OP_NOP;
+    }
+}
+
+/* Bytes instruction i takes in the clone, 0 if it is left out */
+static uint32_t clone_size(const spec_insn_t* si) {
+    if (!si->reached || si->action == ACT_DROP) return 0;
+    if (si->action == ACT_JUMP) return INSTRUCTION_SMALL_SIZE;
+    if (si->action == ACT_FOLD) {
+        uint32_t size;
+        (void)load_opcode(&si->value, &size);
+        return size;
+    }
+    return si->end - si->pc;
+}
+
+/* Keep folds that have no immediate load, and drop jumps to the next emitted instruction */
+static void plan_clone(void) {
+    for (uint32_t i = 0; i < g_insn_count; i++) {
+        spec_insn_t* si = &g_insns[i];
+        uint32_t size;
+        if (si->action == ACT_FOLD && load_opcode(&si->value, &size) == OP_NOP) si->action = ACT_KEEP;
+    }
+    for (uint32_t i = g_insn_count; i-- > 0u;) {
+        spec_insn_t* si = &g_insns[i];
+        uint8_t shape = g_shapes[si->insn.header.opcode].shape;
+        bool jump = (shape == SHAPE_JUMP) || (shape == SHAPE_BRANCH && si->action != ACT_DROP);
+        if (!si->reached || !jump) continue;
+        uint32_t j = insn_index(si->insn.imm[0].u32);
+        if (j == NO_INDEX || j <= i) continue;
+        uint32_t k = i + 1u;
+        while (k < j && clone_size(&g_insns[k]) == 0u) k++;
+        if (k == j) si->action = ACT_DROP;
+    }
+}
+
+static uint32_t remap(uint32_t pc) {
+    return g_insns[insn_index(pc)].new_pc;
+}
+
+/*
+ * Lay out and write a clone of the analyzed function at g_code[base]: the
+ * guards, then the rewritten body. Returns its size, or 0 if it would not
+ * fit. Lines for the clone are appended to g_meta at *meta.
+ */
+static uint32_t emit_clone(const spec_clone_t* c, const vm_image_t* img, uint32_t base,
+                           uint32_t* meta, uint32_t* folded) {
+    uint32_t guard_count = 0;
+    for (uint32_t v = 0; v < STACK_VAR_COUNT; v++) guard_count += (c->mask >> v) & 1u;
+    uint32_t pc = base + (guard_count * (INSTRUCTION_LARGE_SIZE + INSTRUCTION_SMALL_SIZE));
+    for (uint32_t i = 0; i < g_insn_count; i++) {
+        g_insns[i].new_pc = pc;
+        pc += clone_size(&g_insns[i]);
+    }
+    if (pc > PROGRAM_MAX_SIZE) return 0;
+    bool lines = img->section[VM_SECTION_LINES] != NULL;
+    uint32_t line_room = (uint32_t)sizeof(g_meta) - *meta;
+    if (lines && line_room / sizeof(vm_image_line_t) < g_insn_count + 1u) return 0;
+
+    uint8_t* p = &g_code[base];
+    for (uint32_t v = 0; v < STACK_VAR_COUNT; v++) {
+        if (((c->mask >> v) & 1u) == 0u) continue;
+        const var_value_t* arg = &c->args[v];
+        bool wide = (arg->type == V_I64) || (arg->type == V_U64);
+        uint64_t bits = wide ? arg->val.u64 : arg->val.u32;
+        const uint32_t test[3] = { (uint32_t)arg->type, (uint32_t)bits, (uint32_t)(bits >> 32) };
+        p += put_insn(p, OP_TEST_CONST, (uint8_t)v, 3u, test);
+        p += put_insn(p, OP_JNZ, 0, 1u, &c->target);
+    }
+
+    uint32_t last_line = 0;
+    for (uint32_t i = 0; i < g_insn_count; i++) {
+        const spec_insn_t* si = &g_insns[i];
+        uint32_t size = clone_size(si);
+        if (size == 0u) {
+            if (si->reached) (*folded)++;
+            continue;
+        }
+        uint32_t line = lines ? vm_image_line_at(img, si->pc) : 0u;
+        if (line != 0u && line != last_line) {
+            /* The first entry also covers the guards */
+            const vm_image_line_t l = { .pc = (last_line == 0u) ? base : si->new_pc, .line = line };
+            memcpy(&g_meta[*meta], &l, sizeof(l));
+            *meta += sizeof(l);
+            last_line = line;
+        }
+        p = &g_code[si->new_pc];
+        if (si->action == ACT_FOLD) {
+            uint32_t load_size;
+            uint8_t op = load_opcode(&si->value, &load_size);
+            const uint32_t imms[2] = { (uint32_t)si->value.val.u64, (uint32_t)(si->value.val.u64 >> 32) };
+            (void)put_insn(p, op, si->insn.header.operand, (load_size - INSTRUCTION_HEADER_SIZE) / 4u, imms);
+            (*folded)++;
+            continue;
+        }
+        if (si->action == ACT_JUMP) {
+            uint32_t target = remap(si->insn.imm[0].u32);
+            (void)put_insn(p, OP_JMP, 0, 1u, &target);
+            (*folded)++;
+            continue;
+        }
+        memcpy(p, &g_code[si->pc], size);
+        const op_shape_t sh = g_shapes[si->insn.header.opcode];
+        if (sh.shape == SHAPE_JUMP || sh.shape == SHAPE_BRANCH) {
+            uint32_t target = remap(si->insn.imm[0].u32);
+            memcpy(&p[INSTRUCTION_HEADER_SIZE], &target, 4);
+        } else if (sh.shape == SHAPE_TABLE) {
+            uint32_t target = remap(si->insn.imm[1].u32);
+            memcpy(&p[INSTRUCTION_HEADER_SIZE + 4u], &target, 4);
+            for (uint32_t k = 0; k < si->insn.imm[0].u32; k++) {
+                uint32_t at = si->insn.size + (k * 4u);
+                memcpy(&target, &p[at], 4);
+                target = remap(target);
+                memcpy(&p[at], &target, 4);
+            }
+        }
+    }
+    return pc - base;
+}
+
+/* ============================================================================
+ * Specializer
+ * ============================================================================ */
+
+/* Read the call sites of a PROFILE section into g_sites */
+static vm_status_t read_profile(const vm_image_t* img, uint32_t* count) {
+    const uint8_t* p = img->section[VM_SECTION_PROFILE];
+    uint32_t words = img->section_size[VM_SECTION_PROFILE] / 4u;
+    uint32_t w = 0;
+    uint32_t header[2];
+    if (p == NULL || words < 2u) return VM_ERR_INVALID_IMAGE;
+    memcpy(header, p, sizeof(header));
+    w = 2;
+    if (header[0] != VM_SPEC_PROFILE_TAG || header[1] > VM_SPEC_MAX_SITES) return VM_ERR_INVALID_IMAGE;
+    for (uint32_t s = 0; s < header[1]; s++) {
+        vm_call_site_t* site = &g_sites[s];
+        memset(site, 0, sizeof(*site));
+        if (words - w < SITE_WORDS) return VM_ERR_INVALID_IMAGE;
+        memcpy(&site->pc, &p[w * 4u], 4);
+        memcpy(&site->target, &p[(w + 1u) * 4u], 4);
+        memcpy(&site->calls, &p[(w + 2u) * 4u], 4);
+        memcpy(&site->const_mask, &p[(w + 3u) * 4u], 4);
+        w += SITE_WORDS;
+        if ((site->const_mask & ~ALL_VARS) != 0u) return VM_ERR_INVALID_IMAGE;
+        for (uint32_t i = 0; i < STACK_VAR_COUNT; i++) {
+            if (((site->const_mask >> i) & 1u) == 0u) continue;
+            uint32_t v[3];
+            if (words - w < 3u) return VM_ERR_INVALID_IMAGE;
+            memcpy(v, &p[w * 4u], sizeof(v));
+            w += 3u;
+            if (v[0] > V_U64) return VM_ERR_INVALID_IMAGE;
+            site->args[i].type = (var_value_type_t)v[0];
+            site->args[i].val.u64 = (uint64_t)v[1] | ((uint64_t)v[2] << 32);
+        }
+    }
+    if (w != words) return VM_ERR_INVALID_IMAGE;
+    *count = header[1];
+    return VM_OK;
+}
+
+/* Mark instruction starts and function entries (call targets, FUNCS, the entry point) */
+static void scan_code(const vm_image_t* img) {
+    memset(g_starts, 0, sizeof(g_starts));
+    memset(g_entries, 0, sizeof(g_entries));
+    bit_set(g_entries, img->entry);
+    uint32_t pc = 0;
+    while (pc < img->code_len) {
+        vm_instruction_t insn;
+        (void)vm_decode_instruction(g_code, img->code_len, pc, VM_ENCODING_WIDE, &insn);
+        bit_set(g_starts, pc);
+        const uint8_t op = insn.header.opcode;
+        if (op == OP_CALL || op == OP_CALL_MEMO || op == OP_TAILCALL) bit_set(g_entries, insn.imm[0].u32);
+        pc += insn.size;
+        if (insn.header.opcode == OP_JMP_TABLE) pc += insn.imm[0].u32 * 4u;
+    }
+    uint32_t funcs_len = img->section_size[VM_SECTION_FUNCS];
+    for (uint32_t off = 0; off < funcs_len; off += sizeof(vm_image_func_t)) {
+        vm_image_func_t f;
+        memcpy(&f, &img->section[VM_SECTION_FUNCS][off], sizeof(f));
+        bit_set(g_entries, f.pc);
+    }
+}
+
+/* End of the code the function at target may occupy: its FUNCS entry, else the next entry */
+static uint32_t function_end(const vm_image_t* img, uint32_t target) {
+    vm_image_func_t f;
+    if (vm_image_function_at(img, target, &f) && f.pc == target) return f.pc + f.len;
+    uint32_t end = target + 1u;
+    while (end < img->code_len && !bit_test(g_entries, end)) end++;
+    return end;
+}
+
+/* True if an exception handler covers or resumes inside [start, end); clones would escape it */
+static bool has_handler(const vm_image_t* img, uint32_t start, uint32_t end) {
+    for (uint32_t off = 0; off < img->section_size[VM_SECTION_HANDLERS]; off += sizeof(vm_handler_t)) {
+        vm_handler_t h;
+        memcpy(&h, &img->section[VM_SECTION_HANDLERS][off], sizeof(h));
+        if ((h.start < end && h.end > start) || (h.handler >= start && h.handler < end)) return true;
+    }
+    return false;
+}
+
+/* Unseeded analysis of the function at target, cached in g_funcs */
+static const spec_func_t* analyze_function(const vm_image_t* img, uint32_t target, uint32_t* func_count) {
+    for (uint32_t i = 0; i < *func_count; i++) {
+        if (g_funcs[i].target == target) return &g_funcs[i];
+    }
+    spec_func_t* fn = &g_funcs[(*func_count)++];
+    fn->target = target;
+    spec_state_t seed;
+    memset(&seed, 0, sizeof(seed));
+    seed.entry = ALL_VARS;
+    seed.flags_state = FLAGS_CALLER;
+    uint32_t end = function_end(img, target);
+    fn->ok = bit_test(g_starts, target) && !has_handler(img, target, end) && decode_function(g_code, target, end) &&
+             propagate(g_code, &seed, &fn->used);
+    return fn;
+}
+
+/* Clone for target with the arguments of site under mask, reusing an equal one */
+static uint32_t find_clone(uint32_t target, uint32_t mask, const vm_call_site_t* site, uint32_t* clone_count) {
+    for (uint32_t c = 0; c < *clone_count; c++) {
+        const spec_clone_t* clone = &g_clones[c];
+        if (clone->target != target || clone->mask != mask) continue;
+        bool same = true;
+        for (uint32_t v = 0; v < STACK_VAR_COUNT; v++) {
+            if (((mask >> v) & 1u) != 0u && !same_value(&clone->args[v], &site->args[v])) same = false;
+        }
+        if (same) return c;
+    }
+    if (*clone_count == VM_SPEC_MAX_CLONES) return NO_INDEX;
+    spec_clone_t* clone = &g_clones[*clone_count];
+    memset(clone, 0, sizeof(*clone));
+    clone->target = target;
+    clone->mask = mask;
+    for (uint32_t v = 0; v < STACK_VAR_COUNT; v++) {
+        if (((mask >> v) & 1u) != 0u) clone->args[v] = site->args[v];
+    }
+    clone->pc = NO_INDEX;
+    return (*clone_count)++;
+}
+
+vm_status_t vm_specialize(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len,
+                          vm_spec_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!vm_image_is_container(in, len)) return VM_ERR_INVALID_IMAGE;  /* No PROFILE */
+    vm_image_t img;
+    vm_status_t status = vm_image_parse(in, len, &img);
+    if (status != VM_OK) return status;
+    if ((img.flags & VM_IMAGE_FLAG_COMPACT) != 0u) return VM_ERR_INVALID_IMAGE;
+    if (img.section[VM_SECTION_EXPORTS] != NULL || img.section[VM_SECTION_IMPORTS] != NULL ||
+        img.section[VM_SECTION_RELOCS] != NULL) {
+        return VM_ERR_LINK;
+    }
+    if (img.code_len > PROGRAM_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    status = vm_image_unpack_code(&img, g_code, true);
+    if (status != VM_OK) return status;
+    uint32_t site_count;
+    status = read_profile(&img, &site_count);
+    if (status != VM_OK) return status;
+    vm_init(&g_eval);
+    scan_code(&img);
+
+    /* Group hot sites by callee and constant arguments */
+    uint32_t func_count = 0;
+    uint32_t clone_count = 0;
+    for (uint32_t s = 0; s < site_count; s++) {
+        const vm_call_site_t* site = &g_sites[s];
+        g_site_clone[s] = NO_INDEX;
+        vm_instruction_t call;
+        if (site->pc >= img.code_len || !bit_test(g_starts, site->pc) ||
+            vm_decode_instruction(g_code, img.code_len, site->pc, VM_ENCODING_WIDE, &call) != VM_OK ||
+            call.header.opcode != OP_CALL || call.imm[0].u32 != site->target) {
+            return VM_ERR_INVALID_IMAGE;  /* Profile of different code */
+        }
+        if (site->calls < VM_SPEC_HOT_CALLS || site->const_mask == 0u) continue;
+        const spec_func_t* fn = analyze_function(&img, site->target, &func_count);
+        uint32_t mask = site->const_mask & fn->used;
+        if (!fn->ok || mask == 0u) continue;
+        g_site_clone[s] = find_clone(site->target, mask, site, &clone_count);
+    }
+
+    /* FUNCS are copied to g_meta, clone entries follow; then LINES likewise */
+    uint32_t funcs_len = img.section_size[VM_SECTION_FUNCS];
+    uint32_t lines_len = img.section_size[VM_SECTION_LINES];
+    if (funcs_len + (VM_SPEC_MAX_CLONES * sizeof(vm_image_func_t)) + lines_len > sizeof(g_meta)) {
+        return VM_ERR_PROGRAM_TOO_LARGE;
+    }
+    uint8_t* funcs = g_meta;
+    if (funcs_len != 0u) memcpy(funcs, img.section[VM_SECTION_FUNCS], funcs_len);
+    uint8_t* lines = &g_meta[funcs_len + (VM_SPEC_MAX_CLONES * sizeof(vm_image_func_t))];
+    if (lines_len != 0u) memcpy(lines, img.section[VM_SECTION_LINES], lines_len);
+    uint32_t meta = (uint32_t)(lines - g_meta) + lines_len;
+
+    uint32_t code_len = img.code_len;
+    for (uint32_t c = 0; c < clone_count; c++) {
+        spec_clone_t* clone = &g_clones[c];
+        spec_state_t seed;
+        memset(&seed, 0, sizeof(seed));
+        seed.known = clone->mask;
+        seed.entry = ALL_VARS;
+        seed.flags_state = FLAGS_CALLER;
+        memcpy(seed.vars, clone->args, sizeof(seed.vars));
+        uint32_t used;
+        /* Constants only remove paths, so this cannot fail where the unseeded pass succeeded */
+        if (!decode_function(g_code, clone->target, function_end(&img, clone->target)) ||
+            !propagate(g_code, &seed, &used)) {
+            continue;
+        }
+        plan_clone();
+        uint32_t folded = 0;
+        uint32_t meta_before = meta;
+        uint32_t size = emit_clone(clone, &img, code_len, &meta, &folded);
+        if (size == 0u || folded == 0u) {
+            meta = meta_before;  /* Too big, or no better than the original */
+            continue;
+        }
+        clone->pc = code_len;
+        vm_image_func_t f;
+        if (funcs_len != 0u && vm_image_function_at(&img, clone->target, &f)) {
+            f.pc = code_len;
+            f.len = size;
+            memcpy(&funcs[funcs_len], &f, sizeof(f));
+            funcs_len += sizeof(f);
+        }
+        code_len += size;
+        stats->clones++;
+        stats->folded += folded;
+    }
+
+    /* Redirect the sites last, so clones copy the original calls */
+    for (uint32_t s = 0; s < site_count; s++) {
+        if (g_site_clone[s] == NO_INDEX || g_clones[g_site_clone[s]].pc == NO_INDEX) continue;
+        memcpy(&g_code[g_sites[s].pc + INSTRUCTION_HEADER_SIZE], &g_clones[g_site_clone[s]].pc, 4);
+        stats->sites++;
+    }
+
+    img.section[VM_SECTION_CODE] = g_code;
+    img.section_size[VM_SECTION_CODE] = code_len;
+    img.section[VM_SECTION_CODE_LZ4] = NULL;
+    img.section_size[VM_SECTION_CODE_LZ4] = 0;
+    img.code_len = code_len;
+    if (img.section[VM_SECTION_FUNCS] != NULL) {
+        img.section[VM_SECTION_FUNCS] = funcs;
+        img.section_size[VM_SECTION_FUNCS] = funcs_len;
+    }
+    if (img.section[VM_SECTION_LINES] != NULL) {
+        img.section[VM_SECTION_LINES] = lines;
+        img.section_size[VM_SECTION_LINES] = meta - (uint32_t)(lines - g_meta);
+    }
+    img.section[VM_SECTION_PROFILE] = NULL;
+    img.section_size[VM_SECTION_PROFILE] = 0;
+    img.flags |= VM_IMAGE_FLAG_VERIFIED;
+    if (stats->clones != 0u) img.flags |= VM_IMAGE_FLAG_OPTIMIZED;
+    status = vm_image_build(&img, out, cap, out_len);
+    if (status != VM_OK) return status;
+    return vm_image_verify(out, *out_len);
+}
+
+/* ============================================================================
+ * Tail Calls
+ * ============================================================================ */
+
+/* RET, or LOAD_RET s, F; STORE_RET s, F-1; RET, starting at pc */
+static bool is_tail(const uint8_t* code, uint32_t len, uint32_t pc) {
+    vm_instruction_t load, store, ret;
+    if (vm_decode_instruction(code, len, pc, VM_ENCODING_WIDE, &load) != VM_OK) return false;
+    if (load.header.opcode == OP_RET) return true;
+    if (load.header.opcode != OP_LOAD_RET || load.imm[0].u32 == 0u) return false;
+    pc += load.size;
+    if (vm_decode_instruction(code, len, pc, VM_ENCODING_WIDE, &store) != VM_OK ||
+        store.header.opcode != OP_STORE_RET || store.header.operand != load.header.operand ||
+        store.imm[0].u32 + 1u != load.imm[0].u32) {
+        return false;
+    }
+    pc += store.size;
+    return vm_decode_instruction(code, len, pc, VM_ENCODING_WIDE, &ret) == VM_OK && ret.header.opcode == OP_RET;
+}
+
+vm_status_t vm_tailcall(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len,
+                        uint32_t* count) {
+    *count = 0;
+    vm_image_t img;
+    if (vm_image_is_container(in, len)) {
+        vm_status_t status = vm_image_parse(in, len, &img);
+        if (status != VM_OK) return status;
+        if ((img.flags & VM_IMAGE_FLAG_COMPACT) != 0u) return VM_ERR_INVALID_IMAGE;
+        if (img.section[VM_SECTION_EXPORTS] != NULL || img.section[VM_SECTION_IMPORTS] != NULL ||
+            img.section[VM_SECTION_RELOCS] != NULL) {
+            return VM_ERR_LINK;
+        }
+    } else {
+        memset(&img, 0, sizeof(img));
+        img.section[VM_SECTION_CODE] = in;
+        img.section_size[VM_SECTION_CODE] = len;
+        img.code_len = len;
+    }
+    if (img.code_len > PROGRAM_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    vm_status_t status = vm_image_unpack_code(&img, g_code, true);
+    if (status != VM_OK) return status;
+    scan_code(&img);
+
+    /* Code before the first entry belongs to no function */
+    uint32_t func = NO_INDEX;
+    uint32_t pc = 0;
+    while (pc < img.code_len) {
+        vm_instruction_t insn;
+        (void)vm_decode_instruction(g_code, img.code_len, pc, VM_ENCODING_WIDE, &insn);
+        if (bit_test(g_entries, pc)) func = pc;
+        uint32_t next = pc + insn.size;
+        /* A covered CALL must keep its frame, or the callee's errors would skip the handler */
+        if (insn.header.opcode == OP_CALL && insn.imm[0].u32 == func && is_tail(g_code, img.code_len, next) &&
+            !has_handler(&img, pc, next)) {
+            g_code[pc] = OP_TAILCALL;
+            g_code[pc + 1u] = STACK_VAR_COUNT;
+            (*count)++;
+        }
+        if (insn.header.opcode == OP_JMP_TABLE) next += insn.imm[0].u32 * 4u;
+        pc = next;
+    }
+
+    img.section[VM_SECTION_CODE] = g_code;
+    img.section_size[VM_SECTION_CODE] = img.code_len;
+    img.section[VM_SECTION_CODE_LZ4] = NULL;
+    img.section_size[VM_SECTION_CODE_LZ4] = 0;
+    img.section[VM_SECTION_PROFILE] = NULL;  /* Its sites may now be TAILCALLs */
+    img.section_size[VM_SECTION_PROFILE] = 0;
+    img.flags |= VM_IMAGE_FLAG_VERIFIED;
+    if (*count != 0u) img.flags |= VM_IMAGE_FLAG_OPTIMIZED;
+    status = vm_image_build(&img, out, cap, out_len);
+    if (status != VM_OK) return status;
+    return vm_image_verify(out, *out_len);
+}
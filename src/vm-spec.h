@@ -0,0 +1,104 @@
+#pragma once
+#include "stipple.h"
+#include "vm-image.h"
+
+/*
+ * Stipple VM - Call Profiles and Function Specialization
+ * While vm.call_profile is set, every CALL records which of the callee's
+ * stack vars held the same value each time that call site ran. The profile
+ * is stored in the PROFILE section of the image. vm_specialize() then
+ * clones each function that a hot call site always calls with the same
+ * arguments. A clone starts with one TEST_CONST guard per constant argument,
+ * which falls back to the original function when the argument differs. Its
+ * body is the original with the constants propagated: operations on known
+ * values become immediate loads, decided branches become jumps or vanish,
+ * and code no longer reachable is dropped. The call site is redirected to
+ * the clone. Unlike inlining, this works for functions of any size, and
+ * the caller does not grow.
+ *
+ * vm_tailcall() is a separate pass over the same code: a function that
+ * calls itself in tail position gets a TAILCALL, so the recursion reuses
+ * one frame instead of running into STACK_DEPTH.
+ */
+
+/* ============================================================================
+ * Specialization Limits
+ * ============================================================================ */
+
+#define VM_SPEC_MAX_SITES 256u        /* Call sites a profile tracks (power of two) */
+#define VM_SPEC_MAX_CLONES 32u        /* Clones added by one vm_specialize() */
+#define VM_SPEC_MAX_INSNS 1024u       /* Larger functions are not specialized */
+#define VM_SPEC_HOT_CALLS 64u         /* Calls before a site counts as hot */
+#define VM_SPEC_PROFILE_TAG 0x4C4C4143u  /* "CALL": first word of the PROFILE section */
+
+/* ============================================================================
+ * Call Profile
+ * ============================================================================ */
+
+/* One CALL instruction */
+typedef struct {
+	uint32_t pc;                        /* CALL instruction */
+	uint32_t target;                    /* Callee entry */
+	uint32_t calls;                     /* Times it ran */
+	uint32_t const_mask;                /* Bit i: stack var i had the same type and value on every call */
+	var_value_t args[STACK_VAR_COUNT];  /* Stack vars on the first call */
+} vm_call_site_t;
+
+/* Open-addressed by pc; a site that finds the table full is not recorded */
+typedef struct vm_call_profile {
+	uint32_t site_count;
+	uint32_t dropped;                   /* Calls from sites that did not fit */
+	vm_call_site_t sites[VM_SPEC_MAX_SITES];
+} vm_call_profile_t;
+
+_Static_assert(STACK_VAR_COUNT <= 32, "const_mask needs a bit per stack var");
+
+/* Results of one vm_specialize() */
+typedef struct {
+	uint32_t clones;  /* Functions cloned */
+	uint32_t sites;   /* Call sites redirected to a clone */
+	uint32_t folded;  /* Instructions folded or removed across all clones */
+} vm_spec_stats_t;
+
+/* ============================================================================
+ * Specialization API
+ * ============================================================================ */
+
+/* Start an empty profile */
+void vm_profile_init(vm_call_profile_t* profile);
+
+/* CALL hook: the CALL at pc is entering target with the stack vars args */
+void vm_profile_call(vm_call_profile_t* profile, uint32_t pc, uint32_t target, const var_value_t* args);
+
+/*
+ * Copy a raw or container image to out with profile as its PROFILE section.
+ * Any other sections are kept; out must not overlap in.
+ */
+vm_status_t vm_profile_save(const vm_call_profile_t* profile, const uint8_t* in, uint32_t len,
+                            uint8_t* out, uint32_t cap, uint32_t* out_len);
+
+/*
+ * Clone the functions that hot sites in the PROFILE section call with
+ * constant arguments, and redirect those sites. in must be a wide container
+ * of at most PROGRAM_MAX_SIZE code bytes, possibly compressed, and not a
+ * module with EXPORTS or IMPORTS (VM_ERR_LINK): guards jump from the clone
+ * into the original function, which the linker does not allow. PROFILE is
+ * dropped; FUNCS and LINES cover the clones. Functions an exception handler
+ * covers are not cloned. With no clone worth making the code is unchanged.
+ * Uses static scratch space, so it is not reentrant.
+ */
+vm_status_t vm_specialize(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len,
+                          vm_spec_stats_t* stats);
+
+/*
+ * Replace each self call (a CALL of the enclosing function's entry) that
+ * is followed by RET, or by LOAD_RET s, F; STORE_RET s, F-1; RET, which
+ * forwards the result to this frame, with TAILCALL, unless an exception
+ * handler covers the CALL. Operand STACK_VAR_COUNT hands the callee the
+ * stack vars the CALL would have. in is a raw image or a wide container,
+ * possibly compressed, and not a module (VM_ERR_LINK). PROFILE is
+ * dropped; the rest of the image is kept. Uses static scratch space, so it
+ * is not reentrant.
+ */
+vm_status_t vm_tailcall(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t cap, uint32_t* out_len,
+                        uint32_t* count);
@@ -0,0 +1,171 @@
+/*
+ * Stipple VM - Watchpoints
+ * Writes are caught by page protection rather than by checks in the
+ * instruction handlers. The fault handler only records and unprotects;
+ * deciding whether a watched value really changed happens after the step,
+ * outside signal context.
+ */
+
+#define _GNU_SOURCE
+#include "vm-watch.h"
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* One session: the watched VM, its pages and the value snapshots */
+static struct {
+    vm_state_t* vm;
+    uint32_t count;
+    vm_watch_t watches[VM_WATCH_MAX];
+    uintptr_t page_lo[VM_WATCH_MAX];  /* Protected pages of each watch */
+    uintptr_t page_hi[VM_WATCH_MAX];
+    membuf_t snapshot[VM_WATCH_MAX];  /* A global uses the first sizeof(var_value_t) bytes */
+    struct sigaction old_action;
+    volatile sig_atomic_t faulted;    /* A watched page was written during this step */
+    volatile uint32_t fault_pc;
+    volatile uint8_t fault_opcode;
+    vm_status_t status;               /* Result of the step a VM_BREAK interrupted */
+} g_watch;
+
+/* ============================================================================
+ * Helpers
+ * ============================================================================ */
+
+static void watch_region(const vm_watch_t* w, const uint8_t** start, size_t* len) {
+    if (w->kind == VM_WATCH_GLOBAL) {
+        *start = (const uint8_t*)&g_watch.vm->g_vars[w->index];
+        *len = sizeof(var_value_t);
+    } else {
+        *start = (const uint8_t*)&g_watch.vm->g_membuf[w->index];
+        *len = sizeof(membuf_t);
+    }
+}
+
+static bool set_protection(int prot) {
+    bool ok = true;
+    for (uint32_t i = 0; i < g_watch.count; i++) {
+        if (mprotect((void*)g_watch.page_lo[i], g_watch.page_hi[i] - g_watch.page_lo[i], prot) != 0) ok = false;
+    }
+    return ok;
+}
+
+/* Bytes a value does not use (the high word of a 32-bit value) are not compared */
+static bool same_global(const var_value_t* a, const var_value_t* b) {
+    if (a->type != b->type) return false;
+    if (a->type == V_VOID) return true;
+    if (a->type == V_I64 || a->type == V_U64) return a->val.u64 == b->val.u64;
+    return a->val.u32 == b->val.u32;
+}
+
+/* First watch whose value differs from its snapshot; the snapshot is refreshed */
+static bool next_change(vm_watch_hit_t* hit) {
+    for (uint32_t i = 0; i < g_watch.count; i++) {
+        const vm_watch_t* w = &g_watch.watches[i];
+        const uint8_t* start;
+        size_t len;
+        watch_region(w, &start, &len);
+        bool same = (w->kind == VM_WATCH_GLOBAL)
+                        ? same_global((const var_value_t*)start, (const var_value_t*)&g_watch.snapshot[i])
+                        : memcmp(start, &g_watch.snapshot[i], len) == 0;
+        if (same) continue;
+        memcpy(&g_watch.snapshot[i], start, len);
+        hit->watch = i;
+        hit->pc = g_watch.fault_pc;
+        hit->opcode = g_watch.fault_opcode;
+        return true;
+    }
+    return false;
+}
+
+/* Faults outside the watched pages are not ours: fall back to the previous action and fault again */
+static void on_fault(int sig, siginfo_t* info, void* context) {
+    (void)sig;
+    (void)context;
+    const uintptr_t addr = (uintptr_t)info->si_addr;
+    bool ours = false;
+    for (uint32_t i = 0; i < g_watch.count && !ours; i++) {
+        ours = addr >= g_watch.page_lo[i] && addr < g_watch.page_hi[i];
+    }
+    if (g_watch.vm == NULL || !ours) {
+        (void)sigaction(SIGSEGV, &g_watch.old_action, NULL);
+        return;
+    }
+    /* vm.pc is only advanced once the instruction has finished */
+    const vm_state_t* vm = g_watch.vm;
+    g_watch.fault_pc = vm->pc;
+    g_watch.fault_opcode = (vm->pc < vm->program_len) ? vm->code[vm->pc] : 0u;
+    g_watch.faulted = 1;
+    (void)set_protection(PROT_READ | PROT_WRITE);
+}
+
+/* ============================================================================
+ * Watchpoint API
+ * ============================================================================ */
+
+bool vm_watch_start(vm_state_t* vm, const vm_watch_t* watches, uint32_t count) {
+    if (g_watch.vm != NULL || count > VM_WATCH_MAX) return false;
+    const long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0) return false;
+    const uintptr_t page = (uintptr_t)page_size;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t limit = (watches[i].kind == VM_WATCH_GLOBAL) ? G_VARS_COUNT : G_MEMBUF_COUNT;
+        if (watches[i].index >= limit) return false;
+    }
+
+    g_watch.vm = vm;
+    g_watch.count = count;
+    g_watch.faulted = 0;
+    g_watch.status = VM_OK;
+    for (uint32_t i = 0; i < count; i++) {
+        g_watch.watches[i] = watches[i];
+        const uint8_t* start;
+        size_t len;
+        watch_region(&watches[i], &start, &len);
+        memcpy(&g_watch.snapshot[i], start, len);
+        g_watch.page_lo[i] = (uintptr_t)start & ~(page - 1u);
+        g_watch.page_hi[i] = ((uintptr_t)start + len + page - 1u) & ~(page - 1u);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO;
+    (void)sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &g_watch.old_action) != 0) {
+        g_watch.vm = NULL;
+        g_watch.count = 0;
+        return false;
+    }
+    if (!set_protection(PROT_READ)) {
+        vm_watch_stop();
+        return false;
+    }
+    return true;
+}
+
+vm_status_t vm_watch_run(vm_state_t* vm, vm_watch_hit_t* hit) {
+    for (;;) {
+        if (g_watch.faulted != 0) {
+            /* The pages stay writable until every change of that step is reported */
+            if (next_change(hit)) return VM_BREAK;
+            g_watch.faulted = 0;
+            (void)set_protection(PROT_READ);
+        }
+        if (g_watch.status != VM_OK) break;
+        g_watch.status = vm_step(vm);
+    }
+    vm_status_t status = g_watch.status;
+    g_watch.status = VM_OK;
+    if (status == VM_BREAK) hit->watch = VM_WATCH_NONE;
+    return (status == VM_ERR_HALT) ? VM_OK : status;
+}
+
+void vm_watch_stop(void) {
+    if (g_watch.vm == NULL) return;
+    (void)set_protection(PROT_READ | PROT_WRITE);
+    (void)sigaction(SIGSEGV, &g_watch.old_action, NULL);
+    g_watch.vm = NULL;
+    g_watch.count = 0;
+    g_watch.faulted = 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "stipple.h"
+
+/*
+ * Stipple VM - Watchpoints
+ * vm_watch_run() stops when a watched global or memory buffer changes.
+ * The pages holding watched storage are made read-only with mprotect(), so
+ * the first write to one raises SIGSEGV. The handler notes the PC and
+ * opcode of the instruction being executed and makes the pages writable
+ * so it can finish. After that step the watched values are compared with
+ * a snapshot and the pages are protected again. STORE_G and the buffer
+ * writes check nothing, so instructions that do not touch those pages run
+ * as fast as under vm_run().
+ *
+ * A page also holds neighbouring storage: writes to another global or
+ * buffer on it fault too and are filtered out by the compare. With the VM
+ * aligned to VM_WATCH_ALIGN, g_vars fills exactly one page. The page of
+ * the last few buffers is shared with the stack frames, so watching them
+ * faults on most instructions: correct, but slow.
+ *
+ * Linux only. The SIGSEGV handler is process-wide, so only one VM can be
+ * watched at a time.
+ */
+
+/* ============================================================================
+ * Watchpoint Limits
+ * ============================================================================ */
+
+#define VM_WATCH_MAX 16u       /* Watchpoints per session */
+#define VM_WATCH_ALIGN 4096u   /* Give a watched vm_state_t this alignment */
+#define VM_WATCH_NONE 0xFFFFFFFFu  /* vm_watch_hit_t.watch when a BREAK stopped the run */
+
+/* ============================================================================
+ * Watchpoints
+ * ============================================================================ */
+
+typedef enum {
+	VM_WATCH_GLOBAL = 0,  /* g_vars[index]: type and value */
+	VM_WATCH_BUFFER       /* g_membuf[index]: type and contents */
+} vm_watch_kind_t;
+
+typedef struct {
+	vm_watch_kind_t kind;
+	uint32_t index;
+} vm_watch_t;
+
+/* Why vm_watch_run() returned VM_BREAK */
+typedef struct {
+	uint32_t watch;  /* Index into the list given to vm_watch_start() */
+	uint32_t pc;     /* Instruction that changed it; it has completed */
+	uint8_t opcode;
+} vm_watch_hit_t;
+
+/* ============================================================================
+ * Watchpoint API
+ * ============================================================================ */
+
+/*
+ * Snapshot the watched storage of vm and write-protect its pages. Returns
+ * false if an index is out of range, count exceeds VM_WATCH_MAX, another
+ * session is active, or the handler or protection cannot be installed.
+ */
+bool vm_watch_start(vm_state_t* vm, const vm_watch_t* watches, uint32_t count);
+
+/*
+ * Like vm_run(), but returns VM_BREAK after an instruction changed a
+ * watched value, with *hit telling which one. An instruction that changed
+ * several is reported once per watchpoint. Call again to continue. A
+ * breakpoint also returns VM_BREAK, with hit->watch VM_WATCH_NONE.
+ */
+vm_status_t vm_watch_run(vm_state_t* vm, vm_watch_hit_t* hit);
+
+/* Unprotect the pages and restore the previous SIGSEGV action */
+void vm_watch_stop(void);
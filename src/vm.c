@@ -4,9 +4,14 @@
  */
 
 #include "stipple.h"
+#include "vm-image.h"
+#include "vm-link.h"
+#include "vm-spec.h"
+#include "vm-memo.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <stdlib.h>  /* For strtoll, strtof */
 #include <stdint.h>  /* For INT32_MIN */
 #include <inttypes.h>  /* For SCNd32, SCNu32 format specifiers */
 
@@ -25,11 +30,61 @@
 #endif
 #endif
 
+/* The instruction decoders must inline into vm_step's fetch */
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define VM_ALWAYS_INLINE inline
+#endif
+
+/* Bit counting: GCC builtins map to POPCNT/TZCNT where the target has them */
+#if defined(__GNUC__) || defined(__clang__)
+#define bit_popcount32(x) ((uint32_t)__builtin_popcount(x))
+#define bit_ctz32(x) ((uint32_t)__builtin_ctz(x))
+#else
+static inline uint32_t bit_popcount32(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+    return (x * 0x01010101u) >> 24;
+}
+static inline uint32_t bit_ctz32(uint32_t x) {
+    /* Caller guarantees x != 0 */
+    uint32_t n = 0;
+    while ((x & 1u) == 0u) { x >>= 1; n++; }
+    return n;
+}
+#endif
+
 /* ============================================================================
  * Helper Functions - MISRA-C Compliant I/O (no printf/fprintf)
  * ============================================================================ */
 
-static void print_i32(int32_t value) {
+/* Longest text any print_* helper produces for one value */
+#define IO_NUMBER_MAX 32u
+
+/*
+ * In VM_IO_HOST mode a print that might not fit in out_buf yields without
+ * advancing, so the host can drain the buffer and resume.
+ */
+static bool io_out_room(const vm_io_t* io, uint32_t need) {
+    return (io->mode != VM_IO_HOST) || (VM_IO_OUTPUT_SIZE - io->out_len >= need);
+}
+
+/*
+ * Program output goes through io_putc so a VM in VM_IO_HOST mode collects
+ * it in its own buffer. Debug output (io == NULL) always goes to stdout.
+ */
+static void io_putc(vm_io_t* io, char c) {
+    if (io != NULL && io->mode == VM_IO_HOST) {
+        /* Print opcodes reserve room up front (io_out_room), so this never drops */
+        if (io->out_len < VM_IO_OUTPUT_SIZE) io->out_buf[io->out_len++] = (uint8_t)c;
+    } else {
+        (void)fputc(c, stdout);
+    }
+}
+
+static void print_i32(vm_io_t* io, int32_t value) {
     char buf[12];  /* Enough for -2147483648 + null */
     int i = 0;
     bool negative = false;
@@ -48,7 +103,7 @@ static void print_i32(int32_t value) {
     }
     
     if (uval == 0u) {
-        (void)fputc('0', stdout);
+        io_putc(io, '0');
         return;
     }
     
@@ -59,21 +114,42 @@ static void print_i32(int32_t value) {
     }
     
     if (negative) {
-        (void)fputc('-', stdout);
+        io_putc(io, '-');
     }
     
     while (i > 0) {
         i--;
-        (void)fputc(buf[i], stdout);
+        io_putc(io, buf[i]);
     }
 }
 
-static void print_u32(uint32_t value) {
+static void print_u32(vm_io_t* io, uint32_t value) {
     char buf[12];
     int i = 0;
     
     if (value == 0u) {
-        (void)fputc('0', stdout);
+        io_putc(io, '0');
+        return;
+    }
+    
+    while (value > 0u) {
+        buf[i] = (char)('0' + (value % 10u));
+        value /= 10u;
+        i++;
+    }
+    
+    while (i > 0) {
+        i--;
+        io_putc(io, buf[i]);
+    }
+}
+
+static void print_u64(vm_io_t* io, uint64_t value) {
+    char buf[21];  /* Enough for 18446744073709551615 + null */
+    int i = 0;
+    
+    if (value == 0u) {
+        io_putc(io, '0');
         return;
     }
     
@@ -85,11 +161,21 @@ static void print_u32(uint32_t value) {
     
     while (i > 0) {
         i--;
-        (void)fputc(buf[i], stdout);
+        io_putc(io, buf[i]);
+    }
+}
+
+static void print_i64(vm_io_t* io, int64_t value) {
+    if (value < 0) {
+        io_putc(io, '-');
+        /* Negate in unsigned arithmetic so INT64_MIN is well defined */
+        print_u64(io, 0u - (uint64_t)value);
+    } else {
+        print_u64(io, (uint64_t)value);
     }
 }
 
-static void print_f32(float value) {
+static void print_f32(vm_io_t* io, float value) {
     /* Simple float printing - integer part, dot, 6 decimal places */
     int32_t int_part;
     float frac_part;
@@ -97,32 +183,31 @@ static void print_f32(float value) {
     int i;
     
     if (value < 0.0f) {
-        (void)fputc('-', stdout);
+        io_putc(io, '-');
         value = -value;
     }
     
     int_part = (int32_t)value;
     frac_part = value - (float)int_part;
     
-    print_i32(int_part);
-    (void)fputc('.', stdout);
+    print_i32(io, int_part);
+    io_putc(io, '.');
     
     /* Print 6 decimal places */
     frac_val = (uint32_t)(frac_part * 1000000.0f);
     for (i = 0; i < 6; i++) {
-        (void)fputc((char)('0' + (frac_val / 100000u)), stdout);
+        io_putc(io, (char)('0' + (frac_val / 100000u)));
         frac_val = (frac_val % 100000u) * 10u;
     }
 }
 
-static void print_hex16(uint16_t value) {
+static void print_hex32(uint32_t value) {
     const char hex[] = "0123456789ABCDEF";
     (void)fputc('0', stdout);
     (void)fputc('x', stdout);
-    (void)fputc(hex[(value >> 12) & 0xFu], stdout);
-    (void)fputc(hex[(value >> 8) & 0xFu], stdout);
-    (void)fputc(hex[(value >> 4) & 0xFu], stdout);
-    (void)fputc(hex[value & 0xFu], stdout);
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        (void)fputc(hex[(value >> shift) & 0xFu], stdout);
+    }
 }
 
 static void print_hex8(uint8_t value) {
@@ -139,13 +224,15 @@ static void print_hex8(uint8_t value) {
 
 const char* var_type_to_string(var_value_type_t type) {
     const char* types[] = {"void", "i32", "u32", "float", "u8x4", "u16x2", 
-                           "unicode", "global_ref", "stack_ref", "buffer_ref", "buffer_pos"};
-    return (type <= V_BUF_POS) ? types[type] : "unknown";
+                           "unicode", "global_ref", "stack_ref", "buffer_ref", "buffer_pos",
+                           "i64", "u64"};
+    return (type <= V_U64) ? types[type] : "unknown";
 }
 
 const char* buffer_type_to_string(membuf_type_t type) {
-    const char* types[] = {"void", "u8[256]", "u16[128]", "i32[64]", "u32[64]", "float[64]"};
-    return (type <= MB_FLOAT) ? types[type] : "unknown";
+    const char* types[] = {"void", "u8[256]", "u16[128]", "i32[64]", "u32[64]", "float[64]", "bit[2048]",
+                           "i64[32]"};
+    return (type <= MB_I64) ? types[type] : "unknown";
 }
 
 const char* opcode_to_string(opcode_t opcode) {
@@ -154,9 +241,12 @@ const char* opcode_to_string(opcode_t opcode) {
         [OP_NOP] = "nop", [OP_HALT] = "halt", [OP_JMP] = "jmp", [OP_JZ] = "jz",
         [OP_JNZ] = "jnz", [OP_JLT] = "jlt", [OP_JGT] = "jgt", [OP_JLE] = "jle",
         [OP_JGE] = "jge", [OP_CALL] = "call", [OP_RET] = "ret",
+        [OP_JMP_TABLE] = "jmp.table", [OP_CALL_HOST] = "call.host", [OP_YIELD] = "yield",
+        [OP_TAILCALL] = "tailcall", [OP_CALL_MEMO] = "call.memo",
         [OP_LOAD_G] = "load.g", [OP_LOAD_L] = "load.l", [OP_LOAD_S] = "load.s",
         [OP_LOAD_I_I32] = "load.i32", [OP_LOAD_I_U32] = "load.u32",
         [OP_LOAD_I_F32] = "load.f32", [OP_LOAD_RET] = "load.ret",
+        [OP_LOAD_I_I64] = "load.i64", [OP_LOAD_I_U64] = "load.u64",
         [OP_STORE_G] = "store.g", [OP_STORE_L] = "store.l",
         [OP_STORE_S] = "store.s", [OP_STORE_RET] = "store.ret",
         [OP_ADD_I32] = "add.i32", [OP_SUB_I32] = "sub.i32",
@@ -167,15 +257,30 @@ const char* opcode_to_string(opcode_t opcode) {
         [OP_ADD_F32] = "add.f32", [OP_SUB_F32] = "sub.f32",
         [OP_MUL_F32] = "mul.f32", [OP_DIV_F32] = "div.f32",
         [OP_NEG_F32] = "neg.f32", [OP_ABS_F32] = "abs.f32", [OP_SQRT_F32] = "sqrt.f32",
+        [OP_EXP_F32] = "exp.f32", [OP_LOG_F32] = "log.f32",
+        [OP_SIN_F32] = "sin.f32", [OP_COS_F32] = "cos.f32",
+        [OP_POW_F32] = "pow.f32", [OP_FLOOR_F32] = "floor.f32",
+        [OP_FMA_F32] = "fma.f32", [OP_VMAP_F32] = "vmap.f32", [OP_VFMA_F32] = "vfma.f32",
         [OP_AND_U32] = "and.u32", [OP_OR_U32] = "or.u32",
         [OP_XOR_U32] = "xor.u32", [OP_NOT_U32] = "not.u32",
         [OP_SHL_U32] = "shl.u32", [OP_SHR_U32] = "shr.u32",
         [OP_CMP_I32] = "cmp.i32", [OP_CMP_U32] = "cmp.u32", [OP_CMP_F32] = "cmp.f32",
+        [OP_CMP_I64] = "cmp.i64", [OP_CMP_U64] = "cmp.u64",
+        [OP_SELECT] = "select", [OP_CMOV] = "cmov", [OP_TEST_CONST] = "test.const",
         [OP_I32_TO_U32] = "i32.to.u32", [OP_U32_TO_I32] = "u32.to.i32",
         [OP_I32_TO_F32] = "i32.to.f32", [OP_U32_TO_F32] = "u32.to.f32",
         [OP_F32_TO_I32] = "f32.to.i32", [OP_F32_TO_U32] = "f32.to.u32",
+        [OP_I32_TO_I64] = "i32.to.i64", [OP_I64_TO_I32] = "i64.to.i32",
+        [OP_U32_TO_U64] = "u32.to.u64", [OP_U64_TO_U32] = "u64.to.u32",
+        [OP_I64_TO_U64] = "i64.to.u64", [OP_U64_TO_I64] = "u64.to.i64",
+        [OP_I64_TO_F32] = "i64.to.f32", [OP_F32_TO_I64] = "f32.to.i64",
         [OP_BUF_READ] = "buf.read", [OP_BUF_WRITE] = "buf.write",
-        [OP_BUF_LEN] = "buf.len", [OP_BUF_CLEAR] = "buf.clear",
+        [OP_BUF_LEN] = "buf.len", [OP_BUF_CLEAR] = "buf.clear", [OP_BUF_INIT] = "buf.init",
+        [OP_BIT_GET] = "bit.get", [OP_BIT_SET] = "bit.set", [OP_BIT_CLR] = "bit.clr",
+        [OP_BIT_TGL] = "bit.tgl", [OP_BIT_CNT] = "bit.cnt",
+        [OP_BIT_FFS] = "bit.ffs", [OP_BIT_FFC] = "bit.ffc",
+        [OP_BIT_AND] = "bit.and", [OP_BIT_OR] = "bit.or",
+        [OP_BIT_XOR] = "bit.xor", [OP_BIT_ANDN] = "bit.andn",
         [OP_STR_CAT] = "str.cat", [OP_STR_COPY] = "str.copy",
         [OP_STR_LEN] = "str.len", [OP_STR_CMP] = "str.cmp",
         [OP_STR_CHR] = "str.chr", [OP_STR_SET_CHR] = "str.set_chr",
@@ -183,7 +288,31 @@ const char* opcode_to_string(opcode_t opcode) {
         [OP_PRINT_F32] = "print.f32", [OP_PRINT_STR] = "print.str",
         [OP_PRINTLN] = "println",
         [OP_READ_I32] = "read.i32", [OP_READ_U32] = "read.u32",
-        [OP_READ_F32] = "read.f32", [OP_READ_STR] = "read.str"
+        [OP_READ_F32] = "read.f32", [OP_READ_STR] = "read.str",
+        [OP_PRINT_I64] = "print.i64", [OP_PRINT_U64] = "print.u64",
+        [OP_ADD_I64] = "add.i64", [OP_SUB_I64] = "sub.i64",
+        [OP_MUL_I64] = "mul.i64", [OP_DIV_I64] = "div.i64",
+        [OP_MOD_I64] = "mod.i64", [OP_NEG_I64] = "neg.i64",
+        [OP_ADD_U64] = "add.u64", [OP_SUB_U64] = "sub.u64",
+        [OP_MUL_U64] = "mul.u64", [OP_DIV_U64] = "div.u64", [OP_MOD_U64] = "mod.u64",
+        [OP_ADD_PK] = "add.pk", [OP_ADDS_PK] = "adds.pk",
+        [OP_SUB_PK] = "sub.pk", [OP_SUBS_PK] = "subs.pk",
+        [OP_MIN_PK] = "min.pk", [OP_MAX_PK] = "max.pk",
+        [OP_CMPEQ_PK] = "cmpeq.pk", [OP_CMPGT_PK] = "cmpgt.pk",
+        [OP_SHUF_PK] = "shuf.pk", [OP_U32_TO_PK] = "u32.to.pk",
+        [OP_PK_TO_U32] = "pk.to.u32",
+        [OP_BUF_READ_PK] = "buf.read.pk", [OP_BUF_WRITE_PK] = "buf.write.pk",
+        [OP_ADD_WRAP_I32] = "add.wrap.i32", [OP_SUB_WRAP_I32] = "sub.wrap.i32",
+        [OP_MUL_WRAP_I32] = "mul.wrap.i32", [OP_ADD_WRAP_U32] = "add.wrap.u32",
+        [OP_SUB_WRAP_U32] = "sub.wrap.u32", [OP_MUL_WRAP_U32] = "mul.wrap.u32",
+        [OP_ADD_SAT_I32] = "add.sat.i32", [OP_SUB_SAT_I32] = "sub.sat.i32",
+        [OP_MUL_SAT_I32] = "mul.sat.i32", [OP_ADD_SAT_U32] = "add.sat.u32",
+        [OP_SUB_SAT_U32] = "sub.sat.u32", [OP_MUL_SAT_U32] = "mul.sat.u32",
+        [OP_MUL_FX] = "mul.fx", [OP_DIV_FX] = "div.fx", [OP_I32_TO_FX] = "i32.to.fx",
+        [OP_FX_TO_I32] = "fx.to.i32", [OP_F32_TO_FX] = "f32.to.fx", [OP_FX_TO_F32] = "fx.to.f32",
+        [OP_VMUL_FX] = "vmul.fx", [OP_VDIV_FX] = "vdiv.fx",
+        [OP_VF32_TO_FX] = "vf32.to.fx", [OP_VFX_TO_F32] = "vfx.to.f32",
+        [OP_BREAK] = "break"
     };
     return ops[opcode] ? ops[opcode] : "unknown";
 }
@@ -198,9 +327,13 @@ const char* vm_get_error_string(vm_status_t status) {
         [VM_ERR_INVALID_BUFFER_IDX] = "Invalid buffer index", [VM_ERR_INVALID_BUFFER_POS] = "Invalid buffer position",
         [VM_ERR_INVALID_PC] = "Invalid program counter", [VM_ERR_INVALID_INSTRUCTION] = "Invalid instruction",
         [VM_ERR_PROGRAM_TOO_LARGE] = "Program too large", [VM_ERR_OVERFLOW] = "Arithmetic overflow",
-        [VM_ERR_HALT] = "Program halted"
+        [VM_ERR_HALT] = "Program halted",
+        [VM_ERR_INVALID_HOST_FN] = "Invalid host function", [VM_ERR_INVALID_IMAGE] = "Invalid program image",
+        [VM_ERR_LINK] = "Link error",
+        [VM_YIELD] = "Yielded to host",
+        [VM_BREAK] = "Stopped at breakpoint or watchpoint"
     };
-    return (status <= VM_ERR_HALT) ? errors[status] : "Unknown error";
+    return ((uint32_t)status < sizeof(errors) / sizeof(errors[0])) ? errors[status] : "Unknown error";
 }
 
 bool validate_global_idx(index_t idx) { return idx < G_VARS_COUNT; }
@@ -211,6 +344,68 @@ bool validate_buffer_pos(membuf_type_t type, pos_t pos) {
     return pos < get_buffer_capacity(type);
 }
 
+/*
+ * SWAR (SIMD within a register) helpers for the packed V_U8/V_U16 types.
+ * hi has the top bit of every lane set (0x80808080 or 0x80008000) and
+ * bits is the lane width. Lane 0 is the least significant lane.
+ */
+static inline uint32_t swar_add(uint32_t a, uint32_t b, uint32_t hi) {
+    return ((a & ~hi) + (b & ~hi)) ^ ((a ^ b) & hi);
+}
+
+static inline uint32_t swar_sub(uint32_t a, uint32_t b, uint32_t hi) {
+    return ((a | hi) - (b & ~hi)) ^ ((a ^ ~b) & hi);
+}
+
+/* Top bit of each lane where a + b carried out of the lane */
+static inline uint32_t swar_carry(uint32_t a, uint32_t b, uint32_t sum, uint32_t hi) {
+    return ((a & b) | ((a | b) & ~sum)) & hi;
+}
+
+/* Top bit of each lane where a - b borrowed, i.e. a < b */
+static inline uint32_t swar_borrow(uint32_t a, uint32_t b, uint32_t diff, uint32_t hi) {
+    return ((~a & b) | ((~a | b) & diff)) & hi;
+}
+
+/* Widen per-lane top bits into all-ones lanes */
+static inline uint32_t swar_spread(uint32_t msbs, uint32_t bits) {
+    return (msbs >> (bits - 1u)) * ((1u << bits) - 1u);
+}
+
+/* All-ones lanes where a > b (unsigned) */
+static inline uint32_t swar_cmpgt(uint32_t a, uint32_t b, uint32_t hi, uint32_t bits) {
+    return swar_spread(swar_borrow(b, a, swar_sub(b, a, hi), hi), bits);
+}
+
+/* All-ones lanes where a == b */
+static inline uint32_t swar_cmpeq(uint32_t a, uint32_t b, uint32_t hi, uint32_t bits) {
+    uint32_t x = a ^ b;
+    uint32_t nonzero = (((x & ~hi) + ~hi) | x) & hi;
+    return swar_spread(nonzero ^ hi, bits);
+}
+
+/* Portable lane <-> u32 conversion, independent of host byte order */
+static inline uint32_t packed_to_u32(const var_value_t* v) {
+    if (v->type == V_U8) {
+        return (uint32_t)v->val.u8x4[0] | ((uint32_t)v->val.u8x4[1] << 8) |
+               ((uint32_t)v->val.u8x4[2] << 16) | ((uint32_t)v->val.u8x4[3] << 24);
+    }
+    return (uint32_t)v->val.u16x2[0] | ((uint32_t)v->val.u16x2[1] << 16);
+}
+
+static inline void u32_to_packed(var_value_t* v, var_value_type_t type, uint32_t bits) {
+    v->type = type;
+    if (type == V_U8) {
+        v->val.u8x4[0] = (uint8_t)bits;
+        v->val.u8x4[1] = (uint8_t)(bits >> 8);
+        v->val.u8x4[2] = (uint8_t)(bits >> 16);
+        v->val.u8x4[3] = (uint8_t)(bits >> 24);
+    } else {
+        v->val.u16x2[0] = (uint16_t)bits;
+        v->val.u16x2[1] = (uint16_t)(bits >> 16);
+    }
+}
+
 /* Helper function to validate float results */
 static inline bool is_valid_float(float value) {
     /* Accept normal numbers, zero, and negative zero */
@@ -229,8 +424,75 @@ static inline bool is_valid_float(float value) {
         } \
     } while (0)
 
+/*
+ * Apply a unary float opcode to the first n elements. Each case is a
+ * separate counted loop so the compiler can vectorize it; validity is
+ * accumulated without branching and checked once at the end.
+ */
+static vm_status_t map_f32(uint32_t op, const float* src, float* dst, uint32_t n) {
+    uint32_t i;
+    switch (op) {
+        case OP_NEG_F32:   for (i = 0; i < n; i++) dst[i] = -src[i]; break;
+        case OP_ABS_F32:   for (i = 0; i < n; i++) dst[i] = fabsf(src[i]); break;
+        case OP_SQRT_F32:  for (i = 0; i < n; i++) dst[i] = sqrtf(src[i]); break;
+        case OP_EXP_F32:   for (i = 0; i < n; i++) dst[i] = expf(src[i]); break;
+        case OP_LOG_F32:   for (i = 0; i < n; i++) dst[i] = logf(src[i]); break;
+        case OP_SIN_F32:   for (i = 0; i < n; i++) dst[i] = sinf(src[i]); break;
+        case OP_COS_F32:   for (i = 0; i < n; i++) dst[i] = cosf(src[i]); break;
+        case OP_FLOOR_F32: for (i = 0; i < n; i++) dst[i] = floorf(src[i]); break;
+        default:
+            return VM_ERR_INVALID_INSTRUCTION;
+    }
+    bool valid = true;
+    for (i = 0; i < n; i++) {
+        valid &= is_valid_float(dst[i]);
+    }
+    return valid ? VM_OK : VM_ERR_OVERFLOW;
+}
+
+/*
+ * Divide n by d (d != 0) rounding as selected by mode. Used for both the
+ * Q16.16 multiply (d = FX_ONE) and divide. The caller range-checks the
+ * 64-bit quotient against int32_t.
+ */
+static inline int64_t fx_div_round(int64_t n, int64_t d, uint32_t mode) {
+    int64_t q = n / d;
+    int64_t r = n % d;
+    if (r != 0) {
+        /* r carries the sign of n, so this tests for a negative true quotient */
+        bool neg = (r < 0) != (d < 0);
+        if (mode == FX_ROUND_FLOOR) {
+            if (neg) q--;
+        } else if (mode == FX_ROUND_NEAREST) {
+            int64_t ar = (r < 0) ? -r : r;
+            int64_t ad = (d < 0) ? -d : d;
+            if (2 * ar >= ad) q += neg ? -1 : 1;
+        }
+    }
+    return q;
+}
+
+static inline bool fx_in_range(int64_t v) {
+    return (v >= INT32_MIN) && (v <= INT32_MAX);
+}
+
+/* Convert a float to Q16.16; the scaled value is exact in double */
+static vm_status_t f32_to_fx(float f, uint32_t mode, int32_t* out) {
+    double x = (double)f * (double)FX_ONE;
+    if (mode == FX_ROUND_NEAREST) x = round(x);
+    else if (mode == FX_ROUND_FLOOR) x = floor(x);
+    else x = trunc(x);
+    /* Negated form also rejects NaN */
+    if (!(x >= -2147483648.0 && x <= 2147483647.0)) return VM_ERR_OVERFLOW;
+    *out = (int32_t)x;
+    return VM_OK;
+}
+
 void vm_init(vm_state_t* vm) {
     memset(vm, 0, sizeof(*vm));
+    vm->code = vm->program;
+    vm->patch = vm->program;
+    vm->break_starts = vm->break_starts_buf;
     for (uint32_t i = 0; i < G_VARS_COUNT; i++) vm->g_vars[i].type = V_VOID;
     for (uint32_t i = 0; i < G_MEMBUF_COUNT; i++) vm->g_membuf[i].type = MB_VOID;
     for (uint32_t i = 0; i < STACK_DEPTH; i++) {
@@ -244,55 +506,446 @@ void vm_init(vm_state_t* vm) {
 
 void vm_reset(vm_state_t* vm) { vm_init(vm); }
 
+/* ============================================================================
+ * Instruction Decoding
+ * ============================================================================ */
+
+static VM_ALWAYS_INLINE vm_status_t decode_wide(const uint8_t* code, uint32_t len, uint32_t pc,
+                                      vm_instruction_t* insn) {
+    if (pc >= len) return VM_ERR_INVALID_PC;
+    if (len - pc < INSTRUCTION_HEADER_SIZE) return VM_ERR_INVALID_INSTRUCTION;
+    memcpy(&insn->header, &code[pc], INSTRUCTION_HEADER_SIZE);
+    uint32_t payload_len = INSTR_PAYLOAD_LEN(insn->header);
+    if (payload_len > INSTRUCTION_MAX_PAYLOAD_WORDS) return VM_ERR_INVALID_INSTRUCTION;
+    insn->size = get_instruction_size((uint8_t)payload_len);
+    if (len - pc < insn->size) return VM_ERR_INVALID_INSTRUCTION;
+    insn->imm[0].u32 = 0;
+    insn->imm[1].u32 = 0;
+    insn->imm[2].u32 = 0;
+    if (payload_len >= 1u) memcpy(&insn->imm[0], &code[pc + 4u], 4);
+    if (payload_len >= 2u) memcpy(&insn->imm[1], &code[pc + 8u], 4);
+    if (payload_len >= 3u) memcpy(&insn->imm[2], &code[pc + 12u], 4);
+    return VM_OK;
+}
+
+/* Zero-extended immediate of form width code w (1, 2 or 3) at p */
+static VM_ALWAYS_INLINE uint32_t compact_imm(const uint8_t* p, uint32_t w) {
+    if (w == 1u) return p[0];
+    if (w == 2u) {
+        uint16_t v;
+        memcpy(&v, p, 2);
+        return v;
+    }
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static VM_ALWAYS_INLINE vm_status_t decode_compact(const uint8_t* code, uint32_t len, uint32_t pc,
+                                         vm_instruction_t* insn) {
+    /* Bytes per form width code */
+    static const uint8_t widths[4] = { 0u, 1u, 2u, 4u };
+    if (pc >= len) return VM_ERR_INVALID_PC;
+    if (len - pc < COMPACT_HEADER_SIZE) return VM_ERR_INVALID_INSTRUCTION;
+    const uint8_t* p = &code[pc];
+    uint32_t form = p[2];
+    uint32_t w1 = COMPACT_FORM_WIDTH(form, 0u);
+    uint32_t w2 = COMPACT_FORM_WIDTH(form, 1u);
+    uint32_t w3 = COMPACT_FORM_WIDTH(form, 2u);
+    bool nibbles = (form & COMPACT_FORM_NIBBLES) != 0u;
+    
+    /* Size everything first so the reads below need no further checks */
+    uint32_t count, size;
+    if (nibbles) {
+        if (w1 != 0u || w2 != 0u) return VM_ERR_INVALID_INSTRUCTION;
+        count = (w3 != 0u) ? 3u : 2u;
+        size = COMPACT_HEADER_SIZE + 1u + widths[w3];
+    } else {
+        /* Widths must be contiguous: no imm2 without imm1, no imm3 without imm2 */
+        if ((w1 == 0u && w2 != 0u) || (w2 == 0u && w3 != 0u)) return VM_ERR_INVALID_INSTRUCTION;
+        count = (w1 != 0u) + (w2 != 0u) + (w3 != 0u);
+        size = COMPACT_HEADER_SIZE + widths[w1] + widths[w2] + widths[w3];
+    }
+    if ((form & COMPACT_FORM_RESERVED) != 0u || len - pc < size) return VM_ERR_INVALID_INSTRUCTION;
+    
+    insn->header.opcode = p[0];
+    insn->header.operand = p[1];
+    insn->header.flags = (uint8_t)count;  /* Payload length field; no immediate types */
+    insn->header.types = 0;
+    insn->size = size;
+    uint32_t n = COMPACT_HEADER_SIZE;
+    if (nibbles) {
+        insn->imm[0].u32 = p[n] & 0x0Fu;
+        insn->imm[1].u32 = (uint32_t)p[n] >> 4;
+        n++;
+    } else {
+        insn->imm[0].u32 = (w1 != 0u) ? compact_imm(&p[n], w1) : 0u;
+        n += widths[w1];
+        insn->imm[1].u32 = (w2 != 0u) ? compact_imm(&p[n], w2) : 0u;
+        n += widths[w2];
+    }
+    insn->imm[2].u32 = (w3 != 0u) ? compact_imm(&p[n], w3) : 0u;
+    return VM_OK;
+}
+
+vm_status_t vm_decode_instruction(const uint8_t* code, uint32_t len, uint32_t pc,
+                                  vm_encoding_t encoding, vm_instruction_t* insn) {
+    return (encoding == VM_ENCODING_COMPACT) ? decode_compact(code, len, pc, insn)
+                                             : decode_wide(code, len, pc, insn);
+}
+
+/*
+ * Walk the program instruction by instruction, checking that every header
+ * decodes, every payload fits, and every statically known jump target
+ * (JMP/Jcc/CALL immediates, JMP_TABLE entries and defaults) lies inside
+ * the program. Opcode validity is still left to execution time. Container
+ * images are checked by vm_image_verify(), which comes back here for CODE.
+ */
+vm_status_t vm_verify_program(const uint8_t* program, uint32_t len) {
+    if (vm_image_is_container(program, len)) return vm_image_verify(program, len);
+    if (len > PROGRAM_MAP_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    return vm_verify_code(program, len, VM_ENCODING_WIDE);
+}
+
+vm_status_t vm_verify_code(const uint8_t* code, uint32_t len, vm_encoding_t encoding) {
+    uint32_t pc = 0;
+    return vm_verify_code_prefix(code, len, len, encoding, &pc);
+}
+
+vm_status_t vm_verify_code_prefix(const uint8_t* code, uint32_t avail, uint32_t len,
+                                  vm_encoding_t encoding, uint32_t* next) {
+    /* Before the end, an instruction that does not decode may just be incomplete */
+    const bool partial = avail < len;
+    uint32_t pc = *next;
+    while (pc < avail) {
+        *next = pc;
+        vm_instruction_t insn;
+        vm_status_t status = vm_decode_instruction(code, avail, pc, encoding, &insn);
+        if (status != VM_OK) return partial ? VM_OK : status;
+        uint32_t size = insn.size;
+        uint32_t imm1 = insn.imm[0].u32;
+        
+        switch (insn.header.opcode) {
+            case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JLT:
+            case OP_JGT: case OP_JLE: case OP_JGE: case OP_CALL: case OP_CALL_MEMO: case OP_TAILCALL:
+                if (imm1 >= len) return VM_ERR_INVALID_PC;
+                break;
+            case OP_JMP_TABLE: {
+                if (INSTR_PAYLOAD_LEN(insn.header) != 2u) return VM_ERR_INVALID_INSTRUCTION;
+                if (insn.imm[1].u32 >= len) return VM_ERR_INVALID_PC;
+                /* imm1 is the entry count; the table follows the instruction */
+                if (imm1 > (avail - pc - size) / 4u) return partial ? VM_OK : VM_ERR_INVALID_INSTRUCTION;
+                for (uint32_t i = 0; i < imm1; i++) {
+                    uint32_t target;
+                    memcpy(&target, &code[pc + size + (i * 4u)], 4);
+                    if (target >= len) return VM_ERR_INVALID_PC;
+                }
+                size += imm1 * 4u;
+                break;
+            }
+            default:
+                break;
+        }
+        pc += size;
+    }
+    *next = pc;
+    return VM_OK;
+}
+
+vm_status_t vm_register_host_fn(vm_state_t* vm, uint32_t idx, vm_host_fn_t fn, void* ctx) {
+    if (idx >= HOST_FN_COUNT) return VM_ERR_INVALID_HOST_FN;
+    vm->host_fns[idx] = fn;
+    vm->host_ctx[idx] = fn ? ctx : NULL;
+    return VM_OK;
+}
+
+void vm_set_io_mode(vm_state_t* vm, vm_io_mode_t mode) {
+    memset(&vm->io, 0, sizeof(vm->io));
+    vm->io.mode = mode;
+}
+
+uint32_t vm_feed_input(vm_state_t* vm, const uint8_t* data, uint32_t len) {
+    vm_io_t* io = &vm->io;
+    if (io->in_closed) return 0;
+    if (io->in_head > 0u) {
+        memmove(io->in_buf, &io->in_buf[io->in_head], io->in_len - io->in_head);
+        io->in_len -= io->in_head;
+        io->in_head = 0;
+    }
+    uint32_t space = VM_IO_INPUT_SIZE - io->in_len;
+    if (len > space) len = space;
+    memcpy(&io->in_buf[io->in_len], data, len);
+    io->in_len += len;
+    return len;
+}
+
+void vm_close_input(vm_state_t* vm) { vm->io.in_closed = true; }
+
+const uint8_t* vm_pending_output(const vm_state_t* vm, uint32_t* len) {
+    *len = vm->io.out_len;
+    return vm->io.out_buf;
+}
+
+void vm_consume_output(vm_state_t* vm, uint32_t n) {
+    vm_io_t* io = &vm->io;
+    if (n > io->out_len) n = io->out_len;
+    memmove(io->out_buf, &io->out_buf[n], io->out_len - n);
+    io->out_len -= n;
+}
+
+/*
+ * Consume pending input up to and including a newline after a failed or
+ * truncated read. Returns false while the newline has not arrived yet.
+ */
+static bool io_drain_discard(vm_io_t* io) {
+    while (io->in_discard && io->in_head < io->in_len) {
+        if (io->in_buf[io->in_head++] == '\n') io->in_discard = false;
+    }
+    if (io->in_closed) io->in_discard = false;
+    return !io->in_discard;
+}
+
+static bool io_is_space(uint8_t c) {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\v') || (c == '\f');
+}
+
+/*
+ * Host-mode counterpart of the scanf-based number reads: skip whitespace,
+ * take the longest run of number characters and convert it. Stricter than
+ * scanf: the whole token must convert and fit the type. The token only
+ * counts as complete once a delimiter or EOF follows it, otherwise VM_YIELD.
+ * A malformed token yields 0 and discards the rest of the line, as in
+ * VM_IO_STDIO mode. A token too long for tok is malformed at once: waiting
+ * for its end could fill in_buf and stall the VM.
+ */
+static vm_status_t io_read_number(vm_io_t* io, var_value_type_t type, var_value_t* dest) {
+    char tok[32];
+    if (!io_drain_discard(io)) return VM_YIELD;
+    while (io->in_head < io->in_len && io_is_space(io->in_buf[io->in_head])) io->in_head++;
+    
+    uint32_t end = io->in_head;
+    while (end < io->in_len) {
+        uint8_t c = io->in_buf[end];
+        bool num = ((c >= '0') && (c <= '9')) || (c == '+') || (c == '-') ||
+                   ((type == V_FLOAT) && ((c == '.') || (c == 'e') || (c == 'E')));
+        if (!num) break;
+        end++;
+    }
+    uint32_t n = end - io->in_head;
+    if (end == io->in_len && !io->in_closed && n < sizeof(tok)) return VM_YIELD;
+    
+    bool ok = (n > 0u) && (n < sizeof(tok));
+    dest->type = type;
+    dest->val.u64 = 0;
+    if (ok) {
+        memcpy(tok, &io->in_buf[io->in_head], n);
+        tok[n] = '\0';
+        io->in_head = end;
+        char* tail;
+        if (type == V_FLOAT) {
+            float v = strtof(tok, &tail);
+            ok = (*tail == '\0');
+            if (ok) dest->val.f32 = v;
+        } else {
+            long long v = strtoll(tok, &tail, 10);
+            if (type == V_I32) {
+                ok = (*tail == '\0') && (v >= INT32_MIN) && (v <= INT32_MAX);
+                if (ok) dest->val.i32 = (int32_t)v;
+            } else {
+                ok = (*tail == '\0') && (v >= 0) && (v <= (long long)UINT32_MAX);
+                if (ok) dest->val.u32 = (uint32_t)v;
+            }
+        }
+    }
+    if (!ok) {
+        dest->val.u64 = 0;
+        io->in_discard = true;
+        (void)io_drain_discard(io);
+    }
+    return VM_OK;
+}
+
+/* Host-mode READ_STR: one line of up to MEMBUF_U8_COUNT - 1 bytes */
+static vm_status_t io_read_line(vm_io_t* io, membuf_t* buf) {
+    if (!io_drain_discard(io)) return VM_YIELD;
+    uint32_t avail = io->in_len - io->in_head;
+    const uint8_t* src = &io->in_buf[io->in_head];
+    const uint8_t* nl = memchr(src, '\n', (avail < MEMBUF_U8_COUNT) ? avail : MEMBUF_U8_COUNT);
+    uint32_t n;
+    if (nl) {
+        n = (uint32_t)(nl - src);
+    } else if (avail >= MEMBUF_U8_COUNT - 1) {
+        /* Line longer than the buffer: keep the head, drop the rest */
+        n = MEMBUF_U8_COUNT - 1;
+    } else if (io->in_closed) {
+        n = avail;
+    } else {
+        return VM_YIELD;
+    }
+    buf->type = MB_U8;
+    memcpy(buf->buf.u8x256, src, n);
+    buf->buf.u8x256[n] = 0;
+    io->in_head += nl ? (n + 1u) : n;
+    if (!nl) {
+        io->in_discard = true;
+        (void)io_drain_discard(io);
+    }
+    return VM_OK;
+}
+
 vm_status_t vm_load_program(vm_state_t* vm, const uint8_t* program, uint32_t len) {
-    if (len > PROGRAM_MAX_SIZE) {
-        vm->last_error = VM_ERR_PROGRAM_TOO_LARGE;
-        return VM_ERR_PROGRAM_TOO_LARGE;
+    /* One pass over the code, even when it has to be unpacked first */
+    if (vm_image_is_container(program, len)) return vm_image_load(vm, program, len, false);
+    vm_status_t status = vm_verify_program(program, len);
+    if (status != VM_OK) {
+        vm->last_error = status;
+        return status;
     }
-    memcpy(vm->program, program, len);
+    return vm_load_verified_program(vm, program, len);
+}
+
+/* Make code the running program; the caller has checked its size */
+static vm_status_t set_code(vm_state_t* vm, const uint8_t* code, uint32_t len) {
+    vm->code = code;
+    vm->patch = (code == vm->program) ? vm->program : NULL;
+    vm->break_starts = vm->break_starts_buf;
+    vm->break_starts_valid = false;
     vm->program_len = len;
+    vm->encoding = VM_ENCODING_WIDE;
+    vm->linked = NULL;
+    vm->handler_count = 0;
+    vm->breakpoint_count = 0;
     vm->pc = 0;
     vm->last_error = VM_OK;
     return VM_OK;
 }
 
+vm_status_t vm_load_verified_program(vm_state_t* vm, const uint8_t* program, uint32_t len) {
+    if (vm_image_is_container(program, len)) return vm_image_load_verified(vm, program, len, false);
+    if (len > PROGRAM_MAX_SIZE) {
+        vm->last_error = VM_ERR_PROGRAM_TOO_LARGE;
+        return VM_ERR_PROGRAM_TOO_LARGE;
+    }
+    memcpy(vm->program, program, len);
+    return set_code(vm, vm->program, len);
+}
+
+vm_status_t vm_attach_program(vm_state_t* vm, const uint8_t* program, uint32_t len) {
+    if (vm_image_is_container(program, len)) return vm_image_load(vm, program, len, true);
+    vm_status_t status = vm_verify_program(program, len);
+    if (status != VM_OK) {
+        vm->last_error = status;
+        return status;
+    }
+    return vm_attach_verified_program(vm, program, len);
+}
+
+vm_status_t vm_attach_verified_program(vm_state_t* vm, const uint8_t* program, uint32_t len) {
+    if (vm_image_is_container(program, len)) return vm_image_load_verified(vm, program, len, true);
+    if (len > PROGRAM_MAP_MAX_SIZE) {
+        vm->last_error = VM_ERR_PROGRAM_TOO_LARGE;
+        return VM_ERR_PROGRAM_TOO_LARGE;
+    }
+    return set_code(vm, program, len);
+}
+
+/* 64-bit FNV-1a; identifies program images in caches */
+uint64_t vm_program_hash(const uint8_t* program, uint32_t len) {
+    uint64_t h = 0xCBF29CE484222325u;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= program[i];
+        h *= 0x00000100000001B3u;
+    }
+    return h;
+}
+
 static inline var_value_t* get_stack_var(vm_state_t* vm, uint8_t idx) {
     return (idx < STACK_VAR_COUNT) ? &vm->stack_frames[vm->sp].stack_vars[idx] : NULL;
 }
 
-static inline var_value_t* get_local_var(vm_state_t* vm, uint32_t idx) {
-    return (idx < STACK_LOCALS_COUNT) ? &vm->stack_frames[vm->sp].locals[idx] : NULL;
-}
 
 static inline var_value_t* get_global_var(vm_state_t* vm, uint32_t idx) {
     return (idx < G_VARS_COUNT) ? &vm->g_vars[idx] : NULL;
 }
 
+/* Resolve a bitset buffer and a bit index held in a stack var */
+static vm_status_t get_bit_operands(vm_state_t* vm, uint32_t buf_idx, uint32_t slot,
+                                    membuf_t** buf, uint32_t* bit) {
+    var_value_t* idx = get_stack_var(vm, slot & 0xFF);
+    if (!idx) return VM_ERR_INVALID_STACK_VAR_IDX;
+    if (idx->type != V_U32) return VM_ERR_TYPE_MISMATCH;
+    if (!validate_buffer_idx(buf_idx)) return VM_ERR_INVALID_BUFFER_IDX;
+    if (vm->g_membuf[buf_idx].type != MB_BIT) return VM_ERR_TYPE_MISMATCH;
+    if (idx->val.u32 >= MEMBUF_BIT_COUNT) return VM_ERR_INVALID_BUFFER_POS;
+    *buf = &vm->g_membuf[buf_idx];
+    *bit = idx->val.u32;
+    return VM_OK;
+}
+
+/*
+ * Find the first bit at or after start whose value equals want_set.
+ * Words are scanned whole; an inverted word turns the clear-bit search
+ * into a set-bit search. Returns MEMBUF_BIT_COUNT if there is none.
+ */
+static uint32_t bitset_find(const membuf_t* buf, uint32_t start, bool want_set) {
+    const uint32_t invert = want_set ? 0u : 0xFFFFFFFFu;
+    uint32_t w = start / 32u;
+    uint32_t word = (buf->buf.bitx64[w] ^ invert) & (0xFFFFFFFFu << (start % 32u));
+    while (word == 0u) {
+        w++;
+        if (w == MEMBUF_BIT_WORDS) return MEMBUF_BIT_COUNT;
+        word = buf->buf.bitx64[w] ^ invert;
+    }
+    return (w * 32u) + bit_ctz32(word);
+}
+
+/*
+ * Find the handler for an error raised at vm.pc: the first entry covering
+ * the PC in the current frame, else the CALL that entered it (the byte
+ * before return_addr) one frame down, and so on. On a match, discard the
+ * frames above, store status in the handler's stack var and resume at the
+ * handler. Only failing instructions get here, so the handler table costs
+ * nothing while the program runs cleanly.
+ */
+static bool unwind(vm_state_t* vm, vm_status_t status) {
+    uint32_t sp = vm->sp;
+    uint32_t pc = vm->pc;
+    for (;;) {
+        for (uint32_t i = 0; i < vm->handler_count; i++) {
+            const vm_handler_t* h = &vm->handlers[i];
+            if (pc < h->start || pc >= h->end) continue;
+            if (vm->memo != NULL) {
+                for (uint32_t f = sp + 1u; f <= vm->sp; f++) vm->memo->pending[f].used = false;
+            }
+            vm->sp = sp;
+            var_value_t* v = &vm->stack_frames[sp].stack_vars[h->var];
+            v->type = V_U32;
+            v->val.u64 = 0;
+            v->val.u32 = (uint32_t)status;
+            vm->pc = h->handler;
+            return true;
+        }
+        if (sp == 0u) return false;
+        pc = vm->stack_frames[sp].return_addr - 1u;
+        sp--;
+    }
+}
+
 /* Minimal instruction execution - implements only key instructions */
 vm_status_t vm_step(vm_state_t* vm) {
-    if (vm->pc >= vm->program_len || vm->program_len - vm->pc < 4) {
-        vm->last_error = VM_ERR_INVALID_PC;
-        return VM_ERR_INVALID_PC;
-    }
-    
-    instruction_header_t hdr;
-    memcpy(&hdr, &vm->program[vm->pc], 4);
-    
-    uint8_t payload_len = INSTR_PAYLOAD_LEN(hdr);
-    uint32_t instr_size = 4 + (payload_len * 4);
-    
-    if (vm->pc + instr_size > vm->program_len || payload_len > 3) {
-        vm->last_error = VM_ERR_INVALID_INSTRUCTION;
-        return VM_ERR_INVALID_INSTRUCTION;
+    vm_instruction_t insn;
+    vm_status_t status = (vm->encoding == VM_ENCODING_WIDE)
+                             ? decode_wide(vm->code, vm->program_len, vm->pc, &insn)
+                             : decode_compact(vm->code, vm->program_len, vm->pc, &insn);
+    if (status != VM_OK) {
+        vm->last_error = status;
+        return status;
     }
     
-    instruction_payload_t imm1 = {0}, imm2 = {0}, imm3 = {0};
-    if (payload_len >= 1) memcpy(&imm1, &vm->program[vm->pc + 4], 4);
-    if (payload_len >= 2) memcpy(&imm2, &vm->program[vm->pc + 8], 4);
-    if (payload_len >= 3) memcpy(&imm3, &vm->program[vm->pc + 12], 4);
+    instruction_header_t hdr = insn.header;
+    instruction_payload_t imm1 = insn.imm[0], imm2 = insn.imm[1], imm3 = insn.imm[2];
     
-    uint32_t next_pc = vm->pc + instr_size;
-    vm_status_t status = VM_OK;
+    uint32_t next_pc = vm->pc + insn.size;
     
     switch (hdr.opcode) {
         case OP_NOP:
@@ -301,63 +954,137 @@ vm_status_t vm_step(vm_state_t* vm) {
             status = VM_ERR_HALT;
             break;
             
-        /* Control Flow */
+        /* Control Flow: static targets were range-checked by the verifier,
+         * and the fetch bounds check catches anything else, so jumps do
+         * not compare against program_len themselves */
         case OP_JMP:
-            if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
             next_pc = imm1.u32;
             break;
         case OP_JZ:
             if ((vm->flags & FLAG_ZERO) != 0) {
-                if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
                 next_pc = imm1.u32;
             }
             break;
         case OP_JNZ:
             if ((vm->flags & FLAG_ZERO) == 0) {
-                if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
                 next_pc = imm1.u32;
             }
             break;
         case OP_JLT:
             if ((vm->flags & FLAG_LESS) != 0) {
-                if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
                 next_pc = imm1.u32;
             }
             break;
         case OP_JGT:
             if ((vm->flags & FLAG_GREATER) != 0) {
-                if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
                 next_pc = imm1.u32;
             }
             break;
         case OP_JLE:
             if (((vm->flags & FLAG_LESS) != 0) || ((vm->flags & FLAG_ZERO) != 0)) {
-                if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
                 next_pc = imm1.u32;
             }
             break;
         case OP_JGE:
             if (((vm->flags & FLAG_GREATER) != 0) || ((vm->flags & FLAG_ZERO) != 0)) {
-                if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
                 next_pc = imm1.u32;
             }
             break;
+        case OP_CALL_MEMO: {
+            /* Arguments are stack vars 0..operand-1 of frame SP+1; a hit
+             * leaves the cached result in its ret_val and never enters */
+            if (vm->sp >= STACK_DEPTH - 1) { status = VM_ERR_STACK_OVERFLOW; break; }
+            if (hdr.operand > STACK_VAR_COUNT) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            stack_frame_t* callee = &vm->stack_frames[vm->sp + 1];
+            if (vm->memo != NULL &&
+                vm_memo_lookup(vm->memo, vm->sp + 1u, imm1.u32, hdr.operand, callee->stack_vars, &callee->ret_val)) {
+                break;
+            }
+            if (vm->linked != NULL) {
+                status = vm_link_enter(vm->linked, imm1.u32);
+                if (status != VM_OK) break;
+            }
+            callee->return_addr = next_pc;
+            callee->locals_live = 0;
+            vm->sp++;
+            next_pc = imm1.u32;
+            break;
+        }
         case OP_CALL:
             if (vm->sp >= STACK_DEPTH - 1) { status = VM_ERR_STACK_OVERFLOW; break; }
-            if (imm1.u32 >= vm->program_len) { status = VM_ERR_INVALID_PC; break; }
+            if (vm->linked != NULL) {
+                status = vm_link_enter(vm->linked, imm1.u32);
+                if (status != VM_OK) break;
+            }
+            if (vm->call_profile != NULL) {
+                vm_profile_call(vm->call_profile, vm->pc, imm1.u32, vm->stack_frames[vm->sp + 1].stack_vars);
+            }
             vm->stack_frames[vm->sp + 1].return_addr = next_pc;
+            vm->stack_frames[vm->sp + 1].locals_live = 0;  /* Locals read as V_VOID until stored */
             vm->sp++;
-            for (uint32_t i = 0; i < STACK_LOCALS_COUNT; i++) {
-                vm->stack_frames[vm->sp].locals[i].type = V_VOID;
-                vm->stack_frames[vm->sp].locals[i].val.u32 = 0;
+            next_pc = imm1.u32;
+            break;
+        case OP_TAILCALL: {
+            /* CALL into the current frame: return_addr and ret_val are kept,
+             * so the callee returns straight to this frame's caller. The
+             * first operand stack vars of frame SP+1 become the arguments. */
+            if (hdr.operand > STACK_VAR_COUNT) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (hdr.operand != 0u && vm->sp >= STACK_DEPTH - 1) { status = VM_ERR_STACK_OVERFLOW; break; }
+            if (vm->linked != NULL) {
+                status = vm_link_enter(vm->linked, imm1.u32);
+                if (status != VM_OK) break;
+            }
+            stack_frame_t* frame = &vm->stack_frames[vm->sp];
+            if (hdr.operand != 0u) {
+                memcpy(frame->stack_vars, vm->stack_frames[vm->sp + 1].stack_vars, hdr.operand * sizeof(var_value_t));
             }
+            frame->locals_live = 0;
             next_pc = imm1.u32;
             break;
+        }
+        case OP_CALL_HOST: {
+            /* Same frame convention as CALL, but SP never moves: arguments
+             * are read in place from frame SP+1 and the result lands in its
+             * ret_val, ready for LOAD_RET. */
+            if (vm->sp >= STACK_DEPTH - 1) { status = VM_ERR_STACK_OVERFLOW; break; }
+            if (imm1.u32 >= HOST_FN_COUNT || !vm->host_fns[imm1.u32]) { status = VM_ERR_INVALID_HOST_FN; break; }
+            stack_frame_t* callee = &vm->stack_frames[vm->sp + 1];
+            callee->ret_val.type = V_VOID;
+            callee->ret_val.val.u64 = 0;
+            status = vm->host_fns[imm1.u32](callee->stack_vars, &callee->ret_val, vm->host_ctx[imm1.u32]);
+            break;
+        }
+        case OP_YIELD:
+            status = VM_YIELD;
+            break;
+        case OP_BREAK:
+            /* The PC stays here; vm_break_continue() runs what was patched over */
+            status = VM_BREAK;
+            break;
         case OP_RET:
             if (vm->sp == 0) { status = VM_ERR_STACK_UNDERFLOW; break; }
+            if (vm->memo != NULL && vm->memo->pending[vm->sp].used) {
+                vm_memo_return(vm->memo, vm->sp, &vm->stack_frames[vm->sp].ret_val);
+            }
             next_pc = vm->stack_frames[vm->sp].return_addr;
             vm->sp--;
             break;
+        case OP_JMP_TABLE: {
+            /* Targets were range-checked by the verifier at load time, so
+             * the only runtime check is the single index bounds test. */
+            var_value_t* idx = get_stack_var(vm, hdr.operand);
+            if (!idx) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (idx->type != V_U32 && idx->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            uint32_t count = imm1.u32;
+            if (count > (vm->program_len - next_pc) / 4u) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            /* A negative V_I32 index wraps to a large u32 and takes the default */
+            if (idx->val.u32 < count) {
+                memcpy(&next_pc, &vm->code[next_pc + (idx->val.u32 * 4u)], 4);
+            } else {
+                next_pc = imm2.u32;
+            }
+            break;
+        }
             
         /* Load Operations */
         case OP_LOAD_G: {
@@ -369,9 +1096,14 @@ vm_status_t vm_step(vm_state_t* vm) {
         }
         case OP_LOAD_L: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
-            var_value_t* src = get_local_var(vm, imm1.u32);
-            if (!dest || !src) { status = VM_ERR_INVALID_LOCAL_IDX; break; }
-            *dest = *src;
+            if (!dest || imm1.u32 >= STACK_LOCALS_COUNT) { status = VM_ERR_INVALID_LOCAL_IDX; break; }
+            const stack_frame_t* frame = &vm->stack_frames[vm->sp];
+            if (((frame->locals_live >> imm1.u32) & 1u) != 0u) {
+                *dest = frame->locals[imm1.u32];
+            } else {
+                dest->type = V_VOID;
+                dest->val.u64 = 0;
+            }
             break;
         }
         case OP_LOAD_S: {
@@ -404,6 +1136,20 @@ vm_status_t vm_step(vm_state_t* vm) {
             dest->val.f32 = imm1.f32;
             break;
         }
+        case OP_LOAD_I_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            dest->type = V_I64;
+            dest->val.u64 = ((uint64_t)imm2.u32 << 32) | (uint64_t)imm1.u32;
+            break;
+        }
+        case OP_LOAD_I_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            dest->type = V_U64;
+            dest->val.u64 = ((uint64_t)imm2.u32 << 32) | (uint64_t)imm1.u32;
+            break;
+        }
         case OP_LOAD_RET: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
             if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
@@ -422,9 +1168,10 @@ vm_status_t vm_step(vm_state_t* vm) {
         }
         case OP_STORE_L: {
             var_value_t* src = get_stack_var(vm, hdr.operand);
-            var_value_t* dest = get_local_var(vm, imm1.u32);
-            if (!src || !dest) { status = VM_ERR_INVALID_LOCAL_IDX; break; }
-            *dest = *src;
+            if (!src || imm1.u32 >= STACK_LOCALS_COUNT) { status = VM_ERR_INVALID_LOCAL_IDX; break; }
+            stack_frame_t* frame = &vm->stack_frames[vm->sp];
+            frame->locals[imm1.u32] = *src;
+            frame->locals_live |= (uint64_t)1u << imm1.u32;
             break;
         }
         case OP_STORE_S: {
@@ -594,25 +1341,300 @@ vm_status_t vm_step(vm_state_t* vm) {
             break;
         }
         
-        /* Float Arithmetic */
-        case OP_ADD_F32: {
+        /* Wrapping and Saturating Integer Arithmetic - never VM_ERR_OVERFLOW */
+        case OP_ADD_WRAP_I32: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
             var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
             var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
             if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
-            if (src1->type != V_FLOAT || src2->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
-            dest->type = V_FLOAT;
-            SET_FLOAT_RESULT(dest, src1->val.f32 + src2->val.f32);
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I32;
+            /* Unsigned arithmetic is defined to wrap; the conversion back is two's complement */
+            dest->val.i32 = (int32_t)((uint32_t)src1->val.i32 + (uint32_t)src2->val.i32);
             break;
         }
-        case OP_SUB_F32: {
+        case OP_SUB_WRAP_I32: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
             var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
             var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
             if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
-            if (src1->type != V_FLOAT || src2->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
-            dest->type = V_FLOAT;
-            SET_FLOAT_RESULT(dest, src1->val.f32 - src2->val.f32);
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I32;
+            dest->val.i32 = (int32_t)((uint32_t)src1->val.i32 - (uint32_t)src2->val.i32);
+            break;
+        }
+        case OP_MUL_WRAP_I32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I32;
+            dest->val.i32 = (int32_t)((uint32_t)src1->val.i32 * (uint32_t)src2->val.i32);
+            break;
+        }
+        case OP_ADD_SAT_I32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I32;
+            int32_t b = src2->val.i32;
+            if (ckd_add(&dest->val.i32, src1->val.i32, b)) dest->val.i32 = (b > 0) ? INT32_MAX : INT32_MIN;
+            break;
+        }
+        case OP_SUB_SAT_I32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I32;
+            int32_t b = src2->val.i32;
+            if (ckd_sub(&dest->val.i32, src1->val.i32, b)) dest->val.i32 = (b < 0) ? INT32_MAX : INT32_MIN;
+            break;
+        }
+        case OP_MUL_SAT_I32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I32;
+            int32_t a = src1->val.i32;
+            int32_t b = src2->val.i32;
+            if (ckd_mul(&dest->val.i32, a, b)) dest->val.i32 = ((a < 0) != (b < 0)) ? INT32_MIN : INT32_MAX;
+            break;
+        }
+        case OP_ADD_WRAP_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U32 || src2->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U32;
+            dest->val.u32 = src1->val.u32 + src2->val.u32;
+            break;
+        }
+        case OP_SUB_WRAP_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U32 || src2->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U32;
+            dest->val.u32 = src1->val.u32 - src2->val.u32;
+            break;
+        }
+        case OP_MUL_WRAP_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U32 || src2->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U32;
+            dest->val.u32 = src1->val.u32 * src2->val.u32;
+            break;
+        }
+        case OP_ADD_SAT_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U32 || src2->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U32;
+            if (ckd_add(&dest->val.u32, src1->val.u32, src2->val.u32)) dest->val.u32 = UINT32_MAX;
+            break;
+        }
+        case OP_SUB_SAT_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U32 || src2->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U32;
+            if (ckd_sub(&dest->val.u32, src1->val.u32, src2->val.u32)) dest->val.u32 = 0u;
+            break;
+        }
+        case OP_MUL_SAT_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U32 || src2->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U32;
+            if (ckd_mul(&dest->val.u32, src1->val.u32, src2->val.u32)) dest->val.u32 = UINT32_MAX;
+            break;
+        }
+        
+        /* 64-bit Integer Arithmetic */
+        case OP_ADD_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I64 || src2->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I64;
+            if (ckd_add(&dest->val.i64, src1->val.i64, src2->val.i64)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            break;
+        }
+        case OP_SUB_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I64 || src2->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I64;
+            if (ckd_sub(&dest->val.i64, src1->val.i64, src2->val.i64)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            break;
+        }
+        case OP_MUL_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I64 || src2->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I64;
+            if (ckd_mul(&dest->val.i64, src1->val.i64, src2->val.i64)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            break;
+        }
+        case OP_DIV_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I64 || src2->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (src2->val.i64 == 0) { status = VM_ERR_DIV_BY_ZERO; break; }
+            /* Check for overflow: INT64_MIN / -1 overflows */
+            if (src1->val.i64 == INT64_MIN && src2->val.i64 == -1) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_I64;
+            dest->val.i64 = src1->val.i64 / src2->val.i64;
+            break;
+        }
+        case OP_MOD_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I64 || src2->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (src2->val.i64 == 0) { status = VM_ERR_DIV_BY_ZERO; break; }
+            /* Check for overflow: INT64_MIN % -1 traps on many platforms */
+            if (src1->val.i64 == INT64_MIN && src2->val.i64 == -1) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_I64;
+            dest->val.i64 = src1->val.i64 % src2->val.i64;
+            break;
+        }
+        case OP_NEG_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            /* Check for overflow: negating INT64_MIN overflows */
+            if (src->val.i64 == INT64_MIN) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_I64;
+            dest->val.i64 = -src->val.i64;
+            break;
+        }
+        case OP_ADD_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U64 || src2->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U64;
+            if (ckd_add(&dest->val.u64, src1->val.u64, src2->val.u64)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            break;
+        }
+        case OP_SUB_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U64 || src2->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U64;
+            if (ckd_sub(&dest->val.u64, src1->val.u64, src2->val.u64)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            break;
+        }
+        case OP_MUL_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U64 || src2->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U64;
+            if (ckd_mul(&dest->val.u64, src1->val.u64, src2->val.u64)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            break;
+        }
+        case OP_DIV_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U64 || src2->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (src2->val.u64 == 0u) { status = VM_ERR_DIV_BY_ZERO; break; }
+            dest->type = V_U64;
+            dest->val.u64 = src1->val.u64 / src2->val.u64;
+            break;
+        }
+        case OP_MOD_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U64 || src2->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (src2->val.u64 == 0u) { status = VM_ERR_DIV_BY_ZERO; break; }
+            dest->type = V_U64;
+            dest->val.u64 = src1->val.u64 % src2->val.u64;
+            break;
+        }
+        
+        /* Float Arithmetic */
+        case OP_ADD_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_FLOAT || src2->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, src1->val.f32 + src2->val.f32);
+            break;
+        }
+        case OP_SUB_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_FLOAT || src2->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, src1->val.f32 - src2->val.f32);
             break;
         }
         case OP_MUL_F32: {
@@ -668,6 +1690,124 @@ vm_status_t vm_step(vm_state_t* vm) {
             SET_FLOAT_RESULT(dest, sqrtf(src->val.f32));
             break;
         }
+        case OP_EXP_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, expf(src->val.f32));
+            break;
+        }
+        case OP_LOG_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            /* Check for non-positive input before log */
+            if (src->val.f32 <= 0.0f) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, logf(src->val.f32));
+            break;
+        }
+        case OP_SIN_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, sinf(src->val.f32));
+            break;
+        }
+        case OP_COS_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, cosf(src->val.f32));
+            break;
+        }
+        case OP_POW_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_FLOAT || src2->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, powf(src1->val.f32, src2->val.f32));
+            break;
+        }
+        case OP_FLOOR_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, floorf(src->val.f32));
+            break;
+        }
+        case OP_FMA_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            var_value_t* src3 = get_stack_var(vm, imm3.u32 & 0xFF);
+            if (!dest || !src1 || !src2 || !src3) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_FLOAT || src2->type != V_FLOAT || src3->type != V_FLOAT) {
+                status = VM_ERR_TYPE_MISMATCH; break;
+            }
+            dest->type = V_FLOAT;
+            SET_FLOAT_RESULT(dest, fmaf(src1->val.f32, src2->val.f32, src3->val.f32));
+            break;
+        }
+        case OP_VMAP_F32: {
+            uint32_t dest_idx = hdr.operand;
+            uint32_t src_idx = imm1.u32;
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(src_idx)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            if (vm->g_membuf[src_idx].type != MB_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            /* Element count; 0 (or no imm3) maps the whole buffer */
+            uint32_t n = (imm3.u32 == 0u) ? MEMBUF_F32_COUNT : imm3.u32;
+            if (n > MEMBUF_F32_COUNT) { status = VM_ERR_BOUNDS; break; }
+            
+            /* Results are staged so a failing element leaves dest untouched */
+            float tmp[MEMBUF_F32_COUNT];
+            status = map_f32(imm2.u32, vm->g_membuf[src_idx].buf.f32x64, tmp, n);
+            if (status != VM_OK) break;
+            vm->g_membuf[dest_idx].type = MB_FLOAT;
+            memcpy(vm->g_membuf[dest_idx].buf.f32x64, tmp, n * sizeof(tmp[0]));
+            break;
+        }
+        case OP_VFMA_F32: {
+            uint32_t dest_idx = hdr.operand;
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(imm1.u32) ||
+                !validate_buffer_idx(imm2.u32) || !validate_buffer_idx(imm3.u32)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            const membuf_t* a = &vm->g_membuf[imm1.u32];
+            const membuf_t* b = &vm->g_membuf[imm2.u32];
+            const membuf_t* c = &vm->g_membuf[imm3.u32];
+            if (a->type != MB_FLOAT || b->type != MB_FLOAT || c->type != MB_FLOAT) {
+                status = VM_ERR_TYPE_MISMATCH; break;
+            }
+            
+            float tmp[MEMBUF_F32_COUNT];
+            bool valid = true;
+            for (uint32_t i = 0; i < MEMBUF_F32_COUNT; i++) {
+                tmp[i] = fmaf(a->buf.f32x64[i], b->buf.f32x64[i], c->buf.f32x64[i]);
+            }
+            for (uint32_t i = 0; i < MEMBUF_F32_COUNT; i++) {
+                valid &= is_valid_float(tmp[i]);
+            }
+            if (!valid) { status = VM_ERR_OVERFLOW; break; }
+            vm->g_membuf[dest_idx].type = MB_FLOAT;
+            memcpy(vm->g_membuf[dest_idx].buf.f32x64, tmp, sizeof(tmp));
+            break;
+        }
         
         /* Bitwise Operations (Unsigned Only - MISRA-C) */
         case OP_AND_U32: {
@@ -769,6 +1909,208 @@ vm_status_t vm_step(vm_state_t* vm) {
             if (src1->val.f32 > src2->val.f32) vm->flags |= FLAG_GREATER;
             break;
         }
+        case OP_CMP_I64: {
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I64 || src2->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            vm->flags = 0;
+            if (src1->val.i64 == src2->val.i64) vm->flags |= FLAG_ZERO;
+            if (src1->val.i64 < src2->val.i64) vm->flags |= FLAG_LESS;
+            if (src1->val.i64 > src2->val.i64) vm->flags |= FLAG_GREATER;
+            break;
+        }
+        case OP_CMP_U64: {
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_U64 || src2->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            vm->flags = 0;
+            if (src1->val.u64 == src2->val.u64) vm->flags |= FLAG_ZERO;
+            if (src1->val.u64 < src2->val.u64) vm->flags |= FLAG_LESS;
+            if (src1->val.u64 > src2->val.u64) vm->flags |= FLAG_GREATER;
+            break;
+        }
+        
+        /* Conditional Selection - the choice is made by indexing, not branching */
+        case OP_SELECT: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* cond = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* if_true = get_stack_var(vm, imm2.u32 & 0xFF);
+            var_value_t* if_false = get_stack_var(vm, imm3.u32 & 0xFF);
+            if (!dest || !cond || !if_true || !if_false) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (cond->type != V_U32 && cond->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            const var_value_t* pick[2] = { if_false, if_true };
+            *dest = *pick[cond->val.u32 != 0u];
+            break;
+        }
+        case OP_CMOV: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* if_true = get_stack_var(vm, imm2.u32 & 0xFF);
+            var_value_t* if_false = get_stack_var(vm, imm3.u32 & 0xFF);
+            if (!dest || !if_true || !if_false) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            /* imm1 is a FLAG_* mask: true if any of the masked flags is set */
+            const var_value_t* pick[2] = { if_false, if_true };
+            *dest = *pick[(vm->flags & imm1.u32) != 0u];
+            break;
+        }
+        case OP_TEST_CONST: {
+            /* Never a type mismatch: another type just compares unequal */
+            var_value_t* src = get_stack_var(vm, hdr.operand);
+            if (!src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            bool wide = (src->type == V_I64) || (src->type == V_U64);
+            uint64_t have = wide ? src->val.u64 : src->val.u32;
+            uint64_t want = (uint64_t)imm2.u32 | ((uint64_t)imm3.u32 << 32);
+            vm->flags = (((uint32_t)src->type == imm1.u32) && (have == want)) ? FLAG_ZERO : 0u;
+            break;
+        }
+        
+        /* Packed Lane Operations (SWAR on V_U8 / V_U16) */
+        case OP_ADD_PK:
+        case OP_ADDS_PK:
+        case OP_SUB_PK:
+        case OP_SUBS_PK:
+        case OP_MIN_PK:
+        case OP_MAX_PK:
+        case OP_CMPEQ_PK:
+        case OP_CMPGT_PK: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if ((src1->type != V_U8 && src1->type != V_U16) || src2->type != src1->type) {
+                status = VM_ERR_TYPE_MISMATCH; break;
+            }
+            
+            var_value_type_t type = src1->type;
+            uint32_t bits = (type == V_U8) ? 8u : 16u;
+            uint32_t hi = (type == V_U8) ? 0x80808080u : 0x80008000u;
+            uint32_t a = packed_to_u32(src1);
+            uint32_t b = packed_to_u32(src2);
+            uint32_t r;
+            
+            switch (hdr.opcode) {
+                case OP_ADD_PK:
+                    r = swar_add(a, b, hi);
+                    break;
+                case OP_ADDS_PK:
+                    r = swar_add(a, b, hi);
+                    r |= swar_spread(swar_carry(a, b, r, hi), bits);
+                    break;
+                case OP_SUB_PK:
+                    r = swar_sub(a, b, hi);
+                    break;
+                case OP_SUBS_PK:
+                    r = swar_sub(a, b, hi);
+                    r &= ~swar_spread(swar_borrow(a, b, r, hi), bits);
+                    break;
+                case OP_MIN_PK: {
+                    uint32_t gt = swar_cmpgt(a, b, hi, bits);
+                    r = (b & gt) | (a & ~gt);
+                    break;
+                }
+                case OP_MAX_PK: {
+                    uint32_t gt = swar_cmpgt(a, b, hi, bits);
+                    r = (a & gt) | (b & ~gt);
+                    break;
+                }
+                case OP_CMPEQ_PK:
+                    r = swar_cmpeq(a, b, hi, bits);
+                    break;
+                default:
+                    r = swar_cmpgt(a, b, hi, bits);
+                    break;
+            }
+            u32_to_packed(dest, type, r);
+            break;
+        }
+        case OP_SHUF_PK: {
+            /* imm2 selects the source lane for each destination lane:
+             * 2 bits per lane for V_U8, 1 bit per lane for V_U16 */
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            var_value_t tmp = *src;
+            if (src->type == V_U8) {
+                for (uint32_t i = 0; i < 4u; i++) {
+                    tmp.val.u8x4[i] = src->val.u8x4[(imm2.u32 >> (i * 2u)) & 3u];
+                }
+            } else if (src->type == V_U16) {
+                for (uint32_t i = 0; i < 2u; i++) {
+                    tmp.val.u16x2[i] = src->val.u16x2[(imm2.u32 >> i) & 1u];
+                }
+            } else {
+                status = VM_ERR_TYPE_MISMATCH; break;
+            }
+            *dest = tmp;
+            break;
+        }
+        case OP_U32_TO_PK: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (imm2.u32 != V_U8 && imm2.u32 != V_U16) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            u32_to_packed(dest, (var_value_type_t)imm2.u32, src->val.u32);
+            break;
+        }
+        case OP_PK_TO_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_U8 && src->type != V_U16) { status = VM_ERR_TYPE_MISMATCH; break; }
+            uint32_t bits = packed_to_u32(src);
+            dest->type = V_U32;
+            dest->val.u32 = bits;
+            break;
+        }
+        case OP_BUF_READ_PK:
+        case OP_BUF_WRITE_PK: {
+            /* MB_U8 buffers move 4 bytes as V_U8, MB_U16 buffers 2 halfwords as V_U16.
+             * The element position comes from a V_U32 stack var. */
+            var_value_t* val = get_stack_var(vm, hdr.operand);
+            var_value_t* pos_var = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!val || !pos_var) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (pos_var->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            
+            uint32_t buf_idx = imm1.u32;
+            if (!validate_buffer_idx(buf_idx)) { status = VM_ERR_INVALID_BUFFER_IDX; break; }
+            
+            membuf_t* buf = &vm->g_membuf[buf_idx];
+            var_value_type_t lane_type;
+            uint32_t lanes;
+            if (buf->type == MB_U8) {
+                lane_type = V_U8;
+                lanes = 4u;
+            } else if (buf->type == MB_U16) {
+                lane_type = V_U16;
+                lanes = 2u;
+            } else {
+                status = VM_ERR_TYPE_MISMATCH; break;
+            }
+            
+            uint32_t pos = pos_var->val.u32;
+            if (pos >= get_buffer_capacity(buf->type) || get_buffer_capacity(buf->type) - pos < lanes) {
+                status = VM_ERR_INVALID_BUFFER_POS; break;
+            }
+            
+            if (hdr.opcode == OP_BUF_READ_PK) {
+                val->type = lane_type;
+                if (lane_type == V_U8) {
+                    memcpy(val->val.u8x4, &buf->buf.u8x256[pos], 4);
+                } else {
+                    memcpy(val->val.u16x2, &buf->buf.u16x128[pos], 4);
+                }
+            } else {
+                if (val->type != lane_type) { status = VM_ERR_TYPE_MISMATCH; break; }
+                if (lane_type == V_U8) {
+                    memcpy(&buf->buf.u8x256[pos], val->val.u8x4, 4);
+                } else {
+                    memcpy(&buf->buf.u16x128[pos], val->val.u16x2, 4);
+                }
+            }
+            break;
+        }
         
         /* Type Conversions */
         case OP_I32_TO_U32: {
@@ -825,31 +2167,294 @@ vm_status_t vm_step(vm_state_t* vm) {
             dest->val.u32 = (uint32_t)src->val.f32;
             break;
         }
+        case OP_I32_TO_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I64;
+            dest->val.i64 = (int64_t)src->val.i32;
+            break;
+        }
+        case OP_I64_TO_I32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (src->val.i64 < INT32_MIN || src->val.i64 > INT32_MAX) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_I32;
+            dest->val.i32 = (int32_t)src->val.i64;
+            break;
+        }
+        case OP_U32_TO_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U64;
+            dest->val.u64 = (uint64_t)src->val.u32;
+            break;
+        }
+        case OP_U64_TO_U32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (src->val.u64 > UINT32_MAX) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_U32;
+            dest->val.u32 = (uint32_t)src->val.u64;
+            break;
+        }
+        case OP_I64_TO_U64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_U64;
+            dest->val.u64 = (uint64_t)src->val.i64;
+            break;
+        }
+        case OP_U64_TO_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_I64;
+            dest->val.i64 = (int64_t)src->val.u64;
+            break;
+        }
+        case OP_I64_TO_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            dest->val.f32 = (float)src->val.i64;
+            break;
+        }
+        case OP_F32_TO_I64: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            /* Both bounds are exact powers of two in float; reject NaN too */
+            if (!(src->val.f32 >= -9223372036854775808.0f && src->val.f32 < 9223372036854775808.0f)) {
+                status = VM_ERR_OVERFLOW;
+                break;
+            }
+            dest->type = V_I64;
+            dest->val.i64 = (int64_t)src->val.f32;
+            break;
+        }
+        
+        /* Q16.16 Fixed-Point Operations */
+        case OP_MUL_FX:
+        case OP_DIV_FX: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src1 = get_stack_var(vm, imm1.u32 & 0xFF);
+            var_value_t* src2 = get_stack_var(vm, imm2.u32 & 0xFF);
+            if (!dest || !src1 || !src2) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src1->type != V_I32 || src2->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (imm3.u32 > FX_ROUND_ZERO) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            int64_t q;
+            if (hdr.opcode == OP_MUL_FX) {
+                q = fx_div_round((int64_t)src1->val.i32 * src2->val.i32, FX_ONE, imm3.u32);
+            } else {
+                if (src2->val.i32 == 0) { status = VM_ERR_DIV_BY_ZERO; break; }
+                q = fx_div_round((int64_t)src1->val.i32 * FX_ONE, src2->val.i32, imm3.u32);
+            }
+            if (!fx_in_range(q)) { status = VM_ERR_OVERFLOW; break; }
+            dest->type = V_I32;
+            dest->val.i32 = (int32_t)q;
+            break;
+        }
+        case OP_I32_TO_FX: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            int32_t r;
+            if (ckd_mul(&r, src->val.i32, FX_ONE)) { status = VM_ERR_OVERFLOW; break; }
+            dest->type = V_I32;
+            dest->val.i32 = r;
+            break;
+        }
+        case OP_FX_TO_I32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (imm2.u32 > FX_ROUND_ZERO) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            dest->type = V_I32;
+            dest->val.i32 = (int32_t)fx_div_round(src->val.i32, FX_ONE, imm2.u32);
+            break;
+        }
+        case OP_F32_TO_FX: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (imm2.u32 > FX_ROUND_ZERO) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            int32_t r;
+            status = f32_to_fx(src->val.f32, imm2.u32, &r);
+            if (status != VM_OK) break;
+            dest->type = V_I32;
+            dest->val.i32 = r;
+            break;
+        }
+        case OP_FX_TO_F32: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!dest || !src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (src->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            dest->type = V_FLOAT;
+            dest->val.f32 = (float)src->val.i32 * (1.0f / (float)FX_ONE);
+            break;
+        }
+        case OP_VMUL_FX: {
+            uint32_t dest_idx = hdr.operand;
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(imm1.u32) ||
+                !validate_buffer_idx(imm2.u32)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            const membuf_t* a = &vm->g_membuf[imm1.u32];
+            const membuf_t* b = &vm->g_membuf[imm2.u32];
+            if (a->type != MB_I32 || b->type != MB_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (imm3.u32 > FX_ROUND_ZERO) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            
+            /* Range failures are accumulated without branching; dest is untouched on error */
+            int32_t tmp[MEMBUF_I32_COUNT];
+            bool valid = true;
+            for (uint32_t i = 0; i < MEMBUF_I32_COUNT; i++) {
+                int64_t q = fx_div_round((int64_t)a->buf.i32x64[i] * b->buf.i32x64[i], FX_ONE, imm3.u32);
+                valid &= fx_in_range(q);
+                tmp[i] = (int32_t)q;
+            }
+            if (!valid) { status = VM_ERR_OVERFLOW; break; }
+            vm->g_membuf[dest_idx].type = MB_I32;
+            memcpy(vm->g_membuf[dest_idx].buf.i32x64, tmp, sizeof(tmp));
+            break;
+        }
+        case OP_VDIV_FX: {
+            uint32_t dest_idx = hdr.operand;
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(imm1.u32) ||
+                !validate_buffer_idx(imm2.u32)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            const membuf_t* a = &vm->g_membuf[imm1.u32];
+            const membuf_t* b = &vm->g_membuf[imm2.u32];
+            if (a->type != MB_I32 || b->type != MB_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            /* imm3 = mode | element count << 8; count 0 divides the whole buffer */
+            uint32_t mode = imm3.u32 & 0xFFu;
+            uint32_t n = imm3.u32 >> 8;
+            if (n == 0u) n = MEMBUF_I32_COUNT;
+            if (mode > FX_ROUND_ZERO) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            if (n > MEMBUF_I32_COUNT) { status = VM_ERR_BOUNDS; break; }
+            
+            bool nonzero = true;
+            for (uint32_t i = 0; i < n; i++) {
+                nonzero &= (b->buf.i32x64[i] != 0);
+            }
+            if (!nonzero) { status = VM_ERR_DIV_BY_ZERO; break; }
+            /* Range failures are accumulated without branching; dest is untouched on error */
+            int32_t tmp[MEMBUF_I32_COUNT];
+            bool valid = true;
+            for (uint32_t i = 0; i < n; i++) {
+                int64_t q = fx_div_round((int64_t)a->buf.i32x64[i] * FX_ONE, b->buf.i32x64[i], mode);
+                valid &= fx_in_range(q);
+                tmp[i] = (int32_t)q;
+            }
+            if (!valid) { status = VM_ERR_OVERFLOW; break; }
+            vm->g_membuf[dest_idx].type = MB_I32;
+            memcpy(vm->g_membuf[dest_idx].buf.i32x64, tmp, n * sizeof(tmp[0]));
+            break;
+        }
+        case OP_VF32_TO_FX: {
+            uint32_t dest_idx = hdr.operand;
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(imm1.u32)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            const membuf_t* src = &vm->g_membuf[imm1.u32];
+            if (src->type != MB_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (imm2.u32 > FX_ROUND_ZERO) { status = VM_ERR_INVALID_INSTRUCTION; break; }
+            
+            int32_t tmp[MEMBUF_I32_COUNT];
+            for (uint32_t i = 0; i < MEMBUF_I32_COUNT; i++) {
+                status = f32_to_fx(src->buf.f32x64[i], imm2.u32, &tmp[i]);
+                if (status != VM_OK) break;
+            }
+            if (status != VM_OK) break;
+            vm->g_membuf[dest_idx].type = MB_I32;
+            memcpy(vm->g_membuf[dest_idx].buf.i32x64, tmp, sizeof(tmp));
+            break;
+        }
+        case OP_VFX_TO_F32: {
+            uint32_t dest_idx = hdr.operand;
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(imm1.u32)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            const membuf_t* src = &vm->g_membuf[imm1.u32];
+            if (src->type != MB_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+            
+            float tmp[MEMBUF_F32_COUNT];
+            for (uint32_t i = 0; i < MEMBUF_F32_COUNT; i++) {
+                tmp[i] = (float)src->buf.i32x64[i] * (1.0f / (float)FX_ONE);
+            }
+            vm->g_membuf[dest_idx].type = MB_FLOAT;
+            memcpy(vm->g_membuf[dest_idx].buf.f32x64, tmp, sizeof(tmp));
+            break;
+        }
         
         /* I/O Operations */
         case OP_PRINT_I32: {
             var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
             if (!src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (!io_out_room(&vm->io, IO_NUMBER_MAX)) { status = VM_YIELD; break; }
             if (src->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
-            print_i32(src->val.i32);
+            print_i32(&vm->io, src->val.i32);
             break;
         }
         case OP_PRINT_U32: {
             var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
             if (!src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (!io_out_room(&vm->io, IO_NUMBER_MAX)) { status = VM_YIELD; break; }
             if (src->type != V_U32) { status = VM_ERR_TYPE_MISMATCH; break; }
-            print_u32(src->val.u32);
+            print_u32(&vm->io, src->val.u32);
             break;
         }
         case OP_PRINT_F32: {
             var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
             if (!src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (!io_out_room(&vm->io, IO_NUMBER_MAX)) { status = VM_YIELD; break; }
             if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
-            print_f32(src->val.f32);
+            print_f32(&vm->io, src->val.f32);
+            break;
+        }
+        case OP_PRINT_I64: {
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (!io_out_room(&vm->io, IO_NUMBER_MAX)) { status = VM_YIELD; break; }
+            if (src->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            print_i64(&vm->io, src->val.i64);
+            break;
+        }
+        case OP_PRINT_U64: {
+            var_value_t* src = get_stack_var(vm, imm1.u32 & 0xFF);
+            if (!src) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (!io_out_room(&vm->io, IO_NUMBER_MAX)) { status = VM_YIELD; break; }
+            if (src->type != V_U64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            print_u64(&vm->io, src->val.u64);
             break;
         }
         case OP_PRINTLN:
-            (void)fputc('\n', stdout);
+            if (!io_out_room(&vm->io, 1u)) { status = VM_YIELD; break; }
+            io_putc(&vm->io, '\n');
             break;
         
         /* Buffer Operations */
@@ -887,6 +2492,14 @@ vm_status_t vm_step(vm_state_t* vm) {
                     dest->type = V_FLOAT;
                     dest->val.f32 = buf->buf.f32x64[pos];
                     break;
+                case MB_I64:
+                    dest->type = V_I64;
+                    dest->val.i64 = buf->buf.i64x32[pos];
+                    break;
+                case MB_BIT:
+                    dest->type = V_U32;
+                    dest->val.u32 = (buf->buf.bitx64[pos / 32u] >> (pos % 32u)) & 1u;
+                    break;
                 default:
                     status = VM_ERR_TYPE_MISMATCH;
                     break;
@@ -936,6 +2549,20 @@ vm_status_t vm_step(vm_state_t* vm) {
                     if (src->type != V_FLOAT) { status = VM_ERR_TYPE_MISMATCH; break; }
                     buf->buf.f32x64[pos] = src->val.f32;
                     break;
+                case MB_I64:
+                    if (src->type != V_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+                    buf->buf.i64x32[pos] = src->val.i64;
+                    break;
+                case MB_BIT: {
+                    if (src->type != V_U32 && src->type != V_I32) { status = VM_ERR_TYPE_MISMATCH; break; }
+                    uint32_t mask = 1u << (pos % 32u);
+                    if (src->val.u32 != 0u) {
+                        buf->buf.bitx64[pos / 32u] |= mask;
+                    } else {
+                        buf->buf.bitx64[pos / 32u] &= ~mask;
+                    }
+                    break;
+                }
                 default:
                     status = VM_ERR_TYPE_MISMATCH;
                     break;
@@ -965,6 +2592,124 @@ vm_status_t vm_step(vm_state_t* vm) {
             break;
         }
         
+        case OP_BUF_INIT: {
+            uint32_t buf_idx = imm1.u32;
+            if (!validate_buffer_idx(buf_idx)) { status = VM_ERR_INVALID_BUFFER_IDX; break; }
+            if (hdr.operand > MB_I64) { status = VM_ERR_TYPE_MISMATCH; break; }
+            
+            membuf_t* buf = &vm->g_membuf[buf_idx];
+            buf->type = (membuf_type_t)hdr.operand;
+            memset(&buf->buf, 0, sizeof(buf->buf));
+            break;
+        }
+        
+        /* Bitset Operations */
+        case OP_BIT_GET: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            membuf_t* buf;
+            uint32_t bit;
+            status = get_bit_operands(vm, imm1.u32, imm2.u32, &buf, &bit);
+            if (status != VM_OK) break;
+            dest->type = V_U32;
+            dest->val.u32 = (buf->buf.bitx64[bit / 32u] >> (bit % 32u)) & 1u;
+            break;
+        }
+        case OP_BIT_SET: {
+            membuf_t* buf;
+            uint32_t bit;
+            status = get_bit_operands(vm, imm1.u32, imm2.u32, &buf, &bit);
+            if (status != VM_OK) break;
+            buf->buf.bitx64[bit / 32u] |= 1u << (bit % 32u);
+            break;
+        }
+        case OP_BIT_CLR: {
+            membuf_t* buf;
+            uint32_t bit;
+            status = get_bit_operands(vm, imm1.u32, imm2.u32, &buf, &bit);
+            if (status != VM_OK) break;
+            buf->buf.bitx64[bit / 32u] &= ~(1u << (bit % 32u));
+            break;
+        }
+        case OP_BIT_TGL: {
+            membuf_t* buf;
+            uint32_t bit;
+            status = get_bit_operands(vm, imm1.u32, imm2.u32, &buf, &bit);
+            if (status != VM_OK) break;
+            buf->buf.bitx64[bit / 32u] ^= 1u << (bit % 32u);
+            break;
+        }
+        case OP_BIT_CNT: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            uint32_t buf_idx = imm1.u32;
+            if (!validate_buffer_idx(buf_idx)) { status = VM_ERR_INVALID_BUFFER_IDX; break; }
+            
+            membuf_t* buf = &vm->g_membuf[buf_idx];
+            if (buf->type != MB_BIT) { status = VM_ERR_TYPE_MISMATCH; break; }
+            
+            uint32_t count = 0;
+            for (uint32_t i = 0; i < MEMBUF_BIT_WORDS; i++) {
+                count += bit_popcount32(buf->buf.bitx64[i]);
+            }
+            dest->type = V_U32;
+            dest->val.u32 = count;
+            break;
+        }
+        case OP_BIT_FFS:
+        case OP_BIT_FFC: {
+            var_value_t* dest = get_stack_var(vm, hdr.operand);
+            if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            membuf_t* buf;
+            uint32_t start;
+            status = get_bit_operands(vm, imm1.u32, imm2.u32, &buf, &start);
+            if (status != VM_OK) break;
+            dest->type = V_U32;
+            dest->val.u32 = bitset_find(buf, start, hdr.opcode == OP_BIT_FFS);
+            break;
+        }
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_BIT_ANDN: {
+            uint32_t dest_idx = hdr.operand;
+            uint32_t src1_idx = imm1.u32;
+            uint32_t src2_idx = imm2.u32;
+            
+            if (!validate_buffer_idx(dest_idx) || !validate_buffer_idx(src1_idx) || !validate_buffer_idx(src2_idx)) {
+                status = VM_ERR_INVALID_BUFFER_IDX; break;
+            }
+            
+            /* Element-wise over words, so dest may alias either source */
+            uint32_t* dst = vm->g_membuf[dest_idx].buf.bitx64;
+            const uint32_t* a = vm->g_membuf[src1_idx].buf.bitx64;
+            const uint32_t* b = vm->g_membuf[src2_idx].buf.bitx64;
+            
+            if (vm->g_membuf[src1_idx].type != MB_BIT || vm->g_membuf[src2_idx].type != MB_BIT) {
+                status = VM_ERR_TYPE_MISMATCH; break;
+            }
+            
+            vm->g_membuf[dest_idx].type = MB_BIT;
+            
+            /* Separate fixed-trip loops per operation so each vectorizes */
+            uint32_t i;
+            switch (hdr.opcode) {
+                case OP_BIT_AND:
+                    for (i = 0; i < MEMBUF_BIT_WORDS; i++) dst[i] = a[i] & b[i];
+                    break;
+                case OP_BIT_OR:
+                    for (i = 0; i < MEMBUF_BIT_WORDS; i++) dst[i] = a[i] | b[i];
+                    break;
+                case OP_BIT_XOR:
+                    for (i = 0; i < MEMBUF_BIT_WORDS; i++) dst[i] = a[i] ^ b[i];
+                    break;
+                default:
+                    for (i = 0; i < MEMBUF_BIT_WORDS; i++) dst[i] = a[i] & ~b[i];
+                    break;
+            }
+            break;
+        }
+        
         /* String Operations */
         case OP_STR_CAT: {
             uint32_t dest_idx = hdr.operand;
@@ -1173,13 +2918,14 @@ vm_status_t vm_step(vm_state_t* vm) {
             
             membuf_t* buf = &vm->g_membuf[buf_idx];
             if (buf->type != MB_U8) { status = VM_ERR_TYPE_MISMATCH; break; }
+            if (!io_out_room(&vm->io, MEMBUF_U8_COUNT)) { status = VM_YIELD; break; }
             
             /* Print string up to null terminator */
             for (uint32_t i = 0; i < MEMBUF_U8_COUNT; i++) {
                 if (buf->buf.u8x256[i] == 0) {
                     break;
                 }
-                (void)fputc((char)buf->buf.u8x256[i], stdout);
+                io_putc(&vm->io, (char)buf->buf.u8x256[i]);
             }
             break;
         }
@@ -1187,6 +2933,10 @@ vm_status_t vm_step(vm_state_t* vm) {
         case OP_READ_I32: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
             if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (vm->io.mode == VM_IO_HOST) {
+                status = io_read_number(&vm->io, V_I32, dest);
+                break;
+            }
             
             /* Use SCNd32 for portable scanf with int32_t */
             int32_t value;
@@ -1211,6 +2961,10 @@ vm_status_t vm_step(vm_state_t* vm) {
         case OP_READ_U32: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
             if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (vm->io.mode == VM_IO_HOST) {
+                status = io_read_number(&vm->io, V_U32, dest);
+                break;
+            }
             
             /* Use SCNu32 for portable scanf with uint32_t */
             uint32_t value;
@@ -1235,6 +2989,10 @@ vm_status_t vm_step(vm_state_t* vm) {
         case OP_READ_F32: {
             var_value_t* dest = get_stack_var(vm, hdr.operand);
             if (!dest) { status = VM_ERR_INVALID_STACK_VAR_IDX; break; }
+            if (vm->io.mode == VM_IO_HOST) {
+                status = io_read_number(&vm->io, V_FLOAT, dest);
+                break;
+            }
             
             /* Safe: scanf with %f reads into fixed-size float variable, no buffer overflow risk */
             float value;
@@ -1261,6 +3019,10 @@ vm_status_t vm_step(vm_state_t* vm) {
             if (!validate_buffer_idx(buf_idx)) { status = VM_ERR_INVALID_BUFFER_IDX; break; }
             
             membuf_t* buf = &vm->g_membuf[buf_idx];
+            if (vm->io.mode == VM_IO_HOST) {
+                status = io_read_line(&vm->io, buf);
+                break;
+            }
             buf->type = MB_U8;
             
             /* Read string from stdin up to newline or max length */
@@ -1292,6 +3054,12 @@ vm_status_t vm_step(vm_state_t* vm) {
     
     if (status == VM_OK) {
         vm->pc = next_pc;
+    } else if (status == VM_YIELD && hdr.opcode == OP_YIELD) {
+        /* YIELD resumes after itself; a blocked read or print re-executes */
+        vm->pc = next_pc;
+    } else if (status != VM_YIELD && status != VM_BREAK && status != VM_ERR_HALT && vm->handler_count != 0u &&
+               unwind(vm, status)) {
+        status = VM_OK;
     }
     
     vm->last_error = status;
@@ -1304,27 +3072,120 @@ vm_status_t vm_run(vm_state_t* vm) {
     return (status == VM_ERR_HALT) ? VM_OK : status;
 }
 
+/* ============================================================================
+ * Breakpoints
+ * ============================================================================ */
+
+/* Index of the breakpoint at pc, or breakpoint_count */
+static uint32_t find_breakpoint(const vm_state_t* vm, uint32_t pc) {
+    uint32_t i = 0;
+    while (i < vm->breakpoint_count && vm->breakpoints[i].pc != pc) i++;
+    return i;
+}
+
+/*
+ * Walk the code from 0 once per loaded program and mark where instructions
+ * start; a patched JMP_TABLE still owns the table after it. Code that is
+ * not patched in place fits break_starts_buf, because vm_break_set()
+ * refuses code larger than program[] first.
+ */
+static bool is_instruction_start(vm_state_t* vm, uint32_t target) {
+    uint32_t* starts = vm->break_starts;
+    if (!vm->break_starts_valid) {
+        memset(starts, 0, VM_BREAK_STARTS_WORDS(vm->program_len) * sizeof(starts[0]));
+        uint32_t pc = 0;
+        while (pc < vm->program_len) {
+            vm_instruction_t insn;
+            if (vm_decode_instruction(vm->code, vm->program_len, pc, vm->encoding, &insn) != VM_OK) break;
+            starts[pc / 32u] |= 1u << (pc % 32u);
+            uint32_t i = find_breakpoint(vm, pc);
+            uint8_t opcode = (i < vm->breakpoint_count) ? vm->breakpoints[i].opcode : insn.header.opcode;
+            pc += insn.size;
+            if (opcode == OP_JMP_TABLE) pc += insn.imm[0].u32 * 4u;
+        }
+        vm->break_starts_valid = true;
+    }
+    return target < vm->program_len && ((starts[target / 32u] >> (target % 32u)) & 1u) != 0u;
+}
+
+vm_status_t vm_break_set(vm_state_t* vm, uint32_t pc) {
+    if (vm->linked != NULL) return VM_ERR_LINK;
+    /* Attached code may be a shared or read-only mapping, so it is copied first */
+    if (vm->patch == NULL && vm->program_len > PROGRAM_MAX_SIZE) return VM_ERR_PROGRAM_TOO_LARGE;
+    if (!is_instruction_start(vm, pc)) return VM_ERR_INVALID_PC;
+    if (vm->code[pc] == OP_BREAK) return VM_OK;  /* Already set, or part of the program */
+    if (vm->breakpoint_count == VM_MAX_BREAKPOINTS) return VM_ERR_BOUNDS;
+    if (vm->patch == NULL) {
+        memcpy(vm->program, vm->code, vm->program_len);
+        vm->code = vm->program;
+        vm->patch = vm->program;
+    }
+    vm_breakpoint_t* bp = &vm->breakpoints[vm->breakpoint_count++];
+    bp->pc = pc;
+    bp->opcode = vm->patch[pc];
+    vm->patch[pc] = OP_BREAK;
+    return VM_OK;
+}
+
+vm_status_t vm_break_allow_patch(vm_state_t* vm, uint8_t* region, uint32_t len,
+                                 uint32_t* starts, uint32_t starts_words) {
+    const uintptr_t start = (uintptr_t)region;
+    const uintptr_t code = (uintptr_t)vm->code;
+    if (code < start || code - start > len || len - (code - start) < vm->program_len) return VM_ERR_BOUNDS;
+    if (starts_words < VM_BREAK_STARTS_WORDS(vm->program_len)) return VM_ERR_BOUNDS;
+    vm->patch = &region[code - start];
+    vm->break_starts = starts;
+    vm->break_starts_valid = false;
+    return VM_OK;
+}
+
+vm_status_t vm_break_clear(vm_state_t* vm, uint32_t pc) {
+    uint32_t i = find_breakpoint(vm, pc);
+    if (i == vm->breakpoint_count) return VM_ERR_INVALID_PC;
+    vm->patch[pc] = vm->breakpoints[i].opcode;
+    vm->breakpoints[i] = vm->breakpoints[--vm->breakpoint_count];
+    return VM_OK;
+}
+
+vm_status_t vm_break_continue(vm_state_t* vm) {
+    const uint32_t pc = vm->pc;
+    uint32_t i = find_breakpoint(vm, pc);
+    if (i == vm->breakpoint_count) {
+        vm_instruction_t insn;
+        vm_status_t status = vm_decode_instruction(vm->code, vm->program_len, pc, vm->encoding, &insn);
+        if (status != VM_OK || insn.header.opcode != OP_BREAK) return vm_step(vm);
+        vm->pc = pc + insn.size;
+        vm->last_error = VM_OK;
+        return VM_OK;
+    }
+    /* Nothing else runs this code meanwhile, so the original byte is
+     * simply put back for one step; only this path pays for breakpoints */
+    vm->patch[pc] = vm->breakpoints[i].opcode;
+    vm_status_t status = vm_step(vm);
+    vm->patch[pc] = OP_BREAK;
+    return status;
+}
+
 void vm_disassemble_instruction(const vm_state_t* vm, uint32_t pc) {
-    if (pc >= vm->program_len || vm->program_len - pc < 4) {
-        print_hex16((uint16_t)pc);
+    vm_instruction_t insn;
+    if (vm_decode_instruction(vm->code, vm->program_len, pc, vm->encoding, &insn) != VM_OK) {
+        print_hex32(pc);
         (void)fputs(": <invalid>\n", stdout);
         return;
     }
     
-    instruction_header_t hdr;
-    memcpy(&hdr, &vm->program[pc], 4);
-    print_hex16((uint16_t)pc);
+    print_hex32(pc);
     (void)fputs(": ", stdout);
-    (void)fputs(opcode_to_string(hdr.opcode), stdout);
+    (void)fputs(opcode_to_string(insn.header.opcode), stdout);
     (void)fputc('\n', stdout);
 }
 
 void vm_dump_state(const vm_state_t* vm) {
     (void)fputs("=== VM State ===\n", stdout);
     (void)fputs("PC: ", stdout);
-    print_hex16((uint16_t)vm->pc);
+    print_hex32(vm->pc);
     (void)fputs("  SP: ", stdout);
-    print_u32(vm->sp);
+    print_u32(NULL, vm->sp);
     (void)fputs("  Flags: ", stdout);
     print_hex8(vm->flags);
     (void)fputc('\n', stdout);
@@ -1334,22 +3195,26 @@ void vm_dump_state(const vm_state_t* vm) {
     (void)fputc('\n', stdout);
     
     (void)fputs("\nStack Frame ", stdout);
-    print_u32(vm->sp);
+    print_u32(NULL, vm->sp);
     (void)fputs(":\n", stdout);
     for (uint32_t i = 0; i < STACK_VAR_COUNT; i++) {
         var_value_t* v = (var_value_t*)&vm->stack_frames[vm->sp].stack_vars[i];
         if (v->type != V_VOID) {
             (void)fputs("  s", stdout);
-            print_u32(i);
+            print_u32(NULL, i);
             (void)fputs(": ", stdout);
             (void)fputs(var_type_to_string(v->type), stdout);
             (void)fputs(" = ", stdout);
             if (v->type == V_I32) {
-                print_i32(v->val.i32);
+                print_i32(NULL, v->val.i32);
             } else if (v->type == V_U32) {
-                print_u32(v->val.u32);
+                print_u32(NULL, v->val.u32);
             } else if (v->type == V_FLOAT) {
-                print_f32(v->val.f32);
+                print_f32(NULL, v->val.f32);
+            } else if (v->type == V_I64) {
+                print_i64(NULL, v->val.i64);
+            } else if (v->type == V_U64) {
+                print_u64(NULL, v->val.u64);
             }
             (void)fputc('\n', stdout);
         }